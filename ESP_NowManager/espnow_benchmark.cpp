@@ -0,0 +1,153 @@
+// espnow_benchmark.cpp
+#include "espnow_benchmark.hpp"
+#include "esp_log.h"
+#include <string.h>
+#include <algorithm>
+
+#define TAG "ESPNOW_BENCH"
+
+namespace {
+
+// Locally administered addresses, distinct from any real radio
+constexpr uint8_t SENDER_MAC[ESPNOW_MAC_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+constexpr uint8_t RECEIVER_MAC[ESPNOW_MAC_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+
+}
+
+EspNowBenchmark::EspNowBenchmark(const EspNowSimConfig &link)
+    : medium(link), senderRadio(medium, SENDER_MAC), receiverRadio(medium, RECEIVER_MAC),
+      sender(&senderRadio), receiver(&receiverRadio)
+{
+    resultMutex = xSemaphoreCreateMutex();
+}
+
+esp_err_t EspNowBenchmark::begin()
+{
+    receiver.registerCommandHandler([this](const uint8_t *mac, const uint8_t *data, size_t len)
+                                    { onMessage(data, len); });
+    if (!sender.begin(RECEIVER_MAC) || !receiver.begin(SENDER_MAC))
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+void EspNowBenchmark::setLink(const EspNowSimConfig &link)
+{
+    medium.setConfig(link);
+}
+
+// Receiver task. Messages left over from an earlier run are not counted.
+void EspNowBenchmark::onMessage(const uint8_t *data, size_t len)
+{
+    if (len < ESPNOW_BENCHMARK_MIN_PAYLOAD)
+        return;
+    uint32_t id;
+    int64_t sentUs;
+    memcpy(&id, data, sizeof(id));
+    memcpy(&sentUs, data + sizeof(id), sizeof(sentUs));
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(resultMutex, portMAX_DELAY);
+    if (id == runId)
+    {
+        latencies.push_back(now - sentUs);
+        deliveredBytes += len;
+        lastDeliveryUs = now;
+    }
+    xSemaphoreGive(resultMutex);
+}
+
+// Sends bench.messages back to back, each stamped with the time it was handed
+// to the sender, then waits until all arrived or deliveries stop coming.
+esp_err_t EspNowBenchmark::run(const EspNowBenchmarkCase &bench, EspNowBenchmarkResult &result)
+{
+    result = {};
+    if (bench.payloadLen < ESPNOW_BENCHMARK_MIN_PAYLOAD || bench.payloadLen > ESPNOW_MAX_MESSAGE_LEN ||
+        bench.messages == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    std::vector<uint8_t> message(bench.payloadLen);
+    for (size_t i = 0; i < message.size(); ++i)
+        message[i] = i;
+    sender.setSendWindow(bench.window);
+
+    xSemaphoreTake(resultMutex, portMAX_DELAY);
+    uint32_t id = ++runId;
+    latencies.clear();
+    latencies.reserve(bench.messages);
+    deliveredBytes = 0;
+    xSemaphoreGive(resultMutex);
+
+    EspNowStats before = sender.getStats();
+    int64_t startUs = esp_timer_get_time();
+    for (size_t i = 0; i < bench.messages; ++i)
+    {
+        int64_t now = esp_timer_get_time();
+        memcpy(message.data(), &id, sizeof(id));
+        memcpy(message.data() + sizeof(id), &now, sizeof(now));
+        esp_err_t err = sender.sendWithAck(RECEIVER_MAC, message.data(), message.size());
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Send failed: %s", esp_err_to_name(err));
+            return err;
+        }
+    }
+
+    int64_t waitFromUs = esp_timer_get_time();
+    std::vector<uint32_t> sorted;
+    size_t bytes;
+    int64_t lastUs;
+    while (true)
+    {
+        xSemaphoreTake(resultMutex, portMAX_DELAY);
+        size_t delivered = latencies.size();
+        lastUs = lastDeliveryUs;
+        if (delivered >= bench.messages || esp_timer_get_time() - std::max(waitFromUs, lastUs) > IDLE_TIMEOUT_MS * 1000LL)
+        {
+            sorted = latencies;
+            bytes = deliveredBytes;
+            runId++;    // anything later is no longer this run's
+            xSemaphoreGive(resultMutex);
+            break;
+        }
+        xSemaphoreGive(resultMutex);
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    EspNowStats after = sender.getStats();
+    result.delivered = sorted.size();
+    if (!sorted.empty())
+    {
+        std::sort(sorted.begin(), sorted.end());
+        result.p50Us = sorted[(sorted.size() - 1) * 50 / 100];
+        result.p99Us = sorted[(sorted.size() - 1) * 99 / 100];
+        result.goodputKbps = lastUs > startUs ? bytes * 8000.0f / (lastUs - startUs) : 0;
+    }
+    result.retransmissions = after.retransmissions - before.retransmissions;
+    result.fastRetransmissions = after.fastRetransmissions - before.fastRetransmissions;
+    result.dropped = after.dropped - before.dropped;
+    result.passed = result.delivered == bench.messages &&
+                    (bench.minGoodputKbps <= 0 || result.goodputKbps >= bench.minGoodputKbps) &&
+                    (bench.maxP99Us == 0 || result.p99Us <= bench.maxP99Us);
+    return ESP_OK;
+}
+
+esp_err_t EspNowBenchmark::runAll(const EspNowBenchmarkCase *cases, size_t count)
+{
+    bool allPassed = true;
+    ESP_LOGI(TAG, "window payload   msgs  delivered  goodput(kbps)  p50(us)  p99(us)  rtx  fast  dropped");
+    for (size_t i = 0; i < count; ++i)
+    {
+        EspNowBenchmarkResult result;
+        esp_err_t err = run(cases[i], result);
+        if (err != ESP_OK)
+            return err;
+        ESP_LOGI(TAG, "%6u %7u %6u %10u %14.1f %8lu %8lu %4lu %5lu %8lu  %s",
+                 cases[i].window, (unsigned)cases[i].payloadLen, (unsigned)cases[i].messages,
+                 (unsigned)result.delivered, result.goodputKbps, (unsigned long)result.p50Us,
+                 (unsigned long)result.p99Us, (unsigned long)result.retransmissions,
+                 (unsigned long)result.fastRetransmissions, (unsigned long)result.dropped,
+                 result.passed ? "pass" : "FAIL");
+        allPassed &= result.passed;
+    }
+    return allPassed ? ESP_OK : ESP_FAIL;
+}
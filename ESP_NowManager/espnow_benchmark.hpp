@@ -0,0 +1,64 @@
+// espnow_benchmark.hpp
+#pragma once
+
+#include "espnow_comm.hpp"
+#include "espnow_sim_radio.hpp"
+#include <vector>
+
+// Smallest message the benchmark can time: run id and send timestamp
+static constexpr size_t ESPNOW_BENCHMARK_MIN_PAYLOAD = 12;
+
+struct EspNowBenchmarkCase {
+    uint16_t window;                // send window in fragments, 1-16
+    size_t payloadLen;              // bytes per message, at least ESPNOW_BENCHMARK_MIN_PAYLOAD
+    size_t messages;
+    float minGoodputKbps;           // gate, 0 to skip
+    uint32_t maxP99Us;              // gate, 0 to skip
+};
+
+struct EspNowBenchmarkResult {
+    size_t delivered;               // messages that reached the receiver's handler
+    float goodputKbps;              // delivered payload over the time to the last delivery
+    uint32_t p50Us;                 // delivery latency, from the sendWithAck() call
+    uint32_t p99Us;
+    uint32_t retransmissions;
+    uint32_t fastRetransmissions;
+    uint32_t dropped;
+    bool passed;                    // every message delivered and the case's gates met
+};
+
+// Two managers on a simulated medium, one sending to the other, for measuring
+// the protocol rather than the air. Run the cases before and after a protocol
+// change with the same link and seed: a case that no longer meets its gates
+// fails the run. Heavy on RAM (two managers); allocate it rather than putting
+// it on a task stack. Its tasks live on after it, so create one per program.
+class EspNowBenchmark {
+public:
+    explicit EspNowBenchmark(const EspNowSimConfig& link = {});
+
+    esp_err_t begin();
+    void setLink(const EspNowSimConfig& link);
+
+    esp_err_t run(const EspNowBenchmarkCase& bench, EspNowBenchmarkResult& result);
+    // Runs and logs every case; ESP_FAIL if any of them did not pass
+    esp_err_t runAll(const EspNowBenchmarkCase* cases, size_t count);
+
+private:
+    // How long a run waits for the next delivery before giving up on the rest
+    static constexpr uint32_t IDLE_TIMEOUT_MS = 2000;
+
+    void onMessage(const uint8_t* data, size_t len);
+
+    EspNowSimMedium medium;
+    EspNowSimRadio senderRadio;
+    EspNowSimRadio receiverRadio;
+    EspNowManager sender;
+    EspNowManager receiver;
+
+    // Filled by the receiver's handler
+    SemaphoreHandle_t resultMutex;
+    uint32_t runId = 0;
+    std::vector<uint32_t> latencies;
+    size_t deliveredBytes = 0;
+    int64_t lastDeliveryUs = 0;
+};
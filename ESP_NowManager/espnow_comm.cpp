@@ -1,91 +1,462 @@
 // espnow_manager.cpp
 #include "espnow_comm.hpp"
+#include "espnow_driver_radio.hpp"
 #include "esp_random.h"
 #include "esp_log.h"
 #include <string.h>
+#include <stdlib.h>
+#include <algorithm>
 
 #define TAG "ESPNOW"
 
-EspNowManager *EspNowManager::instance = nullptr;
+namespace {
 
-EspNowManager::EspNowManager()
+void accumulateStats(EspNowStats &total, const EspNowStats &stats)
+{
+    total.dataSent += stats.dataSent;
+    total.retransmissions += stats.retransmissions;
+    total.fastRetransmissions += stats.fastRetransmissions;
+    total.dropped += stats.dropped;
+    total.duplicatesReceived += stats.duplicatesReceived;
+    total.messagesReassembled += stats.messagesReassembled;
+    total.reassemblyTimeouts += stats.reassemblyTimeouts;
+    total.reassemblyDrops += stats.reassemblyDrops;
+    total.reorderTimeouts += stats.reorderTimeouts;
+    total.framesReceived += stats.framesReceived;
+    total.macSendOk += stats.macSendOk;
+    total.macSendFail += stats.macSendFail;
+}
+
+}
+
+EspNowManager::EspNowManager(EspNowRadio *radio) : radio(radio), pendingTaskHandle(nullptr), rxTaskHandle(nullptr)
 {
     pendingMutex = xSemaphoreCreateMutex();
-    instance = this;
+    rxMutex = xSemaphoreCreateRecursiveMutex();
+    for (auto &peer : peers)
+    {
+        peer.tx.stats = &peer.stats;
+        peer.tx.txMutex = xSemaphoreCreateMutex();
+        peer.tx.windowOpened = xSemaphoreCreateBinary();
+    }
+    groupTx.stats = &groupStats;
+    groupTx.txMutex = xSemaphoreCreateMutex();
+    groupTx.windowOpened = xSemaphoreCreateBinary();
+    memset(peerIndex, -1, sizeof(peerIndex));
+
+    for (int i = 0; i < ESPNOW_PENDING_POOL; ++i)
+    {
+        pool[i].nextFree = i + 1 < ESPNOW_PENDING_POOL ? i + 1 : -1;
+        pool[i].heapPos = -1;
+        pool[i].txTargets = 0;
+        pool[i].txQueued = false;
+    }
+    freeHead = 0;
+    poolFree = xSemaphoreCreateCounting(ESPNOW_PENDING_POOL, ESPNOW_PENDING_POOL);
 }
 
-bool EspNowManager::begin(const uint8_t *mac)
+bool EspNowManager::begin()
 {
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    if (!radio)
+        radio = &EspNowDriverRadio::instance();
+
+    // The radio can deliver as soon as it starts, so its callbacks come first.
+    // Until the tasks exist, frames and completions wait in their rings.
+    radio->setReceiveCallback([this](const EspNowRxInfo &info, const uint8_t *data, size_t len)
+                              {
+                                  if (rxRing.push(info, data, len) && rxTaskHandle)
+                                      xTaskNotifyGive(rxTaskHandle);
+                              });
+    radio->setSendCallback([this](const uint8_t *mac, bool success)
+                           { onSendComplete(mac, success); });
+    radio->setChannelCallback([this](uint8_t newChannel)
+                              { onChannelChanged(newChannel); });
+
+    if (radio->begin() != ESP_OK)
+        return false;
+    // Group sends and beacons
+    if (radio->addPeer(ESPNOW_BROADCAST_MAC) != ESP_OK)
+        return false;
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_start());
-    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
-    ESP_ERROR_CHECK(esp_wifi_set_channel(1, WIFI_SECOND_CHAN_NONE));
-    ESP_ERROR_CHECK(esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR));
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    resetTxChannel(groupTx);
+    channel = radio->getChannel();
+    xSemaphoreGive(pendingMutex);
+
+    xTaskCreatePinnedToCore(rxTask, "EspNowRxTask", 4096, this, 2, &rxTaskHandle, 1);
+    xTaskCreatePinnedToCore(pendingTask, "PendingACKTask", 4096, this, 1, &pendingTaskHandle, 1);
+
+    ESP_LOGI(TAG, "ESP-NOW initialized successfully");
+    return true;
+}
 
-    if (esp_now_init() != ESP_OK)
+bool EspNowManager::begin(const uint8_t *mac)
+{
+    if (!begin())
+        return false;
+    if (addPeer(mac) != ESP_OK)
         return false;
-    esp_now_register_recv_cb(onReceive);
-    esp_now_register_send_cb(onSend);
 
-    // Store target MAC
-    memcpy(this->targetMac, mac, ESP_NOW_ETH_ALEN);
+    xSemaphoreTakeRecursive(rxMutex, portMAX_DELAY);
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    memcpy(defaultMac, mac, ESPNOW_MAC_LEN);
+    hasDefaultPeer = true;
+    lastHeardUs = esp_timer_get_time();
+    xSemaphoreGive(pendingMutex);
+    xSemaphoreGiveRecursive(rxMutex);
+    return true;
+}
 
-    // Add peer
-    esp_now_peer_info_t *peer = (esp_now_peer_info_t *)malloc(sizeof(esp_now_peer_info_t));
-    if (peer == NULL)
+// A fresh session lets the receiver tell a restarted sender from retransmissions.
+// The channel must have nothing in flight.
+void EspNowManager::resetTxChannel(TxChannel &ch)
+{
+    ch.session = esp_random();
+    ch.base = 0;
+    ch.nextSeq = 0;
+    ch.srttUs = 0;
+    ch.rttVarUs = 0;
+    ch.rtoUs = ACK_TIMEOUT_MS * 1000;
+    memset(ch.inFlight, -1, sizeof(ch.inFlight));
+    ch.messagesOpen = 0;
+}
+
+void EspNowManager::resetRxChannel(RxChannel &rx)
+{
+    rx.synced = false;
+    rx.bitmap = 0;
+    rx.reorderHeld = 0;
+    rx.holdSinceUs = 0;
+    for (auto &slot : rx.reassembly)
+        slot.active = false;
+}
+
+esp_err_t EspNowManager::addPeer(const uint8_t *mac, const uint8_t *lmk)
+{
+    if (!pendingTaskHandle)
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTakeRecursive(rxMutex, portMAX_DELAY);
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    int index = findPeer(mac);
+    bool known = index >= 0;
+    if (!known)
     {
-        ESP_LOGE(TAG, "Malloc peer information fail");
-        return ESP_FAIL;
+        for (index = 0; index < ESPNOW_MAX_PEERS && peers[index].used; ++index)
+            ;
     }
 
-    memset(peer, 0, sizeof(esp_now_peer_info_t));
-    peer->channel = 1;
-    peer->ifidx = WIFI_IF_STA;
-    peer->encrypt = false;
+    esp_err_t err = index < ESPNOW_MAX_PEERS ? radio->addPeer(mac, lmk) : ESP_ERR_NO_MEM;
+    if (err == ESP_OK && !known)
+    {
+        Peer &peer = peers[index];
+        peer.used = true;
+        memcpy(peer.mac, mac, ESPNOW_MAC_LEN);
+        resetTxChannel(peer.tx);
+        resetRxChannel(peer.rx);
+        resetRxChannel(peer.groupRx);
+        peer.stats = {};
+        peerMask |= 1UL << index;
+        rebuildPeerIndex();
+    }
+    xSemaphoreGive(pendingMutex);
+    xSemaphoreGiveRecursive(rxMutex);
 
-    memcpy(peer->peer_addr, mac, ESP_NOW_ETH_ALEN);
+    if (err == ESP_ERR_NO_MEM)
+        ESP_LOGE(TAG, "Peer table full");
+    return err;
+}
 
-    esp_err_t ret = esp_now_add_peer(peer);
-    if (ret != ESP_OK)
+esp_err_t EspNowManager::removePeer(const uint8_t *mac)
+{
+    xSemaphoreTakeRecursive(rxMutex, portMAX_DELAY);
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    int index = findPeer(mac);
+    if (index < 0)
     {
-        ESP_LOGE(TAG, "Add peer failed: %s", esp_err_to_name(ret));
-        free(peer);
-        return false;
+        xSemaphoreGive(pendingMutex);
+        xSemaphoreGiveRecursive(rxMutex);
+        return ESP_ERR_NOT_FOUND;
     }
 
-    free(peer);
-    ESP_LOGI(TAG, "ESP-NOW initialized successfully");
-    xTaskCreatePinnedToCore(pendingTask, "PendingACKTask", 4096, this, 1, &pendingTaskHandle, 1);
-    return true;
+    Peer &peer = peers[index];
+    uint32_t bit = 1UL << index;
+    peer.used = false;
+    peerMask &= ~bit;
+    for (int16_t slot : peer.tx.inFlight)
+    {
+        if (slot >= 0)
+            releasePending(pool[slot]);
+    }
+    xSemaphoreGive(peer.tx.windowOpened);
+
+    // Group messages still waiting on the peer count it as missed
+    for (auto &msg : groupMessages)
+    {
+        if (msg.targets & bit)
+            msg.missed |= bit;
+    }
+    for (int16_t slot : groupTx.inFlight)
+    {
+        if (slot < 0)
+            continue;
+        pool[slot].outstanding &= ~bit;
+        pool[slot].txTargets &= ~bit;
+        if (!pool[slot].outstanding)
+            releasePending(pool[slot]);
+    }
+
+    for (RxChannel *rx : {&peer.rx, &peer.groupRx})
+    {
+        for (auto &slot : rx->reassembly)
+        {
+            free(slot.buffer);
+            slot = {};
+        }
+        free(rx->reorder);
+        rx->reorder = nullptr;
+        rx->reorderHeld = 0;
+    }
+    rebuildPeerIndex();
+    if (hasDefaultPeer && memcmp(defaultMac, mac, ESPNOW_MAC_LEN) == 0)
+        hasDefaultPeer = false;
+    esp_err_t err = radio->removePeer(mac);
+    xSemaphoreGive(pendingMutex);
+    xSemaphoreGiveRecursive(rxMutex);
+    return err;
 }
 
-esp_err_t EspNowManager::sendWithAck(const uint8_t *data, size_t len)
+// FNV-1a; the vendor prefix is shared by most peers, so every byte is mixed in
+size_t EspNowManager::macHash(const uint8_t *mac)
 {
-    EspNowPacket pkt = {};
-    pkt.type = MessageType::DATA;
-    pkt.packetId = esp_random();
-    memcpy(pkt.payload, data, len);
-    pkt.payloadLen = len;
-    pkt.checksum = computeChecksum(pkt);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < ESPNOW_MAC_LEN; ++i)
+        hash = (hash ^ mac[i]) * 16777619u;
+    return (hash ^ (hash >> 16)) & (PEER_INDEX_SIZE - 1);
+}
 
-    PendingPacket pending;
-    memcpy(pending.targetMac, targetMac, ESP_NOW_ETH_ALEN);
-    pending.packet = pkt;
-    pending.retriesLeft = MAX_RETRIES;
-    pending.timeoutTick = xTaskGetTickCount() + pdMS_TO_TICKS(ACK_TIMEOUT_MS);
-    pending.ackReceived = false;
+// Caller holds pendingMutex or rxMutex. The index is never more than half full,
+// so a probe always ends at an empty cell.
+int EspNowManager::findPeer(const uint8_t *mac) const
+{
+    for (size_t cell = macHash(mac);; cell = (cell + 1) & (PEER_INDEX_SIZE - 1))
+    {
+        int index = peerIndex[cell];
+        if (index < 0 || memcmp(peers[index].mac, mac, ESPNOW_MAC_LEN) == 0)
+            return index;
+    }
+}
+
+// Caller holds both mutexes. Peers change rarely, so removal simply rebuilds
+// the index instead of deleting from the probe chains.
+void EspNowManager::rebuildPeerIndex()
+{
+    memset(peerIndex, -1, sizeof(peerIndex));
+    for (int index = 0; index < ESPNOW_MAX_PEERS; ++index)
+    {
+        if (!peers[index].used)
+            continue;
+        size_t cell = macHash(peers[index].mac);
+        while (peerIndex[cell] >= 0)
+            cell = (cell + 1) & (PEER_INDEX_SIZE - 1);
+        peerIndex[cell] = index;
+    }
+}
+
+esp_err_t EspNowManager::sendWithAck(const uint8_t *mac, const uint8_t *data, size_t len, TickType_t waitTicks)
+{
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    int index = findPeer(mac);
+    xSemaphoreGive(pendingMutex);
+    if (index < 0)
+        return ESP_ERR_NOT_FOUND;
+    return sendMessage(peers[index].tx, 1UL << index, false, data, len, waitTicks, nullptr);
+}
+
+esp_err_t EspNowManager::sendWithAck(const uint8_t *data, size_t len, TickType_t waitTicks)
+{
+    if (!hasDefaultPeer)
+        return ESP_ERR_INVALID_STATE;
+    return sendWithAck(defaultMac, data, len, waitTicks);
+}
+
+esp_err_t EspNowManager::sendBroadcast(const uint8_t *data, size_t len, TickType_t waitTicks, uint16_t *messageId)
+{
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    uint32_t targets = peerMask;
+    xSemaphoreGive(pendingMutex);
+    if (!targets)
+        return ESP_ERR_NOT_FOUND;
+    return sendMessage(groupTx, targets, true, data, len, waitTicks, messageId);
+}
+
+esp_err_t EspNowManager::sendMulticast(const uint8_t (*macs)[ESPNOW_MAC_LEN], size_t macCount, const uint8_t *data, size_t len,
+                                       TickType_t waitTicks, uint16_t *messageId)
+{
+    uint32_t targets = 0;
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    for (size_t i = 0; i < macCount; ++i)
+    {
+        int index = findPeer(macs[i]);
+        if (index < 0)
+        {
+            xSemaphoreGive(pendingMutex);
+            return ESP_ERR_NOT_FOUND;
+        }
+        targets |= 1UL << index;
+    }
+    xSemaphoreGive(pendingMutex);
+    if (!targets)
+        return ESP_ERR_INVALID_ARG;
+    return sendMessage(groupTx, targets, false, data, len, waitTicks, messageId);
+}
+
+esp_err_t EspNowManager::sendMessage(TxChannel &ch, uint32_t targets, bool broadcast, const uint8_t *data, size_t len,
+                                     TickType_t waitTicks, uint16_t *messageId)
+{
+    size_t count = len == 0 ? 1 : (len + ESPNOW_FRAGMENT_LEN - 1) / ESPNOW_FRAGMENT_LEN;
+    if (count > UINT16_MAX)
+        return ESP_ERR_INVALID_SIZE;
+
+    TickType_t start = xTaskGetTickCount();
+    if (xSemaphoreTake(ch.txMutex, waitTicks) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    esp_err_t err = ESP_OK;
+    size_t queued = 0;
+    uint16_t firstSeq = 0;
+    while (queued < count)
+    {
+        size_t offset = queued * ESPNOW_FRAGMENT_LEN;
+        size_t fragLen = std::min(ESPNOW_FRAGMENT_LEN, len - offset);
+        uint16_t seq;
+        err = enqueueFragment(ch, targets, broadcast, data + offset, fragLen, queued, count, start, waitTicks, seq);
+        if (err != ESP_OK)
+            break;
+        if (queued++ == 0)
+            firstSeq = seq;
+    }
+
+    if (err != ESP_OK && queued > 0 && count > 1)
+    {
+        // The message ends early; don't let it occupy a reassembly slot forever
+        xSemaphoreTake(pendingMutex, portMAX_DELAY);
+        for (int i = 0; i < ESPNOW_REASSEMBLY_SLOTS; i++)
+        {
+            if ((ch.messagesOpen & (1 << i)) && ch.messageEnds[i] == (uint16_t)(firstSeq + count - 1))
+                ch.messageEnds[i] = firstSeq + queued - 1;
+        }
+        // Its sent fragments may all be acknowledged already
+        closePassedMessages(ch);
+        xSemaphoreGive(pendingMutex);
+    }
+
+    if (&ch == &groupTx && queued > 0)
+    {
+        // An incomplete message reaches nobody
+        xSemaphoreTake(pendingMutex, portMAX_DELAY);
+        resolveGroupFragment(firstSeq, err == ESP_OK ? 0 : targets, true);
+        xSemaphoreGive(pendingMutex);
+        if (messageId)
+            *messageId = firstSeq;
+    }
+    xSemaphoreGive(ch.txMutex);
+    return err;
+}
+
+TickType_t EspNowManager::remainingTicks(TickType_t start, TickType_t waitTicks)
+{
+    if (waitTicks == portMAX_DELAY)
+        return portMAX_DELAY;
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    return elapsed >= waitTicks ? 0 : waitTicks - elapsed;
+}
 
+esp_err_t EspNowManager::enqueueFragment(TxChannel &ch, uint32_t targets, bool broadcast, const uint8_t *data, size_t len, uint16_t index,
+                                         uint16_t count, TickType_t start, TickType_t waitTicks, uint16_t &seq)
+{
+    if (xSemaphoreTake(poolFree, remainingTicks(start, waitTicks)) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    // The window limits the sequence span in flight, not the packet count, so the
+    // receiver's SACK bitmap always covers everything the sender may still resend.
+    // A new multi-fragment message also waits until the receiver is guaranteed a
+    // free reassembly slot for it.
+    bool needsSlot = index == 0 && count > 1;
     xSemaphoreTake(pendingMutex, portMAX_DELAY);
-    pendingPackets.push_back(pending);
+    while ((uint16_t)(ch.nextSeq - ch.base) >= sendWindow ||
+           (needsSlot && messagesInFlight(ch) >= ESPNOW_REASSEMBLY_SLOTS))
+    {
+        xSemaphoreGive(pendingMutex);
+        TickType_t wait = remainingTicks(start, waitTicks);
+        if (wait == 0)
+        {
+            xSemaphoreGive(poolFree);
+            return ESP_ERR_TIMEOUT;
+        }
+        xSemaphoreTake(ch.windowOpened, wait);
+        xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    }
+
+    // Targets removed while we waited no longer count
+    targets &= peerMask;
+    if (!targets)
+    {
+        xSemaphoreGive(pendingMutex);
+        xSemaphoreGive(poolFree);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int16_t slot = freeHead;
+    PendingPacket &pending = pool[slot];
+    freeHead = pending.nextFree;
+    seq = ch.nextSeq++;
+    ch.inFlight[seq % WINDOW_SIZE] = slot;
+    if (needsSlot)
+    {
+        int entry = __builtin_ctz(~ch.messagesOpen);
+        ch.messageEnds[entry] = seq + count - 1;
+        ch.messagesOpen |= 1 << entry;
+    }
+
+    pending.packet.type = &ch == &groupTx ? MessageType::GROUP_DATA : MessageType::DATA;
+    pending.packet.session = ch.session;
+    pending.packet.seq = seq;
+    pending.packet.fragIndex = index;
+    pending.packet.fragCount = count;
+    pending.packet.payloadLen = len;
+    memcpy(pending.packet.payload, data, len);
+    pending.ch = &ch;
+    pending.outstanding = targets;
+    pending.broadcast = broadcast;
+    pending.retransmitted = false;
+    pending.retriesLeft = MAX_RETRIES;
+    pending.rtoUs = ch.rtoUs;
+    pending.sentUs = esp_timer_get_time();
+
+    if (pending.packet.type == MessageType::GROUP_DATA)
+    {
+        if (index == 0)
+            groupMessages.push_back({seq, 0, false, targets, 0});
+        for (auto &msg : groupMessages)
+        {
+            if (msg.id == (uint16_t)(seq - index))
+                msg.unresolved++;
+        }
+    }
+    transmit(pending, targets, pending.sentUs);
+    ch.stats->dataSent++;
+    // Wake the pending task if this is now the earliest deadline
+    if (pending.heapPos == 0)
+        xTaskNotifyGive(pendingTaskHandle);
     xSemaphoreGive(pendingMutex);
 
-    return esp_now_send(targetMac, (uint8_t *)&pkt, sizeof(pkt));
+    return ESP_OK;
+}
+
+void EspNowManager::registerGroupDeliveryHandler(GroupDeliveryHandler handler)
+{
+    groupDeliveryHandler = handler;
 }
 
 void EspNowManager::registerCommandHandler(std::function<void(const uint8_t *mac, const uint8_t *data, size_t len)> handler)
@@ -93,102 +464,1012 @@ void EspNowManager::registerCommandHandler(std::function<void(const uint8_t *mac
     commandHandler = handler;
 }
 
-void EspNowManager::onReceive(const esp_now_recv_info_t *esp_now_info, const uint8_t *data, int len)
+void EspNowManager::registerStreamHandler(StreamHandler handler)
 {
-    if (instance)
-        instance->processReceivedPacket(esp_now_info, data, len);
+    streamHandler = handler;
 }
 
-void EspNowManager::onSend(const uint8_t *mac_addr, esp_now_send_status_t status)
+void EspNowManager::setOrderedDelivery(bool ordered)
 {
-    // Optional: log success/failure
+    orderedDelivery = ordered;
 }
 
-void EspNowManager::processReceivedPacket(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+void EspNowManager::setSendWindow(uint16_t fragments)
 {
-    if (memcmp(info->src_addr, targetMac, ESP_NOW_ETH_ALEN) != 0) {
-        ESP_LOGW(TAG, "Received packet from unknown MAC — ignored");
-        return;
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    sendWindow = std::max<uint16_t>(1, std::min<uint16_t>(fragments, WINDOW_SIZE));
+    xSemaphoreGive(pendingMutex);
+    // Senders waiting on a smaller window recheck it
+    for (auto &peer : peers)
+        xSemaphoreGive(peer.tx.windowOpened);
+    xSemaphoreGive(groupTx.windowOpened);
+}
+
+uint8_t EspNowManager::getChannel()
+{
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    uint8_t current = channel;
+    xSemaphoreGive(pendingMutex);
+    return current;
+}
+
+EspNowStats EspNowManager::getStats()
+{
+    xSemaphoreTakeRecursive(rxMutex, portMAX_DELAY);
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    EspNowStats total = {};
+    accumulateStats(total, groupStats);
+    for (const auto &peer : peers)
+    {
+        if (peer.used)
+            accumulateStats(total, peer.stats);
     }
+    xSemaphoreGive(pendingMutex);
+    xSemaphoreGiveRecursive(rxMutex);
+    total.rxOverflows = rxRing.overflows();
+    total.rxQueueHighWater = rxRing.maxDepth();
+    return total;
+}
 
-    if (len < sizeof(EspNowPacket) - 200)
-        return;
-    EspNowPacket pkt;
-    memcpy(&pkt, data, len);
+bool EspNowManager::getPeerStats(const uint8_t *mac, EspNowStats &out)
+{
+    xSemaphoreTakeRecursive(rxMutex, portMAX_DELAY);
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    int index = findPeer(mac);
+    if (index >= 0)
+    {
+        out = peers[index].stats;
+        out.srttUs = peers[index].tx.srttUs;
+        out.rtoUs = peers[index].tx.rtoUs;
+    }
+    xSemaphoreGive(pendingMutex);
+    xSemaphoreGiveRecursive(rxMutex);
+    return index >= 0;
+}
 
-    if (pkt.type == MessageType::ACK)
+// Caller holds pendingMutex. Queues the packet for targets and restarts its
+// timer; the frame itself is built when pumpTx hands it to the radio.
+void EspNowManager::transmit(PendingPacket &pending, uint32_t targets, int64_t now)
+{
+    schedule(pending, now + pending.rtoUs);
+    pending.txTargets |= targets;
+    if (!pending.txQueued)
     {
-        xSemaphoreTake(pendingMutex, portMAX_DELAY);
-        for (auto &pending : pendingPackets)
+        pending.txQueued = true;
+        txQueue[(txQueueHead + txQueueCount++) % ESPNOW_PENDING_POOL] = &pending - pool;
+    }
+    pumpTx();
+}
+
+// Caller holds pendingMutex. Queues an ACK or beacon ahead of all data. One
+// already waiting for the same peer with the same type is replaced, as the
+// newer one carries everything the older did.
+void EspNowManager::queueControl(const uint8_t *mac, const uint8_t *frame, size_t len)
+{
+    ControlFrame *control = nullptr;
+    for (int i = 0; i < controlCount && !control; ++i)
+    {
+        ControlFrame &queued = controlQueue[(controlHead + i) % CONTROL_QUEUE_LEN];
+        if (queued.frame[0] == frame[0] && memcmp(queued.mac, mac, ESPNOW_MAC_LEN) == 0)
+            control = &queued;
+    }
+    if (!control && controlCount < CONTROL_QUEUE_LEN)
+    {
+        control = &controlQueue[(controlHead + controlCount++) % CONTROL_QUEUE_LEN];
+        memcpy(control->mac, mac, ESPNOW_MAC_LEN);
+    }
+    if (control)
+    {
+        memcpy(control->frame, frame, len);
+        control->len = len;
+    }
+    pumpTx();
+}
+
+// Caller holds pendingMutex
+void EspNowManager::queueBeacon(const uint8_t *mac, uint8_t flags)
+{
+    EspNowPacket beacon = {};
+    beacon.type = MessageType::BEACON;
+    beacon.channel = channel;
+    beacon.flags = flags;
+    uint8_t frame[ESPNOW_BEACON_FRAME_LEN];
+    queueControl(mac, frame, espnowEncodeFrame(beacon, frame));
+}
+
+// Caller holds pendingMutex. Hands queued frames to the radio while credits
+// last: ACKs and beacons first, as they open the peers' windows, then data in
+// queue order.
+// A broadcast still missing several peers goes out once to all of them;
+// otherwise each target gets its own copy.
+void EspNowManager::pumpTx()
+{
+    txBlocked = false;
+    while (controlCount > 0 && txCredits > 0)
+    {
+        ControlFrame &control = controlQueue[controlHead];
+        if (!sendFrame(control.mac, control.frame, control.len))
+            return;
+        controlHead = (controlHead + 1) % CONTROL_QUEUE_LEN;
+        controlCount--;
+    }
+
+    while (txQueueCount > 0 && txCredits > 0)
+    {
+        PendingPacket &pending = pool[txQueue[txQueueHead]];
+        if (pending.txTargets)
         {
-            if (pending.packet.packetId == pkt.packetId)
+            uint8_t frame[ESPNOW_MAX_FRAME_LEN];
+            pending.packet.base = pending.ch->base;
+            size_t len = espnowEncodeFrame(pending.packet, frame);
+            if (pending.broadcast && __builtin_popcount(pending.txTargets) > 1)
             {
-                pending.ackReceived = true;
-                break;
+                if (!sendFrame(ESPNOW_BROADCAST_MAC, frame, len))
+                    return;
+                pending.txTargets = 0;
+            }
+            while (pending.txTargets)
+            {
+                int index = __builtin_ctz(pending.txTargets);
+                if (!sendFrame(peers[index].mac, frame, len))
+                    return;
+                pending.txTargets &= ~(1UL << index);
             }
         }
-        xSemaphoreGive(pendingMutex);
+        pending.txQueued = false;
+        txQueueHead = (txQueueHead + 1) % ESPNOW_PENDING_POOL;
+        txQueueCount--;
     }
-    else if (pkt.type == MessageType::DATA)
+}
+
+// Caller holds pendingMutex. False if the frame has to wait: no credit left,
+// or the radio's queue is full. Frames the radio rejects outright are dropped
+// and left to the retransmission timer.
+bool EspNowManager::sendFrame(const uint8_t *mac, const uint8_t *frame, size_t len)
+{
+    if (txCredits == 0)
+        return false;
+    esp_err_t err = radio->send(mac, frame, len);
+    if (err == ESP_OK)
     {
-        // Validate checksum
-        if (pkt.checksum != computeChecksum(pkt))
-            return;
+        txCredits--;
+        return true;
+    }
+    if (err == ESP_ERR_NO_MEM)
+    {
+        txBlocked = true;
+        return false;
+    }
+    statsFor(mac)->macSendFail++;
+    return true;
+}
 
-        if (commandHandler)
-            commandHandler(info->src_addr, pkt.payload, pkt.payloadLen);
+// Radio send callback, in the Wi-Fi task: only records the result
+void EspNowManager::onSendComplete(const uint8_t *mac, bool success)
+{
+    uint32_t head = completionHead.load(std::memory_order_relaxed);
+    if (head - completionTail.load(std::memory_order_acquire) < COMPLETION_RING_LEN)
+    {
+        TxCompletion &completion = completions[head % COMPLETION_RING_LEN];
+        memcpy(completion.mac, mac, ESPNOW_MAC_LEN);
+        completion.success = success;
+        completionHead.store(head + 1, std::memory_order_release);
+    }
+    if (pendingTaskHandle)
+        xTaskNotifyGive(pendingTaskHandle);
+}
 
-        // Send ACK
-        EspNowPacket ackPkt;
-        ackPkt.type = MessageType::ACK;
-        ackPkt.packetId = pkt.packetId;
-        ackPkt.payloadLen = 0;
-        ackPkt.checksum = computeChecksum(ackPkt);
-        esp_now_send(info->src_addr, (uint8_t *)&ackPkt, sizeof(ackPkt));
+// Caller holds pendingMutex. Returns the credits of completed sends.
+void EspNowManager::processCompletions()
+{
+    uint32_t tail = completionTail.load(std::memory_order_relaxed);
+    uint32_t head = completionHead.load(std::memory_order_acquire);
+    for (; tail != head; ++tail)
+    {
+        const TxCompletion &completion = completions[tail % COMPLETION_RING_LEN];
+        EspNowStats *stats = statsFor(completion.mac);
+        if (completion.success)
+            stats->macSendOk++;
+        else
+            stats->macSendFail++;
+        if (txCredits < ESPNOW_TX_CREDITS)
+            txCredits++;
     }
+    completionTail.store(tail, std::memory_order_release);
 }
 
-void EspNowManager::pendingTask(void *pvParameter)
+// Caller holds pendingMutex. Broadcasts and unknown MACs count towards the group.
+EspNowStats *EspNowManager::statsFor(const uint8_t *mac)
+{
+    int index = findPeer(mac);
+    return index >= 0 ? &peers[index].stats : &groupStats;
+}
+
+// Caller holds pendingMutex. Counts the multi-fragment messages the receiver
+// may still hold a reassembly slot for: those not yet passed by the window
+// base. A message whose fragments are all acknowledged still counts while an
+// earlier packet is missing, as ordered delivery keeps it until then.
+int EspNowManager::messagesInFlight(const TxChannel &ch) const
+{
+    return __builtin_popcount(ch.messagesOpen);
+}
+
+// Caller holds pendingMutex. Frees the entries of messages the base has passed,
+// as it moves: an open message ends within the window, so the distance is only
+// ever taken while it is meaningful, never after the sequence wraps.
+void EspNowManager::closePassedMessages(TxChannel &ch)
+{
+    for (int i = 0; i < ESPNOW_REASSEMBLY_SLOTS; i++)
+    {
+        if ((ch.messagesOpen & (1 << i)) && (int16_t)(ch.messageEnds[i] - ch.base) < 0)
+            ch.messagesOpen &= ~(1 << i);
+    }
+}
+
+// Caller holds pendingMutex. Returns the packet to the pool; targets still
+// outstanding on a group fragment missed it.
+void EspNowManager::releasePending(PendingPacket &pending)
+{
+    TxChannel &ch = *pending.ch;
+    int16_t slot = &pending - pool;
+    ch.inFlight[pending.packet.seq % WINDOW_SIZE] = -1;
+    while (ch.base != ch.nextSeq && ch.inFlight[ch.base % WINDOW_SIZE] < 0)
+        ch.base++;
+    closePassedMessages(ch);
+    unschedule(pending);
+    pending.txTargets = 0;
+    if (pending.packet.type == MessageType::GROUP_DATA)
+        resolveGroupFragment(pending.packet.seq - pending.packet.fragIndex, pending.outstanding, false);
+
+    pending.nextFree = freeHead;
+    freeHead = slot;
+    xSemaphoreGive(ch.windowOpened);
+    xSemaphoreGive(poolFree);
+}
+
+// Caller holds pendingMutex. Sets the packet's deadline and moves it to its
+// place in the heap.
+void EspNowManager::schedule(PendingPacket &pending, int64_t deadlineUs)
+{
+    pending.deadlineUs = deadlineUs;
+    if (pending.heapPos < 0)
+    {
+        pending.heapPos = timerCount;
+        timerHeap[timerCount++] = &pending - pool;
+    }
+    siftUp(pending.heapPos);
+    siftDown(pending.heapPos);
+}
+
+// Caller holds pendingMutex
+void EspNowManager::unschedule(PendingPacket &pending)
+{
+    int pos = pending.heapPos;
+    pending.heapPos = -1;
+    if (pos < 0 || pos == --timerCount)
+        return;
+    timerHeap[pos] = timerHeap[timerCount];
+    pool[timerHeap[pos]].heapPos = pos;
+    siftUp(pos);
+    siftDown(pool[timerHeap[pos]].heapPos);
+}
+
+void EspNowManager::siftUp(int pos)
+{
+    while (pos > 0)
+    {
+        int parent = (pos - 1) / 2;
+        if (pool[timerHeap[parent]].deadlineUs <= pool[timerHeap[pos]].deadlineUs)
+            break;
+        swapTimers(pos, parent);
+        pos = parent;
+    }
+}
+
+void EspNowManager::siftDown(int pos)
 {
-    EspNowManager *self = static_cast<EspNowManager *>(pvParameter);
     while (true)
     {
-        xSemaphoreTake(self->pendingMutex, portMAX_DELAY);
-        for (auto it = self->pendingPackets.begin(); it != self->pendingPackets.end();)
+        int child = 2 * pos + 1;
+        if (child >= timerCount)
+            break;
+        if (child + 1 < timerCount && pool[timerHeap[child + 1]].deadlineUs < pool[timerHeap[child]].deadlineUs)
+            child++;
+        if (pool[timerHeap[pos]].deadlineUs <= pool[timerHeap[child]].deadlineUs)
+            break;
+        swapTimers(pos, child);
+        pos = child;
+    }
+}
+
+void EspNowManager::swapTimers(int a, int b)
+{
+    std::swap(timerHeap[a], timerHeap[b]);
+    pool[timerHeap[a]].heapPos = a;
+    pool[timerHeap[b]].heapPos = b;
+}
+
+// Caller holds pendingMutex. A group message completes once it is sealed and
+// none of its fragments is pending any more.
+void EspNowManager::resolveGroupFragment(uint16_t messageId, uint32_t missed, bool seal)
+{
+    for (auto it = groupMessages.begin(); it != groupMessages.end(); ++it)
+    {
+        if (it->id != messageId)
+            continue;
+        it->missed |= missed;
+        if (seal)
+            it->sealed = true;
+        else
+            it->unresolved--;
+        if (it->sealed && it->unresolved == 0)
+        {
+            completedGroups.push_back(*it);
+            groupMessages.erase(it);
+            xTaskNotifyGive(pendingTaskHandle);
+        }
+        return;
+    }
+}
+
+// Runs on the pending task, outside the locks, so the handler may send again
+void EspNowManager::reportGroupDeliveries()
+{
+    std::vector<GroupMessage> done;
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    done.swap(completedGroups);
+    xSemaphoreGive(pendingMutex);
+
+    for (const auto &msg : done)
+    {
+        if (groupDeliveryHandler)
+            groupDeliveryHandler(msg.id, __builtin_popcount(msg.targets & ~msg.missed), __builtin_popcount(msg.targets));
+    }
+}
+
+// Jacobson/Karels estimator (RFC 6298), fed only by packets that were never retransmitted
+void EspNowManager::updateRtt(TxChannel &ch, int64_t sampleUs)
+{
+    uint32_t sample = sampleUs > 0 ? (uint32_t)sampleUs : 1;
+    if (ch.srttUs == 0)
+    {
+        ch.srttUs = sample;
+        ch.rttVarUs = sample / 2;
+    }
+    else
+    {
+        uint32_t delta = sample > ch.srttUs ? sample - ch.srttUs : ch.srttUs - sample;
+        ch.rttVarUs = (3 * ch.rttVarUs + delta) / 4;
+        ch.srttUs = (7 * ch.srttUs + sample) / 8;
+    }
+    ch.rtoUs = ch.srttUs + 4 * ch.rttVarUs;
+    if (ch.rtoUs < MIN_RTO_US)
+        ch.rtoUs = MIN_RTO_US;
+    else if (ch.rtoUs > MAX_RTO_US)
+        ch.rtoUs = MAX_RTO_US;
+}
+
+void EspNowManager::processReceivedPacket(const EspNowRxInfo &info, const uint8_t *data, size_t len)
+{
+    EspNowPacket pkt;
+    if (!espnowDecodeFrame(data, len, pkt))
+        return;
+
+    xSemaphoreTakeRecursive(rxMutex, portMAX_DELAY);
+    int index = findPeer(info.srcMac);
+    if (index < 0)
+    {
+        xSemaphoreGiveRecursive(rxMutex);
+        ESP_LOGD(TAG, "Received packet from unknown MAC — ignored");
+        return;
+    }
+
+    Peer &peer = peers[index];
+    peer.stats.framesReceived++;
+    peer.stats.rssi = info.rssi;
+    peer.stats.lastRxUs = esp_timer_get_time();
+    if (hasDefaultPeer && memcmp(peer.mac, defaultMac, ESPNOW_MAC_LEN) == 0)
+        lastHeardUs = peer.stats.lastRxUs;
+
+    switch (pkt.type)
+    {
+    case MessageType::ACK:
+        handleAck(index, peer.tx, pkt);
+        break;
+    case MessageType::GROUP_ACK:
+        handleAck(index, groupTx, pkt);
+        break;
+    case MessageType::DATA:
+        handleData(peer, peer.rx, info, pkt);
+        break;
+    case MessageType::GROUP_DATA:
+        handleData(peer, peer.groupRx, info, pkt);
+        break;
+    case MessageType::BEACON:
+        handleBeacon(peer, pkt);
+        break;
+    }
+    xSemaphoreGiveRecursive(rxMutex);
+}
+
+// Caller holds rxMutex. The default peer's beacons set the channel: heard on
+// the wrong one (channels overlap), or straight after it moved.
+void EspNowManager::handleBeacon(const Peer &peer, const EspNowPacket &beacon)
+{
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    if (hasDefaultPeer && memcmp(peer.mac, defaultMac, ESPNOW_MAC_LEN) == 0 && beacon.channel != 0 &&
+        beacon.channel != channel && radio->setChannel(beacon.channel) == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Following default peer to channel %d", beacon.channel);
+        channel = beacon.channel;
+    }
+    if (beacon.flags & ESPNOW_BEACON_PROBE)
+        queueBeacon(peer.mac, 0);
+    xSemaphoreGive(pendingMutex);
+}
+
+// Caller holds rxMutex
+void EspNowManager::handleAck(int peerIndex, TxChannel &ch, const EspNowPacket &ack)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t bit = 1UL << peerIndex;
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    if (ack.session != ch.session)
+    {
+        xSemaphoreGive(pendingMutex);
+        return;
+    }
+
+    // Everything before the cumulative point and each SACKed packet after it;
+    // the ring gives each in-flight sequence number its packet directly.
+    uint16_t cumulative = ack.seq;
+    for (uint16_t seq = ch.base; seq != ch.nextSeq; ++seq)
+    {
+        int16_t slot = ch.inFlight[seq % WINDOW_SIZE];
+        if (slot < 0 || !(pool[slot].outstanding & bit))
+            continue;
+        int16_t offset = (int16_t)(seq - cumulative);
+        if (offset >= 0 && (offset == 0 || offset > SACK_BITS || !(ack.sackBitmap & (1UL << (offset - 1)))))
+            continue;
+
+        PendingPacket &pending = pool[slot];
+        if (!pending.retransmitted)
+            updateRtt(ch, now - pending.sentUs);
+        pending.outstanding &= ~bit;
+        if (!pending.outstanding)
+            releasePending(pending);
+    }
+
+    // Fast retransmit: the receiver holds enough packets beyond the hole at the
+    // cumulative point, and the hole has been out for longer than a round trip,
+    // so it is almost certainly lost rather than just reordered.
+    int16_t hole = ch.inFlight[cumulative % WINDOW_SIZE];
+    if (__builtin_popcount(ack.sackBitmap) >= FAST_RETRANSMIT_THRESHOLD && hole >= 0)
+    {
+        PendingPacket &pending = pool[hole];
+        if (pending.packet.seq == cumulative && (pending.outstanding & bit) && !pending.retransmitted &&
+            pending.retriesLeft > 0 && now - pending.sentUs > (int64_t)ch.srttUs)
+        {
+            pending.retriesLeft--;
+            pending.retransmitted = true;
+            transmit(pending, bit, now);
+            ch.stats->fastRetransmissions++;
+        }
+    }
+    xSemaphoreGive(pendingMutex);
+}
+
+// Marks rx.nextSeq as done and slides past every following packet already held
+void EspNowManager::advanceRxWindow(RxChannel &rx)
+{
+    bool held;
+    do
+    {
+        held = rx.bitmap & 1;
+        rx.bitmap >>= 1;
+        rx.nextSeq++;
+    } while (held);
+}
+
+// Caller holds rxMutex
+void EspNowManager::handleData(Peer &peer, RxChannel &rx, const EspNowRxInfo &info, const EspNowPacket &pkt)
+{
+    if (!rx.synced || pkt.session != rx.session)
+    {
+        // Messages held back for ordering belong to the old session
+        resetRxChannel(rx);
+        rx.synced = true;
+        rx.session = pkt.session;
+        rx.nextSeq = pkt.base;
+    }
+
+    // The sender gave up on everything below its base; stop waiting for it. On
+    // the group channel this also skips messages meant for other peers. Held
+    // messages this releases are passed on before their slots are needed again.
+    bool skipped = (int16_t)(pkt.base - rx.nextSeq) > 0;
+    while ((int16_t)(pkt.base - rx.nextSeq) > 0)
+        advanceRxWindow(rx);
+    if (skipped && orderedDelivery && !streamHandler)
+        flushOrdered(rx, info);
+
+    int16_t offset = (int16_t)(pkt.seq - rx.nextSeq);
+    uint32_t bit = offset > 0 ? 1UL << (offset - 1) : 0;
+    bool fresh = offset == 0 || (offset > 0 && offset <= SACK_BITS && !(rx.bitmap & bit));
+
+    if (fresh)
+    {
+        // A fragment the reassembly layer cannot take yet stays unacknowledged,
+        // so the sender retransmits it once a slot has freed up.
+        if (deliverFragment(peer, rx, info, pkt))
         {
-            if (it->ackReceived)
+            if (offset == 0)
+                advanceRxWindow(rx);
+            else
+                rx.bitmap |= bit;
+        }
+    }
+    else if (offset <= SACK_BITS)
+    {
+        peer.stats.duplicatesReceived++;
+    }
+
+    if (orderedDelivery && !streamHandler)
+        flushOrdered(rx, info);
+
+    // Send ACK
+    EspNowPacket ackPkt;
+    ackPkt.type = pkt.type == MessageType::GROUP_DATA ? MessageType::GROUP_ACK : MessageType::ACK;
+    ackPkt.seq = rx.nextSeq;
+    ackPkt.session = pkt.session;
+    ackPkt.sackBitmap = rx.bitmap;
+    uint8_t frame[ESPNOW_ACK_FRAME_LEN];
+    size_t frameLen = espnowEncodeFrame(ackPkt, frame);
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    queueControl(info.srcMac, frame, frameLen);
+    xSemaphoreGive(pendingMutex);
+}
+
+// Ordered delivery: passes on, oldest first, the held messages whose every
+// earlier sequence number has been received or given up by the sender, then
+// restarts the hold timer if a new gap is now holding the rest.
+void EspNowManager::flushOrdered(RxChannel &rx, const EspNowRxInfo &info)
+{
+    bool more = true;
+    while (more)
+    {
+        int16_t oldest = 0;
+        int cell = -1;
+        Reassembly *message = nullptr;
+        for (uint32_t held = rx.reorderHeld; held; held &= held - 1)
+        {
+            int c = __builtin_ctz(held);
+            int16_t offset = (int16_t)(rx.reorderSeq[c] - rx.nextSeq);
+            if (offset < oldest)
             {
-                it = self->pendingPackets.erase(it);
+                oldest = offset;
+                cell = c;
             }
-            else if (xTaskGetTickCount() >= it->timeoutTick)
+        }
+        for (auto &slot : rx.reassembly)
+        {
+            uint16_t lastSeq = slot.firstSeq + slot.fragCount - 1;
+            int16_t offset = (int16_t)(slot.firstSeq - rx.nextSeq);
+            if (slot.active && slot.complete && (int16_t)(lastSeq - rx.nextSeq) < 0 && offset < oldest)
             {
-                if (it->retriesLeft > 0)
-                {
-                    esp_now_send(it->targetMac, (uint8_t *)&it->packet, sizeof(it->packet));
-                    it->retriesLeft--;
-                    it->timeoutTick = xTaskGetTickCount() + pdMS_TO_TICKS(ACK_TIMEOUT_MS);
-                    ++it;
-                }
-                else
-                {
-                    // Max retries reached, drop packet
-                    it = self->pendingPackets.erase(it);
-                }
+                oldest = offset;
+                message = &slot;
+                cell = -1;
             }
-            else
+        }
+
+        if (message)
+        {
+            message->active = false;
+            if (commandHandler)
+                commandHandler(info.srcMac, message->buffer, message->length);
+        }
+        else if (cell >= 0)
+        {
+            rx.reorderHeld &= ~(1UL << cell);
+            if (commandHandler)
+                commandHandler(info.srcMac, rx.reorder + cell * ESPNOW_FRAGMENT_LEN, rx.reorderLen[cell]);
+        }
+        else
+        {
+            more = false;
+        }
+    }
+
+    bool held = rx.reorderHeld != 0;
+    for (auto &slot : rx.reassembly)
+        held |= slot.active && slot.complete;
+    if (!held)
+        rx.holdSinceUs = 0;
+    else if (!rx.holdSinceUs || rx.holdSeq != rx.nextSeq)
+    {
+        rx.holdSeq = rx.nextSeq;
+        rx.holdSinceUs = esp_timer_get_time();
+    }
+}
+
+// Ordered delivery: skips the gap of every channel that has held messages back
+// for ESPNOW_REORDER_TIMEOUT_MS, as when the sender gave up on it and has sent
+// nothing since to say so, up to the oldest held message, which then goes out.
+// Returns when it next needs to run.
+int64_t EspNowManager::expireOrderedHolds(int64_t now)
+{
+    int64_t deadline = INT64_MAX;
+    if (!orderedDelivery || streamHandler)
+        return deadline;
+
+    xSemaphoreTakeRecursive(rxMutex, portMAX_DELAY);
+    for (auto &peer : peers)
+    {
+        if (!peer.used)
+            continue;
+        for (RxChannel *rx : {&peer.rx, &peer.groupRx})
+        {
+            if (!rx->holdSinceUs)
+                continue;
+            int64_t expiry = rx->holdSinceUs + ESPNOW_REORDER_TIMEOUT_MS * 1000LL;
+            if (expiry > now)
+            {
+                deadline = std::min(deadline, expiry);
+                continue;
+            }
+
+            int16_t oldest = INT16_MAX;
+            for (uint32_t held = rx->reorderHeld; held; held &= held - 1)
+                oldest = std::min<int16_t>(oldest, rx->reorderSeq[__builtin_ctz(held)] - rx->nextSeq);
+            for (auto &slot : rx->reassembly)
             {
-                ++it;
+                if (slot.active && slot.complete)
+                    oldest = std::min<int16_t>(oldest, slot.firstSeq - rx->nextSeq);
             }
+            ESP_LOGW(TAG, "Ordered delivery gave up waiting for %u", rx->nextSeq);
+            peer.stats.reorderTimeouts++;
+            // The held message itself was received, so the window slides past it
+            uint16_t skipTo = rx->nextSeq + oldest;
+            while ((int16_t)(skipTo - rx->nextSeq) >= 0)
+                advanceRxWindow(*rx);
+            EspNowRxInfo info = {peer.mac, peer.stats.rssi};
+            flushOrdered(*rx, info);
+            if (rx->holdSinceUs)
+                deadline = std::min<int64_t>(deadline, rx->holdSinceUs + ESPNOW_REORDER_TIMEOUT_MS * 1000LL);
         }
-        xSemaphoreGive(self->pendingMutex);
-        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    xSemaphoreGiveRecursive(rxMutex);
+    return deadline;
+}
+
+// Returns the slot collecting the message pkt belongs to, claiming a free one
+// for a new message; slots that stopped making progress are reclaimed first.
+// Complete messages held for ordered delivery do not time out.
+EspNowManager::Reassembly *EspNowManager::findReassembly(Peer &peer, RxChannel &rx, uint16_t session, uint16_t firstSeq, int64_t now)
+{
+    Reassembly *free = nullptr;
+    for (auto &slot : rx.reassembly)
+    {
+        if (slot.active && !slot.complete && now - slot.lastUs > ESPNOW_REASSEMBLY_TIMEOUT_MS * 1000LL)
+        {
+            ESP_LOGW(TAG, "Reassembly of message %u timed out", slot.firstSeq);
+            slot.active = false;
+            peer.stats.reassemblyTimeouts++;
+        }
+        if (slot.active && slot.session == session && slot.firstSeq == firstSeq)
+            return &slot;
+        if (!slot.active && !free)
+            free = &slot;
+    }
+    return free;
+}
+
+// Returns false if the fragment could not be buffered and must not be acknowledged
+bool EspNowManager::deliverFragment(Peer &peer, RxChannel &rx, const EspNowRxInfo &info, const EspNowPacket &pkt)
+{
+    if (pkt.fragCount == 0 || pkt.fragIndex >= pkt.fragCount ||
+        (pkt.fragIndex + 1 < pkt.fragCount && pkt.payloadLen != ESPNOW_FRAGMENT_LEN))
+    {
+        peer.stats.reassemblyDrops++;
+        return true;
+    }
+
+    bool ordered = orderedDelivery && !streamHandler;
+
+    // Single-fragment messages skip the reassembly buffers entirely, unless one
+    // has to wait for an earlier message
+    if (pkt.fragCount == 1 && ordered && pkt.seq != rx.nextSeq)
+    {
+        if (!rx.reorder)
+            rx.reorder = (uint8_t *)malloc(WINDOW_SIZE * ESPNOW_FRAGMENT_LEN);
+        if (!rx.reorder)
+        {
+            ESP_LOGE(TAG, "Malloc reorder buffer fail");
+            return false;
+        }
+        size_t cell = pkt.seq % WINDOW_SIZE;
+        memcpy(rx.reorder + cell * ESPNOW_FRAGMENT_LEN, pkt.payload, pkt.payloadLen);
+        rx.reorderSeq[cell] = pkt.seq;
+        rx.reorderLen[cell] = pkt.payloadLen;
+        rx.reorderHeld |= 1UL << cell;
+        return true;
+    }
+    if (pkt.fragCount == 1)
+    {
+        if (streamHandler)
+            streamHandler(info.srcMac, ((uint32_t)pkt.session << 16) | pkt.seq, pkt.payload, pkt.payloadLen, 0, true);
+        else if (commandHandler)
+            commandHandler(info.srcMac, pkt.payload, pkt.payloadLen);
+        return true;
+    }
+
+    if (!streamHandler && pkt.fragCount > MAX_MESSAGE_FRAGMENTS)
+    {
+        ESP_LOGW(TAG, "Message of %u fragments exceeds ESPNOW_MAX_MESSAGE_LEN — dropped", pkt.fragCount);
+        peer.stats.reassemblyDrops++;
+        return true;
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint16_t firstSeq = pkt.seq - pkt.fragIndex;
+    Reassembly *slot = findReassembly(peer, rx, pkt.session, firstSeq, now);
+    if (!slot)
+    {
+        ESP_LOGD(TAG, "No free reassembly slot — fragment deferred");
+        return false;
+    }
+
+    if (!slot->active)
+    {
+        if (!slot->buffer)
+            slot->buffer = (uint8_t *)malloc(REASSEMBLY_BUFFER_LEN);
+        if (!slot->buffer)
+        {
+            ESP_LOGE(TAG, "Malloc reassembly buffer fail");
+            return false;
+        }
+        slot->active = true;
+        slot->session = pkt.session;
+        slot->firstSeq = firstSeq;
+        slot->fragCount = pkt.fragCount;
+        slot->received = 0;
+        slot->nextIndex = 0;
+        slot->complete = false;
+        slot->length = 0;
+        memset(slot->bitmap, 0, sizeof(slot->bitmap));
+    }
+    else if (slot->fragCount != pkt.fragCount)
+    {
+        slot->active = false;
+        peer.stats.reassemblyDrops++;
+        return true;
+    }
+    slot->lastUs = now;
+
+    if (streamHandler)
+    {
+        deliverStreamFragment(peer, *slot, info, pkt);
+        return true;
+    }
+
+    size_t offset = (size_t)pkt.fragIndex * ESPNOW_FRAGMENT_LEN;
+    uint32_t bit = 1UL << (pkt.fragIndex % 32);
+    if (offset + pkt.payloadLen > REASSEMBLY_BUFFER_LEN)
+    {
+        slot->active = false;
+        peer.stats.reassemblyDrops++;
+        return true;
+    }
+    if (slot->bitmap[pkt.fragIndex / 32] & bit)
+        return true;
+
+    memcpy(slot->buffer + offset, pkt.payload, pkt.payloadLen);
+    slot->bitmap[pkt.fragIndex / 32] |= bit;
+    if (pkt.fragIndex + 1 == pkt.fragCount)
+        slot->length = offset + pkt.payloadLen;
+
+    if (++slot->received == slot->fragCount)
+    {
+        peer.stats.messagesReassembled++;
+        if (ordered)
+        {
+            // Passed on by flushOrdered once nothing earlier is missing
+            slot->complete = true;
+            return true;
+        }
+        slot->active = false;
+        if (commandHandler)
+            commandHandler(info.srcMac, slot->buffer, slot->length);
+    }
+    return true;
+}
+
+// Fragments of one message use consecutive sequence numbers, so with the sender
+// window bounding the span in flight, anything not yet passed on lies within
+// WINDOW_SIZE fragments of nextIndex and fits the ring of buffer cells.
+void EspNowManager::deliverStreamFragment(Peer &peer, Reassembly &slot, const EspNowRxInfo &info, const EspNowPacket &pkt)
+{
+    uint32_t messageId = ((uint32_t)slot.session << 16) | slot.firstSeq;
+    uint16_t ahead = pkt.fragIndex - slot.nextIndex;
+    if (pkt.fragIndex < slot.nextIndex)
+        return;
+    if (ahead >= WINDOW_SIZE)
+    {
+        // The sender gave up on the fragment we are waiting for
+        ESP_LOGW(TAG, "Stream message %u lost fragment %u", slot.firstSeq, slot.nextIndex);
+        slot.active = false;
+        peer.stats.reassemblyDrops++;
+        return;
+    }
+
+    bool last = pkt.fragIndex + 1 == slot.fragCount;
+    if (ahead == 0)
+    {
+        streamHandler(info.srcMac, messageId, pkt.payload, pkt.payloadLen, (size_t)slot.nextIndex * ESPNOW_FRAGMENT_LEN, last);
+        slot.nextIndex++;
+    }
+    else
+    {
+        size_t cell = pkt.fragIndex % WINDOW_SIZE;
+        memcpy(slot.buffer + cell * ESPNOW_FRAGMENT_LEN, pkt.payload, pkt.payloadLen);
+        slot.bitmap[0] |= 1UL << cell;
+        if (last)
+            slot.length = pkt.payloadLen;
+    }
+
+    while (slot.nextIndex < slot.fragCount && (slot.bitmap[0] & (1UL << (slot.nextIndex % WINDOW_SIZE))))
+    {
+        size_t cell = slot.nextIndex % WINDOW_SIZE;
+        bool cellLast = slot.nextIndex + 1 == slot.fragCount;
+        slot.bitmap[0] &= ~(1UL << cell);
+        streamHandler(info.srcMac, messageId, slot.buffer + cell * ESPNOW_FRAGMENT_LEN, cellLast ? slot.length : ESPNOW_FRAGMENT_LEN,
+                      (size_t)slot.nextIndex * ESPNOW_FRAGMENT_LEN, cellLast);
+        slot.nextIndex++;
+    }
+
+    if (slot.nextIndex == slot.fragCount)
+    {
+        slot.active = false;
+        peer.stats.messagesReassembled++;
+    }
+}
+
+// Caller holds pendingMutex. Retransmits an expired packet to the targets that
+// have not acknowledged it yet, or gives up on it.
+void EspNowManager::expirePending(PendingPacket &pending, int64_t now)
+{
+    TxChannel &ch = *pending.ch;
+    if (pending.retriesLeft > 0)
+    {
+        pending.retriesLeft--;
+        pending.retransmitted = true;
+        pending.rtoUs = pending.rtoUs * 2 > MAX_RTO_US ? MAX_RTO_US : pending.rtoUs * 2;
+        transmit(pending, pending.outstanding, now);
+        ch.stats->retransmissions++;
+    }
+    else
+    {
+        // Max retries reached, drop packet
+        releasePending(pending);
+        ch.stats->dropped++;
     }
 }
 
-uint16_t EspNowManager::computeChecksum(const EspNowPacket &packet)
+// Validates and dispatches the frames queued by the radio callback, and sends
+// the ACKs, so slow handlers never hold up the Wi-Fi task.
+void EspNowManager::rxTask(void *pvParameter)
 {
-    uint16_t sum = static_cast<uint8_t>(packet.type) + packet.packetId;
-    for (size_t i = 0; i < packet.payloadLen; ++i)
-        sum += packet.payload[i];
-    return sum;
+    EspNowManager *self = static_cast<EspNowManager *>(pvParameter);
+    const int64_t tickUs = portTICK_PERIOD_MS * 1000LL;
+    // Frames received before the task started are already waiting
+    while (true)
+    {
+        while (const EspNowRxFrame *frame = self->rxRing.front())
+        {
+            EspNowRxInfo info = {frame->srcMac, frame->rssi};
+            self->processReceivedPacket(info, frame->data, frame->len);
+            self->rxRing.pop();
+        }
+        int64_t now = esp_timer_get_time();
+        int64_t deadline = self->expireOrderedHolds(now);
+        TickType_t wait = portMAX_DELAY;
+        if (deadline != INT64_MAX)
+            wait = (deadline - now + tickUs - 1) / tickUs;
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+// Caller holds pendingMutex. Sends the periodic beacon and, once the default
+// peer has gone quiet, steps through the channels with a probe on each until it
+// answers. Returns when it next needs to run.
+int64_t EspNowManager::serviceLink(int64_t now)
+{
+    int64_t deadline = INT64_MAX;
+    if (ESPNOW_BEACON_INTERVAL_MS > 0)
+    {
+        if (now >= nextBeaconUs)
+        {
+            queueBeacon(ESPNOW_BROADCAST_MAC, 0);
+            nextBeaconUs = now + ESPNOW_BEACON_INTERVAL_MS * 1000LL;
+        }
+        deadline = nextBeaconUs;
+    }
+    if (!hasDefaultPeer || ESPNOW_LINK_TIMEOUT_MS == 0)
+    {
+        scanning = false;
+        return deadline;
+    }
+
+    int64_t quietUntil = lastHeardUs + ESPNOW_LINK_TIMEOUT_MS * 1000LL;
+    if (now < quietUntil)
+    {
+        if (scanning)
+            ESP_LOGI(TAG, "Default peer found on channel %d", channel);
+        scanning = false;
+        return std::min(deadline, quietUntil);
+    }
+    if (!scanning)
+    {
+        scanning = true;
+        nextScanUs = now;
+        ESP_LOGW(TAG, "Default peer lost, scanning channels");
+    }
+    if (now >= nextScanUs)
+    {
+        uint8_t next = channel % LAST_CHANNEL + 1;
+        if (radio->setChannel(next) == ESP_ERR_INVALID_STATE)
+        {
+            // The station owns the channel; wait for the peer to come to it
+            scanning = false;
+            lastHeardUs = now;
+            return std::min<int64_t>(deadline, now + ESPNOW_LINK_TIMEOUT_MS * 1000LL);
+        }
+        channel = next;
+        queueBeacon(ESPNOW_BROADCAST_MAC, ESPNOW_BEACON_PROBE);
+        nextScanUs = now + SCAN_DWELL_MS * 1000LL;
+    }
+    return std::min(deadline, nextScanUs);
+}
+
+// Radio channel callback: the station joined or roamed to another AP. Peers
+// are told at once rather than at the next beacon.
+void EspNowManager::onChannelChanged(uint8_t newChannel)
+{
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    if (newChannel != channel)
+        ESP_LOGI(TAG, "Station moved to channel %d", newChannel);
+    channel = newChannel;
+    queueBeacon(ESPNOW_BROADCAST_MAC, 0);
+    xSemaphoreGive(pendingMutex);
+}
+
+// Also the TX scheduler, returning credits as send completions arrive and
+// pumping the queues, and the link keeper sending beacons and scanning. Sleeps
+// until the earliest deadline, or until notified of an earlier one, a send
+// completion, a channel change or finished group messages.
+void EspNowManager::pendingTask(void *pvParameter)
+{
+    EspNowManager *self = static_cast<EspNowManager *>(pvParameter);
+    const int64_t tickUs = portTICK_PERIOD_MS * 1000LL;
+    while (true)
+    {
+        xSemaphoreTake(self->pendingMutex, portMAX_DELAY);
+        self->processCompletions();
+        int64_t now = esp_timer_get_time();
+        while (self->timerCount > 0 && self->pool[self->timerHeap[0]].deadlineUs <= now)
+            self->expirePending(self->pool[self->timerHeap[0]], now);
+        int64_t deadline = self->serviceLink(now);
+        if (self->timerCount > 0)
+            deadline = std::min(deadline, self->pool[self->timerHeap[0]].deadlineUs);
+        self->pumpTx();
+        TickType_t wait = portMAX_DELAY;
+        if (self->txBlocked)
+            wait = 1;   // retry the radio's full queue on the next tick
+        else if (deadline != INT64_MAX)
+            wait = (deadline - now + tickUs - 1) / tickUs;
+        xSemaphoreGive(self->pendingMutex);
+
+        self->reportGroupDeliveries();
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
 }
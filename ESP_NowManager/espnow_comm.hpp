@@ -1,8 +1,11 @@
 // espnow_manager.hpp
 #pragma once
 
-#include <esp_now.h>
-#include <esp_wifi.h>
+#include "espnow_radio.hpp"
+#include "espnow_frame.hpp"
+#include "espnow_rx_ring.hpp"
+#include "sdkconfig.h"
+#include <atomic>
 #include <functional>
 #include <vector>
 #include <esp_timer.h>
@@ -10,52 +13,385 @@
 #include <freertos/task.h>
 #include <freertos/semphr.h>
 
-enum class MessageType : uint8_t {
-    DATA = 0x01,
-    ACK = 0x02
-};
+#ifdef CONFIG_ESPNOW_MANAGER_MAX_MESSAGE_LEN
+static constexpr size_t ESPNOW_MAX_MESSAGE_LEN = CONFIG_ESPNOW_MANAGER_MAX_MESSAGE_LEN;
+#else
+static constexpr size_t ESPNOW_MAX_MESSAGE_LEN = 4096;
+#endif
 
-struct EspNowPacket {
-    MessageType type;
-    uint16_t packetId;
-    uint16_t checksum;
-    uint8_t payload[200];
-    size_t payloadLen;
-};
+#ifdef CONFIG_ESPNOW_MANAGER_REASSEMBLY_SLOTS
+static constexpr int ESPNOW_REASSEMBLY_SLOTS = CONFIG_ESPNOW_MANAGER_REASSEMBLY_SLOTS;
+#else
+static constexpr int ESPNOW_REASSEMBLY_SLOTS = 2;
+#endif
+
+#ifdef CONFIG_ESPNOW_MANAGER_REASSEMBLY_TIMEOUT_MS
+static constexpr int ESPNOW_REASSEMBLY_TIMEOUT_MS = CONFIG_ESPNOW_MANAGER_REASSEMBLY_TIMEOUT_MS;
+#else
+static constexpr int ESPNOW_REASSEMBLY_TIMEOUT_MS = 1000;
+#endif
+
+#ifdef CONFIG_ESPNOW_MANAGER_REORDER_TIMEOUT_MS
+static constexpr int ESPNOW_REORDER_TIMEOUT_MS = CONFIG_ESPNOW_MANAGER_REORDER_TIMEOUT_MS;
+#else
+static constexpr int ESPNOW_REORDER_TIMEOUT_MS = 10000;
+#endif
+
+#ifdef CONFIG_ESPNOW_MANAGER_MAX_PEERS
+static constexpr int ESPNOW_MAX_PEERS = CONFIG_ESPNOW_MANAGER_MAX_PEERS;
+#else
+static constexpr int ESPNOW_MAX_PEERS = 20;
+#endif
+
+static_assert(ESPNOW_MAX_PEERS <= 32, "peer sets are tracked in 32-bit masks");
+
+#ifdef CONFIG_ESPNOW_MANAGER_RX_RING_SLOTS
+static constexpr size_t ESPNOW_RX_RING_SLOTS = CONFIG_ESPNOW_MANAGER_RX_RING_SLOTS;
+#else
+static constexpr size_t ESPNOW_RX_RING_SLOTS = 16;
+#endif
+
+#ifdef CONFIG_ESPNOW_MANAGER_TX_CREDITS
+static constexpr int ESPNOW_TX_CREDITS = CONFIG_ESPNOW_MANAGER_TX_CREDITS;
+#else
+static constexpr int ESPNOW_TX_CREDITS = 8;
+#endif
+
+#ifdef CONFIG_ESPNOW_MANAGER_BEACON_INTERVAL_MS
+static constexpr uint32_t ESPNOW_BEACON_INTERVAL_MS = CONFIG_ESPNOW_MANAGER_BEACON_INTERVAL_MS;
+#else
+static constexpr uint32_t ESPNOW_BEACON_INTERVAL_MS = 1000;
+#endif
+
+#ifdef CONFIG_ESPNOW_MANAGER_LINK_TIMEOUT_MS
+static constexpr uint32_t ESPNOW_LINK_TIMEOUT_MS = CONFIG_ESPNOW_MANAGER_LINK_TIMEOUT_MS;
+#else
+static constexpr uint32_t ESPNOW_LINK_TIMEOUT_MS = 3000;
+#endif
 
-struct PendingPacket {
-    uint8_t targetMac[ESP_NOW_ETH_ALEN];
-    EspNowPacket packet;
-    int retriesLeft;
-    TickType_t timeoutTick;
-    bool ackReceived;
+#ifdef CONFIG_ESPNOW_MANAGER_PENDING_POOL
+static constexpr int ESPNOW_PENDING_POOL = CONFIG_ESPNOW_MANAGER_PENDING_POOL;
+#else
+static constexpr int ESPNOW_PENDING_POOL = 32;
+#endif
+
+struct EspNowStats {
+    uint32_t dataSent;
+    uint32_t retransmissions;
+    uint32_t fastRetransmissions;
+    uint32_t dropped;
+    uint32_t duplicatesReceived;
+    uint32_t messagesReassembled;
+    uint32_t reassemblyTimeouts;
+    uint32_t reassemblyDrops;       // no free slot, oversized or inconsistent fragments
+    uint32_t reorderTimeouts;       // ordered delivery: gaps skipped after ESPNOW_REORDER_TIMEOUT_MS
+    uint32_t framesReceived;
+    uint32_t macSendOk;             // frames the radio reported as delivered at the MAC level
+    uint32_t macSendFail;           // frames the radio failed to deliver or refused
+    uint32_t rxOverflows;           // totals only: frames lost to a full receive ring
+    uint32_t rxQueueHighWater;      // totals only: most frames ever waiting in the ring
+    uint32_t srttUs;                // per-peer stats only
+    uint32_t rtoUs;                 // per-peer stats only
+    int8_t rssi;                    // per-peer stats only: last frame received
+    int64_t lastRxUs;               // per-peer stats only: 0 if nothing received yet
 };
 
 class EspNowManager {
 public:
-    EspNowManager();
+    // Passing no radio uses the ESP-NOW driver.
+    explicit EspNowManager(EspNowRadio* radio = nullptr);
+    bool begin();
+    // Starts the manager with mac as its first peer, the destination of
+    // sendWithAck() calls that name no peer. The manager also keeps to this
+    // peer's channel: when it has not been heard for ESPNOW_LINK_TIMEOUT_MS it
+    // steps through the channels probing for it, and retunes to the channel
+    // carried in its beacons.
     bool begin(const uint8_t *mac);
 
-    esp_err_t sendWithAck(const uint8_t* data, size_t len);
+    // Adds a peer, or updates its key if it is already known. With an lmk of
+    // ESPNOW_KEY_LEN bytes its unicast traffic is encrypted by the radio.
+    // Both ends must add each other; frames from unknown MACs are ignored.
+    esp_err_t addPeer(const uint8_t* mac, const uint8_t* lmk = nullptr);
+    esp_err_t removePeer(const uint8_t* mac);
+
+    // Queues a message of any length into the peer's send window, split into
+    // ESPNOW_FRAGMENT_LEN fragments. Blocks up to waitTicks while the window is
+    // full; must not be called from the command handler with a wait. On timeout
+    // part of the message may already be in flight; the receiver discards it.
+    // Each peer has its own window, so a slow peer does not hold up the others.
+    esp_err_t sendWithAck(const uint8_t* mac, const uint8_t* data, size_t len, TickType_t waitTicks = portMAX_DELAY);
+    esp_err_t sendWithAck(const uint8_t* data, size_t len, TickType_t waitTicks = portMAX_DELAY);
+
+    // Group sends share one sequence space across all peers. A broadcast goes on
+    // air once to every peer (unencrypted, as ESP-NOW does not encrypt broadcast);
+    // a multicast is addressed to each listed peer in turn. Every fragment is
+    // retransmitted until all targets acknowledged it, and the group delivery
+    // handler is called once per message with the number of peers that got all
+    // of it. messageId, if given, receives the id passed to that handler.
+    esp_err_t sendBroadcast(const uint8_t* data, size_t len, TickType_t waitTicks = portMAX_DELAY, uint16_t* messageId = nullptr);
+    esp_err_t sendMulticast(const uint8_t (*macs)[ESPNOW_MAC_LEN], size_t macCount, const uint8_t* data, size_t len,
+                            TickType_t waitTicks = portMAX_DELAY, uint16_t* messageId = nullptr);
+
+    // Called from the manager's task, which may send again from it.
+    using GroupDeliveryHandler = std::function<void(uint16_t messageId, size_t delivered, size_t targeted)>;
+    void registerGroupDeliveryHandler(GroupDeliveryHandler handler);
+
+    // Receives whole messages of up to ESPNOW_MAX_MESSAGE_LEN bytes. This and the
+    // stream handler run on the manager's receive task, not in the Wi-Fi task.
     void registerCommandHandler(std::function<void(const uint8_t* mac, const uint8_t* data, size_t len)> handler);
 
+    // Streaming mode: when set, fragments are passed on in order within their
+    // message as soon as they are contiguous, with no limit on message length,
+    // instead of going to the command handler. Fragments of different messages
+    // may interleave; `messageId` tells them apart for a given sender and
+    // `offset` is the fragment's byte position in its message.
+    using StreamHandler = std::function<void(const uint8_t* mac, uint32_t messageId, const uint8_t* data, size_t len, size_t offset, bool last)>;
+    void registerStreamHandler(StreamHandler handler);
+
+    // Every message reaches the handlers at most once. With ordered delivery the
+    // command handler also sees each sender's messages in the order they were
+    // sent (separately for unicast and group traffic): a message completed early
+    // is held until every earlier one has arrived or been given up by the sender,
+    // for at most ESPNOW_REORDER_TIMEOUT_MS.
+    void setOrderedDelivery(bool ordered);
+
+    // Caps the sequence span each sender keeps in flight, from 1 up to the
+    // protocol's 16 fragments (the default); mostly for benchmarking.
+    void setSendWindow(uint16_t fragments);
+
+    // Channel the manager is on, following the station's when Wi-Fi is connected
+    uint8_t getChannel();
+
+    // Totals over all peers and group sends
+    EspNowStats getStats();
+    bool getPeerStats(const uint8_t* mac, EspNowStats& out);
+
 private:
-    static void onReceive(const esp_now_recv_info_t* esp_now_info, const uint8_t* data, int data_len);
-    static void onSend(const uint8_t* mac_addr, esp_now_send_status_t status);
+    static constexpr int MAX_RETRIES = 3;
+    static constexpr int ACK_TIMEOUT_MS = 300;
+    static constexpr int WINDOW_SIZE = 16;          // sequence span in flight, at most SACK_BITS + 1
+    static constexpr int SACK_BITS = 32;
+    static constexpr int FAST_RETRANSMIT_THRESHOLD = 3;
+    static constexpr uint32_t MIN_RTO_US = 20 * 1000;
+    static constexpr uint32_t MAX_RTO_US = 2000 * 1000;
+    static constexpr size_t MAX_MESSAGE_FRAGMENTS = (ESPNOW_MAX_MESSAGE_LEN + ESPNOW_FRAGMENT_LEN - 1) / ESPNOW_FRAGMENT_LEN;
+    // Stream mode keeps out-of-order fragments in a ring of WINDOW_SIZE cells
+    static constexpr size_t REASSEMBLY_BUFFER_LEN = ESPNOW_MAX_MESSAGE_LEN > WINDOW_SIZE * ESPNOW_FRAGMENT_LEN
+                                                        ? ESPNOW_MAX_MESSAGE_LEN
+                                                        : WINDOW_SIZE * ESPNOW_FRAGMENT_LEN;
+    // Open-addressed MAC index, kept at most half full
+    static constexpr size_t PEER_INDEX_SIZE = 64;
+    // Queued control frames are coalesced per peer and type: an ACK per channel
+    // and a beacon per peer, plus the broadcast beacon
+    static constexpr int CONTROL_QUEUE_LEN = 3 * ESPNOW_MAX_PEERS + 1;
+    // Time spent listening on each channel while looking for the default peer
+    static constexpr uint32_t SCAN_DWELL_MS = 100;
+    static constexpr uint8_t LAST_CHANNEL = 13;
+    // Send completions in flight never exceed the credits
+    static constexpr uint32_t COMPLETION_RING_LEN = 64;
+    static_assert(ESPNOW_TX_CREDITS <= (int)COMPLETION_RING_LEN, "completion ring must cover every credit");
 
-    void processReceivedPacket(const esp_now_recv_info_t* info, const uint8_t* data, int len);
-    static void pendingTask(void* pvParameter);
+    // A message being reassembled, identified by the sequence number of its
+    // first fragment. Only touched from the receive task.
+    struct Reassembly {
+        bool active;
+        uint16_t session;
+        uint16_t firstSeq;
+        uint16_t fragCount;
+        uint16_t received;      // whole-message mode: fragments stored so far
+        uint16_t nextIndex;     // stream mode: next fragment to pass on
+        uint32_t bitmap[(MAX_MESSAGE_FRAGMENTS + 31) / 32];  // stream mode: word 0, bit index % WINDOW_SIZE
+        bool complete;          // ordered delivery: waiting for earlier messages
+        size_t length;
+        int64_t lastUs;         // last fragment received, for the timeout
+        uint8_t* buffer;        // REASSEMBLY_BUFFER_LEN bytes, allocated on first use
+    };
+
+    // Sending side of one sequence space: a peer's unicast traffic, or the group
+    // channel. Guarded by pendingMutex apart from the two semaphores.
+    struct TxChannel {
+        uint16_t session;
+        uint16_t base;          // oldest unacknowledged sequence, nextSeq if none
+        uint16_t nextSeq;
+        uint32_t srttUs;
+        uint32_t rttVarUs;
+        uint32_t rtoUs;
+        int16_t inFlight[WINDOW_SIZE];  // pool index by seq % WINDOW_SIZE, -1 if free
+        uint16_t messageEnds[ESPNOW_REASSEMBLY_SLOTS];  // last seq of recent multi-fragment messages
+        uint8_t messagesOpen;   // bit per messageEnds entry the base has not passed
+        EspNowStats* stats;
+        SemaphoreHandle_t txMutex;      // keeps the fragments of one message consecutive
+        SemaphoreHandle_t windowOpened;
+    };
+
+    // Receiving side of one sequence space. Only touched from the receive task.
+    struct RxChannel {
+        bool synced;
+        uint16_t session;
+        uint16_t nextSeq;
+        uint32_t bitmap;
+        Reassembly reassembly[ESPNOW_REASSEMBLY_SLOTS];
+        // Ordered delivery: single-fragment messages received ahead of a gap, in
+        // cells of ESPNOW_FRAGMENT_LEN bytes by seq % WINDOW_SIZE
+        uint32_t reorderHeld;
+        uint16_t reorderSeq[WINDOW_SIZE];
+        uint16_t reorderLen[WINDOW_SIZE];
+        uint8_t* reorder;       // allocated on first use
+        uint16_t holdSeq;       // the gap messages are held for, from holdSinceUs
+        int64_t holdSinceUs;    // 0 if nothing is held
+    };
 
-    static uint16_t computeChecksum(const EspNowPacket& packet);
+    struct Peer {
+        bool used;
+        uint8_t mac[ESPNOW_MAC_LEN];
+        TxChannel tx;
+        RxChannel rx;           // the peer's unicast traffic
+        RxChannel groupRx;      // the peer's broadcasts and multicasts
+        EspNowStats stats;
+    };
 
-    static EspNowManager* instance;
-    std::vector<PendingPacket> pendingPackets;
+    // A group message whose fragments are not all resolved yet
+    struct GroupMessage {
+        uint16_t id;            // sequence number of the first fragment
+        uint16_t unresolved;    // fragments still pending
+        bool sealed;            // every fragment has been queued
+        uint32_t targets;
+        uint32_t missed;        // targets that lost at least one fragment
+    };
+
+    // An unacknowledged fragment. Lives in the fixed pool and, while in flight,
+    // in its channel's inFlight ring and the deadline heap. Guarded by pendingMutex.
+    struct PendingPacket {
+        EspNowPacket packet;
+        TxChannel* ch;
+        uint32_t outstanding;   // peer-table bits still to acknowledge
+        bool broadcast;         // sent to the broadcast address rather than peer by peer
+        bool retransmitted;
+        int retriesLeft;
+        int64_t sentUs;         // first transmission, for RTT sampling
+        int64_t deadlineUs;
+        uint32_t rtoUs;         // per-packet timeout, doubled on every retransmission
+        int16_t heapPos;        // index in timerHeap
+        int16_t nextFree;
+        uint32_t txTargets;     // peers still to be handed a copy by pumpTx
+        bool txQueued;          // the pool index is in txQueue, possibly from a previous use
+    };
+
+    // ACK or beacon waiting for the radio
+    struct ControlFrame {
+        uint8_t mac[ESPNOW_MAC_LEN];
+        uint8_t len;
+        uint8_t frame[ESPNOW_ACK_FRAME_LEN];
+    };
+    static_assert(ESPNOW_BEACON_FRAME_LEN <= ESPNOW_ACK_FRAME_LEN, "beacons are queued as control frames");
+
+    struct TxCompletion {
+        uint8_t mac[ESPNOW_MAC_LEN];
+        bool success;
+    };
+
+    void processReceivedPacket(const EspNowRxInfo& info, const uint8_t* data, size_t len);
+    void handleAck(int peerIndex, TxChannel& ch, const EspNowPacket& ack);
+    void handleData(Peer& peer, RxChannel& rx, const EspNowRxInfo& info, const EspNowPacket& pkt);
+    void handleBeacon(const Peer& peer, const EspNowPacket& beacon);
+    void advanceRxWindow(RxChannel& rx);
+    void flushOrdered(RxChannel& rx, const EspNowRxInfo& info);
+    int64_t expireOrderedHolds(int64_t now);
+    esp_err_t sendMessage(TxChannel& ch, uint32_t targets, bool broadcast, const uint8_t* data, size_t len, TickType_t waitTicks, uint16_t* messageId);
+    esp_err_t enqueueFragment(TxChannel& ch, uint32_t targets, bool broadcast, const uint8_t* data, size_t len, uint16_t index,
+                              uint16_t count, TickType_t start, TickType_t waitTicks, uint16_t& seq);
+    bool deliverFragment(Peer& peer, RxChannel& rx, const EspNowRxInfo& info, const EspNowPacket& pkt);
+    void deliverStreamFragment(Peer& peer, Reassembly& slot, const EspNowRxInfo& info, const EspNowPacket& pkt);
+    Reassembly* findReassembly(Peer& peer, RxChannel& rx, uint16_t session, uint16_t firstSeq, int64_t now);
+    void transmit(PendingPacket& pending, uint32_t targets, int64_t now);
+    void queueControl(const uint8_t* mac, const uint8_t* frame, size_t len);
+    void queueBeacon(const uint8_t* mac, uint8_t flags);
+    int64_t serviceLink(int64_t now);
+    void onChannelChanged(uint8_t newChannel);
+    void pumpTx();
+    bool sendFrame(const uint8_t* mac, const uint8_t* frame, size_t len);
+    void onSendComplete(const uint8_t* mac, bool success);
+    void processCompletions();
+    EspNowStats* statsFor(const uint8_t* mac);
+    void expirePending(PendingPacket& pending, int64_t now);
+    void schedule(PendingPacket& pending, int64_t deadlineUs);
+    void unschedule(PendingPacket& pending);
+    void siftUp(int pos);
+    void siftDown(int pos);
+    void swapTimers(int a, int b);
+    void updateRtt(TxChannel& ch, int64_t sampleUs);
+    void releasePending(PendingPacket& pending);
+    void resolveGroupFragment(uint16_t messageId, uint32_t missed, bool seal);
+    void reportGroupDeliveries();
+    int messagesInFlight(const TxChannel& ch) const;
+    static void closePassedMessages(TxChannel& ch);
+    int findPeer(const uint8_t* mac) const;
+    void rebuildPeerIndex();
+    static size_t macHash(const uint8_t* mac);
+    static TickType_t remainingTicks(TickType_t start, TickType_t waitTicks);
+    static void resetTxChannel(TxChannel& ch);
+    static void resetRxChannel(RxChannel& rx);
+    static void pendingTask(void* pvParameter);
+    static void rxTask(void* pvParameter);
+
+    EspNowRadio* radio;
     std::function<void(const uint8_t* mac, const uint8_t* data, size_t len)> commandHandler;
-    SemaphoreHandle_t pendingMutex;
+    StreamHandler streamHandler;
+    bool orderedDelivery = false;
+    GroupDeliveryHandler groupDeliveryHandler;
+    SemaphoreHandle_t pendingMutex;     // sender state and the peer table
+    SemaphoreHandle_t rxMutex;          // receiver state and the peer table, recursive
     TaskHandle_t pendingTaskHandle;
+    TaskHandle_t rxTaskHandle;
 
-    static constexpr int MAX_RETRIES = 3;
-    static constexpr int ACK_TIMEOUT_MS = 300;
+    // Filled by the radio callback, drained by rxTask
+    EspNowRxRing<ESPNOW_RX_RING_SLOTS> rxRing;
+
+    // Fixed pool of pending packets with a min-heap on their deadlines, so the
+    // pending task sleeps until the earliest one instead of polling.
+    PendingPacket pool[ESPNOW_PENDING_POOL];
+    int16_t timerHeap[ESPNOW_PENDING_POOL];
+    int timerCount = 0;
+    int16_t freeHead;
+    SemaphoreHandle_t poolFree;         // counts free pool entries
+
+    // TX scheduler (guarded by pendingMutex). At most ESPNOW_TX_CREDITS frames
+    // are handed to the radio before their send completions come back; the
+    // rest wait here, control frames ahead of data.
+    uint16_t sendWindow = WINDOW_SIZE;
+    int txCredits = ESPNOW_TX_CREDITS;
+    bool txBlocked = false;             // the radio's own queue was full
+    ControlFrame controlQueue[CONTROL_QUEUE_LEN];
+    int controlHead = 0;
+    int controlCount = 0;
+    int16_t txQueue[ESPNOW_PENDING_POOL];
+    int txQueueHead = 0;
+    int txQueueCount = 0;
+
+    // Send completions, pushed by the radio's send callback and drained by the
+    // pending task: single producer, single consumer
+    TxCompletion completions[COMPLETION_RING_LEN];
+    std::atomic<uint32_t> completionHead{0};
+    std::atomic<uint32_t> completionTail{0};
+
+    // Channel tracking (guarded by pendingMutex). Every manager beacons its
+    // channel; one that stops hearing its default peer scans for it.
+    uint8_t channel = 0;
+    bool scanning = false;
+    int64_t nextBeaconUs = 0;
+    int64_t nextScanUs = 0;
+    std::atomic<int64_t> lastHeardUs{0};   // last frame from the default peer
+
+    // Flat peer table; a peer's position is its bit in peer masks
+    Peer peers[ESPNOW_MAX_PEERS] = {};
+    int8_t peerIndex[PEER_INDEX_SIZE];
+    uint32_t peerMask = 0;
+
+    TxChannel groupTx = {};
+    EspNowStats groupStats = {};
+    std::vector<GroupMessage> groupMessages;
+    std::vector<GroupMessage> completedGroups;
 
-    uint8_t targetMac[ESP_NOW_ETH_ALEN];
+    bool hasDefaultPeer = false;
+    uint8_t defaultMac[ESPNOW_MAC_LEN];
 };
@@ -0,0 +1,147 @@
+// espnow_driver_radio.cpp
+#include "espnow_driver_radio.hpp"
+#include "esp_log.h"
+#include <string.h>
+
+#define TAG "ESPNOW"
+
+EspNowDriverRadio& EspNowDriverRadio::instance()
+{
+    static EspNowDriverRadio radio;
+    return radio;
+}
+
+esp_err_t EspNowDriverRadio::begin()
+{
+    if (started)
+        return ESP_OK;
+
+    wifi_mode_t mode;
+    if (esp_wifi_get_mode(&mode) == ESP_OK)
+    {
+        if (mode != WIFI_MODE_STA && mode != WIFI_MODE_APSTA)
+        {
+            ESP_LOGE(TAG, "Wi-Fi is running without a station interface");
+            return ESP_ERR_INVALID_STATE;
+        }
+        wifi_ap_record_t ap;
+        staConnected = esp_wifi_sta_get_ap_info(&ap) == ESP_OK;
+        ESP_LOGI(TAG, "Attached to running Wi-Fi on channel %d", getChannel());
+    }
+    else
+    {
+        esp_err_t ret = startWifi();
+        if (ret != ESP_OK)
+            return ret;
+    }
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, onWifiEvent, nullptr));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, onWifiEvent, nullptr));
+
+    esp_err_t ret = esp_now_init();
+    if (ret != ESP_OK)
+        return ret;
+    esp_now_register_recv_cb(onReceive);
+    esp_now_register_send_cb(onSend);
+
+    started = true;
+    return ESP_OK;
+}
+
+// Wi-Fi for ESP-NOW alone: station mode, not connected, on the default channel
+esp_err_t EspNowDriverRadio::startWifi()
+{
+    ESP_ERROR_CHECK(esp_netif_init());
+    esp_err_t ret = esp_event_loop_create_default();
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
+        return ret;
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_start());
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+    ESP_ERROR_CHECK(esp_wifi_set_channel(ESPNOW_DEFAULT_CHANNEL, WIFI_SECOND_CHAN_NONE));
+    ESP_ERROR_CHECK(esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR));
+    return ESP_OK;
+}
+
+esp_err_t EspNowDriverRadio::addPeer(const uint8_t* mac, const uint8_t* lmk)
+{
+    esp_now_peer_info_t peer = {};
+    peer.channel = 0;   // whatever channel the radio is on, so peers follow a retune
+    peer.ifidx = WIFI_IF_STA;
+    peer.encrypt = lmk != nullptr;
+    if (lmk)
+        memcpy(peer.lmk, lmk, ESP_NOW_KEY_LEN);
+    memcpy(peer.peer_addr, mac, ESP_NOW_ETH_ALEN);
+
+    esp_err_t ret = esp_now_is_peer_exist(mac) ? esp_now_mod_peer(&peer) : esp_now_add_peer(&peer);
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "Add peer failed: %s", esp_err_to_name(ret));
+    return ret;
+}
+
+esp_err_t EspNowDriverRadio::removePeer(const uint8_t* mac)
+{
+    if (!esp_now_is_peer_exist(mac))
+        return ESP_OK;
+    return esp_now_del_peer(mac);
+}
+
+esp_err_t EspNowDriverRadio::send(const uint8_t* mac, const uint8_t* data, size_t len)
+{
+    esp_err_t ret = esp_now_send(mac, data, len);
+    return ret == ESP_ERR_ESPNOW_NO_MEM ? ESP_ERR_NO_MEM : ret;
+}
+
+uint8_t EspNowDriverRadio::getChannel()
+{
+    uint8_t primary;
+    wifi_second_chan_t second;
+    return esp_wifi_get_channel(&primary, &second) == ESP_OK ? primary : 0;
+}
+
+esp_err_t EspNowDriverRadio::setChannel(uint8_t channel)
+{
+    if (staConnected)
+        return ESP_ERR_INVALID_STATE;
+    return esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+}
+
+void EspNowDriverRadio::onReceive(const esp_now_recv_info_t* esp_now_info, const uint8_t* data, int data_len)
+{
+    EspNowDriverRadio& self = instance();
+    if (!self.receiveCb || data_len <= 0)
+        return;
+
+    EspNowRxInfo info;
+    info.srcMac = esp_now_info->src_addr;
+    info.rssi = esp_now_info->rx_ctrl ? esp_now_info->rx_ctrl->rssi : 0;
+    self.receiveCb(info, data, data_len);
+}
+
+void EspNowDriverRadio::onSend(const uint8_t* mac_addr, esp_now_send_status_t status)
+{
+    EspNowDriverRadio& self = instance();
+    if (self.sendCb)
+        self.sendCb(mac_addr, status == ESP_NOW_SEND_SUCCESS);
+}
+
+// The station's channel is set by its AP: report it on every (re)connect
+void EspNowDriverRadio::onWifiEvent(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    EspNowDriverRadio& self = instance();
+    if (event_id == WIFI_EVENT_STA_CONNECTED)
+    {
+        auto* event = static_cast<wifi_event_sta_connected_t*>(event_data);
+        self.staConnected = true;
+        if (self.channelCb)
+            self.channelCb(event->channel);
+    }
+    else if (event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        self.staConnected = false;
+    }
+}
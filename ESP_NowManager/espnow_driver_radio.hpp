@@ -0,0 +1,46 @@
+// espnow_driver_radio.hpp
+#pragma once
+
+#include "espnow_radio.hpp"
+#include "sdkconfig.h"
+#include <atomic>
+#include <esp_event.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+
+#ifdef CONFIG_ESPNOW_MANAGER_CHANNEL
+static constexpr uint8_t ESPNOW_DEFAULT_CHANNEL = CONFIG_ESPNOW_MANAGER_CHANNEL;
+#else
+static constexpr uint8_t ESPNOW_DEFAULT_CHANNEL = 1;
+#endif
+
+// EspNowRadio backed by the ESP-IDF ESP-NOW driver. The driver only accepts plain
+// function callbacks, so there is exactly one instance.
+//
+// If Wi-Fi is already running (e.g. WiFiManager::begin was called first), begin()
+// attaches to it and leaves its configuration alone; ESP-NOW then shares the
+// station's channel and follows it when the station connects or roams. Otherwise
+// it brings up Wi-Fi in station mode itself, on ESPNOW_DEFAULT_CHANNEL.
+class EspNowDriverRadio : public EspNowRadio {
+public:
+    static EspNowDriverRadio& instance();
+
+    esp_err_t begin() override;
+    esp_err_t addPeer(const uint8_t* mac, const uint8_t* lmk = nullptr) override;
+    esp_err_t removePeer(const uint8_t* mac) override;
+    esp_err_t send(const uint8_t* mac, const uint8_t* data, size_t len) override;
+    uint8_t getChannel() override;
+    esp_err_t setChannel(uint8_t channel) override;
+
+private:
+    EspNowDriverRadio() = default;
+
+    esp_err_t startWifi();
+
+    static void onReceive(const esp_now_recv_info_t* esp_now_info, const uint8_t* data, int data_len);
+    static void onSend(const uint8_t* mac_addr, esp_now_send_status_t status);
+    static void onWifiEvent(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+
+    bool started = false;
+    std::atomic<bool> staConnected{false};
+};
@@ -0,0 +1,130 @@
+// espnow_frame.cpp
+#include "espnow_frame.hpp"
+#include <string.h>
+
+namespace {
+
+// CRC-16/CCITT-FALSE (poly 0x1021), one table lookup per byte
+struct Crc16Table {
+    uint16_t entries[256];
+    constexpr Crc16Table() : entries()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            uint16_t crc = i << 8;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+            entries[i] = crc;
+        }
+    }
+};
+
+constexpr Crc16Table crcTable;
+
+inline void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+inline void put32(uint8_t* p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+inline uint16_t get16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+inline uint32_t get32(const uint8_t* p)
+{
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+inline bool isAck(MessageType type)
+{
+    return type == MessageType::ACK || type == MessageType::GROUP_ACK;
+}
+
+uint16_t frameCrc(const uint8_t* frame, size_t len)
+{
+    uint16_t crc = espnowCrc16(frame, 5);
+    return espnowCrc16(frame + ESPNOW_COMMON_HEADER_LEN, len - ESPNOW_COMMON_HEADER_LEN, crc);
+}
+
+}
+
+uint16_t espnowCrc16(const uint8_t* data, size_t len, uint16_t crc)
+{
+    for (size_t i = 0; i < len; ++i)
+        crc = (crc << 8) ^ crcTable.entries[(crc >> 8) ^ data[i]];
+    return crc;
+}
+
+size_t espnowEncodeFrame(const EspNowPacket& pkt, uint8_t* out)
+{
+    size_t len;
+    out[0] = (ESPNOW_PROTOCOL_VERSION << 4) | static_cast<uint8_t>(pkt.type);
+    put16(out + 1, pkt.session);
+    put16(out + 3, pkt.seq);
+    if (isAck(pkt.type))
+    {
+        put32(out + 7, pkt.sackBitmap);
+        len = ESPNOW_ACK_FRAME_LEN;
+    }
+    else if (pkt.type == MessageType::BEACON)
+    {
+        out[7] = pkt.channel;
+        out[8] = pkt.flags;
+        len = ESPNOW_BEACON_FRAME_LEN;
+    }
+    else
+    {
+        put16(out + 7, pkt.base);
+        put16(out + 9, pkt.fragIndex);
+        put16(out + 11, pkt.fragCount);
+        memcpy(out + ESPNOW_DATA_HEADER_LEN, pkt.payload, pkt.payloadLen);
+        len = ESPNOW_DATA_HEADER_LEN + pkt.payloadLen;
+    }
+    put16(out + 5, frameCrc(out, len));
+    return len;
+}
+
+bool espnowDecodeFrame(const uint8_t* data, size_t len, EspNowPacket& pkt)
+{
+    if (len < ESPNOW_COMMON_HEADER_LEN || len > ESPNOW_MAX_FRAME_LEN || (data[0] >> 4) != ESPNOW_PROTOCOL_VERSION)
+        return false;
+    if (get16(data + 5) != frameCrc(data, len))
+        return false;
+
+    pkt.type = static_cast<MessageType>(data[0] & 0x0f);
+    pkt.session = get16(data + 1);
+    pkt.seq = get16(data + 3);
+    if (isAck(pkt.type))
+    {
+        if (len != ESPNOW_ACK_FRAME_LEN)
+            return false;
+        pkt.sackBitmap = get32(data + 7);
+        pkt.payloadLen = 0;
+        return true;
+    }
+    if (pkt.type == MessageType::BEACON)
+    {
+        if (len != ESPNOW_BEACON_FRAME_LEN)
+            return false;
+        pkt.channel = data[7];
+        pkt.flags = data[8];
+        pkt.payloadLen = 0;
+        return true;
+    }
+    if ((pkt.type != MessageType::DATA && pkt.type != MessageType::GROUP_DATA) || len < ESPNOW_DATA_HEADER_LEN)
+        return false;
+    pkt.base = get16(data + 7);
+    pkt.fragIndex = get16(data + 9);
+    pkt.fragCount = get16(data + 11);
+    pkt.payloadLen = len - ESPNOW_DATA_HEADER_LEN;
+    memcpy(pkt.payload, data + ESPNOW_DATA_HEADER_LEN, pkt.payloadLen);
+    return true;
+}
@@ -0,0 +1,71 @@
+// espnow_frame.hpp
+#pragma once
+
+#include "sdkconfig.h"
+#include <cstddef>
+#include <cstdint>
+
+#ifdef CONFIG_ESPNOW_MANAGER_V2_FRAMES
+static constexpr size_t ESPNOW_MAX_FRAME_LEN = 1470;   // ESP_NOW_MAX_DATA_LEN_V2
+#else
+static constexpr size_t ESPNOW_MAX_FRAME_LEN = 250;    // ESP_NOW_MAX_DATA_LEN
+#endif
+
+// Wire format, little-endian and unpadded. Only the header and the payload
+// bytes actually used go on air; the payload length is the frame length minus
+// the header.
+//
+//   0  u8   version << 4 | type
+//   1  u16  session
+//   3  u16  seq         DATA: sequence number, ACK: next expected sequence
+//   5  u16  crc         CRC-16/CCITT-FALSE over the frame, this field excluded
+//   DATA, GROUP_DATA:
+//   7  u16  base        oldest unacknowledged sequence at the sender
+//   9  u16  fragIndex
+//   11 u16  fragCount
+//   13 ...  payload
+//   ACK, GROUP_ACK:
+//   7  u32  sackBitmap  bit i set => seq + 1 + i was received
+//   BEACON (session and seq unused):
+//   7  u8   channel     Wi-Fi channel the sender is on
+//   8  u8   flags       ESPNOW_BEACON_PROBE
+static constexpr uint8_t ESPNOW_PROTOCOL_VERSION = 1;
+static constexpr size_t ESPNOW_COMMON_HEADER_LEN = 7;
+static constexpr size_t ESPNOW_DATA_HEADER_LEN = 13;
+static constexpr size_t ESPNOW_ACK_FRAME_LEN = 11;
+static constexpr size_t ESPNOW_BEACON_FRAME_LEN = 9;
+static constexpr size_t ESPNOW_FRAGMENT_LEN = ESPNOW_MAX_FRAME_LEN - ESPNOW_DATA_HEADER_LEN;
+
+enum class MessageType : uint8_t {
+    DATA = 0x01,
+    ACK = 0x02,
+    GROUP_DATA = 0x03,      // broadcast/multicast channel, laid out as DATA
+    GROUP_ACK = 0x04,       // laid out as ACK
+    BEACON = 0x05
+};
+
+// Beacon flag: the sender is looking for its peers and asks for a beacon back
+static constexpr uint8_t ESPNOW_BEACON_PROBE = 0x01;
+
+// Decoded form of a frame
+struct EspNowPacket {
+    MessageType type;
+    uint16_t session;       // sender session, re-randomised on every begin()
+    uint16_t seq;
+    uint16_t base;
+    uint16_t fragIndex;     // position of this fragment in its message
+    uint16_t fragCount;     // fragments in the message (consecutive sequence numbers)
+    uint16_t payloadLen;
+    uint32_t sackBitmap;
+    uint8_t channel;        // BEACON only
+    uint8_t flags;          // BEACON only
+    uint8_t payload[ESPNOW_FRAGMENT_LEN];
+};
+
+// Serialises pkt into out (at least ESPNOW_MAX_FRAME_LEN bytes); returns the frame length
+size_t espnowEncodeFrame(const EspNowPacket& pkt, uint8_t* out);
+
+// Parses and CRC-checks a received frame; false if it is malformed or of another version
+bool espnowDecodeFrame(const uint8_t* data, size_t len, EspNowPacket& pkt);
+
+uint16_t espnowCrc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF);
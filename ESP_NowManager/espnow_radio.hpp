@@ -0,0 +1,51 @@
+// espnow_radio.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <esp_err.h>
+
+static constexpr size_t ESPNOW_MAC_LEN = 6;
+static constexpr size_t ESPNOW_KEY_LEN = 16;
+static constexpr uint8_t ESPNOW_BROADCAST_MAC[ESPNOW_MAC_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+struct EspNowRxInfo {
+    const uint8_t* srcMac;
+    int8_t rssi;
+};
+
+// Link-layer abstraction below EspNowManager. The ESP-NOW driver implements it on
+// target; a host build can substitute a mock to exercise the protocol without Wi-Fi.
+class EspNowRadio {
+public:
+    using ReceiveCallback = std::function<void(const EspNowRxInfo& info, const uint8_t* data, size_t len)>;
+    using SendCallback = std::function<void(const uint8_t* mac, bool success)>;
+    using ChannelCallback = std::function<void(uint8_t channel)>;
+
+    virtual ~EspNowRadio() = default;
+
+    virtual esp_err_t begin() = 0;
+    // Adds the peer, or updates it if it exists; a non-null lmk (ESPNOW_KEY_LEN
+    // bytes) encrypts its unicast traffic.
+    virtual esp_err_t addPeer(const uint8_t* mac, const uint8_t* lmk = nullptr) = 0;
+    virtual esp_err_t removePeer(const uint8_t* mac) = 0;
+    // Queues one frame. Returns ESP_ERR_NO_MEM while the link's queue is full;
+    // every accepted frame is later reported once through the send callback.
+    virtual esp_err_t send(const uint8_t* mac, const uint8_t* data, size_t len) = 0;
+
+    // Current primary channel, 0 if unknown
+    virtual uint8_t getChannel() = 0;
+    // Retunes the radio. ESP_ERR_INVALID_STATE while a connected station owns
+    // the channel; the channel callback then reports where its AP moves it.
+    virtual esp_err_t setChannel(uint8_t channel) = 0;
+
+    void setReceiveCallback(ReceiveCallback cb) { receiveCb = cb; }
+    void setSendCallback(SendCallback cb) { sendCb = cb; }
+    void setChannelCallback(ChannelCallback cb) { channelCb = cb; }
+
+protected:
+    ReceiveCallback receiveCb;
+    SendCallback sendCb;
+    ChannelCallback channelCb;
+};
@@ -0,0 +1,75 @@
+// espnow_rx_ring.hpp
+#pragma once
+
+#include "espnow_radio.hpp"
+#include "espnow_frame.hpp"
+#include <atomic>
+#include <string.h>
+
+// A received frame as copied out of the radio callback
+struct EspNowRxFrame {
+    uint8_t srcMac[ESPNOW_MAC_LEN];
+    int8_t rssi;
+    uint16_t len;
+    uint8_t data[ESPNOW_MAX_FRAME_LEN];
+};
+
+// Lock-free single-producer/single-consumer ring of preallocated frames. The
+// radio callback copies each frame into the next free slot and publishes it;
+// the receive task processes the oldest slot in place and then releases it.
+template <size_t Capacity>
+class EspNowRxRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // Producer only. False if the ring is full or the frame is too long.
+    bool push(const EspNowRxInfo& info, const uint8_t* data, size_t len)
+    {
+        if (len > ESPNOW_MAX_FRAME_LEN)
+            return false;
+
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t depth = h - tail.load(std::memory_order_acquire);
+        if (depth == Capacity)
+        {
+            overflowCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        EspNowRxFrame& frame = slots[h & (Capacity - 1)];
+        memcpy(frame.srcMac, info.srcMac, ESPNOW_MAC_LEN);
+        frame.rssi = info.rssi;
+        frame.len = len;
+        memcpy(frame.data, data, len);
+        head.store(h + 1, std::memory_order_release);
+
+        if (depth + 1 > highWater.load(std::memory_order_relaxed))
+            highWater.store(depth + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer only. The oldest frame, valid until pop(), or nullptr if empty.
+    const EspNowRxFrame* front()
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return nullptr;
+        return &slots[t & (Capacity - 1)];
+    }
+
+    // Consumer only
+    void pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint32_t overflows() const { return overflowCount.load(std::memory_order_relaxed); }
+    uint32_t maxDepth() const { return highWater.load(std::memory_order_relaxed); }
+
+private:
+    EspNowRxFrame slots[Capacity];
+    std::atomic<uint32_t> head{0};      // written by the producer
+    std::atomic<uint32_t> tail{0};      // written by the consumer
+    std::atomic<uint32_t> overflowCount{0};
+    std::atomic<uint32_t> highWater{0};
+};
@@ -0,0 +1,216 @@
+// espnow_sim_radio.cpp
+#include "espnow_sim_radio.hpp"
+#include "esp_timer.h"
+#include <string.h>
+#include <algorithm>
+
+namespace {
+
+// Min-heap order for std::push_heap/pop_heap, which keep the largest on top
+template <typename Event>
+bool laterEvent(const Event &a, const Event &b)
+{
+    return a.dueUs != b.dueUs ? a.dueUs > b.dueUs : (int32_t)(a.order - b.order) > 0;
+}
+
+}
+
+EspNowSimMedium::EspNowSimMedium(const EspNowSimConfig &config)
+    : config(config), randomState(config.seed ? config.seed : 1)
+{
+    mutex = xSemaphoreCreateMutex();
+}
+
+void EspNowSimMedium::setConfig(const EspNowSimConfig &newConfig)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    config = newConfig;
+    randomState = config.seed ? config.seed : 1;
+    xSemaphoreGive(mutex);
+}
+
+void EspNowSimMedium::attach(EspNowSimRadio *radio)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (std::find(radios.begin(), radios.end(), radio) == radios.end())
+        radios.push_back(radio);
+    if (!taskHandle)
+        xTaskCreatePinnedToCore(mediumTask, "EspNowSimTask", 4096, this, 3, &taskHandle, 1);
+    xSemaphoreGive(mutex);
+}
+
+// xorshift32: reproducible across runs and platforms, unlike esp_random()
+uint32_t EspNowSimMedium::nextRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+bool EspNowSimMedium::chance(float rate)
+{
+    return rate > 0 && nextRandom() < rate * 4294967296.0f;
+}
+
+// The frame occupies the sender's airtime after whatever it is still sending,
+// then reaches each listening radio that does not lose it. A unicast send
+// succeeds if its destination got the frame, as the MAC-level ACK would tell.
+esp_err_t EspNowSimMedium::transmit(EspNowSimRadio &from, const uint8_t *mac, const uint8_t *data, size_t len)
+{
+    if (len == 0 || len > ESPNOW_MAX_FRAME_LEN)
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (from.queued >= config.queueLimit)
+    {
+        xSemaphoreGive(mutex);
+        return ESP_ERR_NO_MEM;
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint32_t airtimeUs = (len * 8 * 1000ULL + config.bitrateKbps - 1) / config.bitrateKbps;
+    int64_t sentUs = std::max(now, from.busyUntilUs) + airtimeUs;
+    from.busyUntilUs = sentUs;
+    from.queued++;
+
+    bool broadcast = memcmp(mac, ESPNOW_BROADCAST_MAC, ESPNOW_MAC_LEN) == 0;
+    bool delivered = false;
+    for (EspNowSimRadio *to : radios)
+    {
+        if (to == &from || to->channel != from.channel ||
+            (!broadcast && memcmp(mac, to->address, ESPNOW_MAC_LEN) != 0))
+            continue;
+        if (chance(config.lossRate))
+            continue;
+
+        delivered = true;
+        Event &event = events.emplace_back();
+        event.dueUs = sentUs + config.latencyUs + (config.jitterUs ? nextRandom() % config.jitterUs : 0);
+        if (chance(config.reorderRate))
+        {
+            event.dueUs += config.reorderDelayUs;
+        }
+        else
+        {
+            event.dueUs = std::max(event.dueUs, to->lastArrivalUs);
+            to->lastArrivalUs = event.dueUs;
+        }
+        event.radio = to;
+        event.completion = false;
+        memcpy(event.mac, from.address, ESPNOW_MAC_LEN);
+        event.len = len;
+        memcpy(event.data, data, len);
+        push();
+    }
+
+    Event &event = events.emplace_back();
+    event.dueUs = sentUs;
+    event.radio = &from;
+    event.completion = true;
+    event.success = broadcast || delivered;
+    memcpy(event.mac, mac, ESPNOW_MAC_LEN);
+    event.len = 0;
+    push();
+    xSemaphoreGive(mutex);
+    return ESP_OK;
+}
+
+// Caller holds mutex. Sifts the event just appended into the heap, waking the
+// medium task if it is now the earliest.
+void EspNowSimMedium::push()
+{
+    uint32_t order = eventOrder++;
+    events.back().order = order;
+    std::push_heap(events.begin(), events.end(), laterEvent<Event>);
+    if (events.front().order == order && taskHandle)
+        xTaskNotifyGive(taskHandle);
+}
+
+// Hands out due events one at a time, outside the mutex, so callbacks may send
+void EspNowSimMedium::mediumTask(void *pvParameter)
+{
+    EspNowSimMedium *self = static_cast<EspNowSimMedium *>(pvParameter);
+    const int64_t tickUs = portTICK_PERIOD_MS * 1000LL;
+    Event event;
+    while (true)
+    {
+        xSemaphoreTake(self->mutex, portMAX_DELAY);
+        int64_t now = esp_timer_get_time();
+        bool due = !self->events.empty() && self->events.front().dueUs <= now;
+        TickType_t wait = portMAX_DELAY;
+        if (due)
+        {
+            std::pop_heap(self->events.begin(), self->events.end(), laterEvent<Event>);
+            event = self->events.back();
+            self->events.pop_back();
+            if (event.completion)
+                event.radio->queued--;
+        }
+        else if (!self->events.empty())
+        {
+            wait = (self->events.front().dueUs - now + tickUs - 1) / tickUs;
+        }
+        xSemaphoreGive(self->mutex);
+
+        if (!due)
+        {
+            ulTaskNotifyTake(pdTRUE, wait);
+            continue;
+        }
+        if (event.completion)
+        {
+            if (event.radio->sendCb)
+                event.radio->sendCb(event.mac, event.success);
+        }
+        else if (event.radio->receiveCb)
+        {
+            EspNowRxInfo info;
+            info.srcMac = event.mac;
+            info.rssi = -50;
+            event.radio->receiveCb(info, event.data, event.len);
+        }
+    }
+}
+
+EspNowSimRadio::EspNowSimRadio(EspNowSimMedium &medium, const uint8_t *mac) : medium(medium)
+{
+    memcpy(address, mac, ESPNOW_MAC_LEN);
+}
+
+esp_err_t EspNowSimRadio::begin()
+{
+    medium.attach(this);
+    return ESP_OK;
+}
+
+esp_err_t EspNowSimRadio::addPeer(const uint8_t *mac, const uint8_t *lmk)
+{
+    return ESP_OK;
+}
+
+esp_err_t EspNowSimRadio::removePeer(const uint8_t *mac)
+{
+    return ESP_OK;
+}
+
+esp_err_t EspNowSimRadio::send(const uint8_t *mac, const uint8_t *data, size_t len)
+{
+    return medium.transmit(*this, mac, data, len);
+}
+
+uint8_t EspNowSimRadio::getChannel()
+{
+    xSemaphoreTake(medium.mutex, portMAX_DELAY);
+    uint8_t current = channel;
+    xSemaphoreGive(medium.mutex);
+    return current;
+}
+
+esp_err_t EspNowSimRadio::setChannel(uint8_t newChannel)
+{
+    xSemaphoreTake(medium.mutex, portMAX_DELAY);
+    channel = newChannel;
+    xSemaphoreGive(medium.mutex);
+    return ESP_OK;
+}
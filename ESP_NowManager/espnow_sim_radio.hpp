@@ -0,0 +1,93 @@
+// espnow_sim_radio.hpp
+#pragma once
+
+#include "espnow_radio.hpp"
+#include "espnow_frame.hpp"
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+// Link model shared by every radio on a simulated medium
+struct EspNowSimConfig {
+    uint32_t bitrateKbps = 1000;    // airtime per frame; each radio sends one frame at a time
+    uint32_t latencyUs = 500;       // fixed delay from the end of airtime to delivery
+    uint32_t jitterUs = 200;        // uniform extra delay, never reordering a link by itself
+    float lossRate = 0.0f;          // chance each receiver misses a frame
+    float reorderRate = 0.0f;       // chance a delivered frame is held back and overtaken
+    uint32_t reorderDelayUs = 5000;
+    uint8_t queueLimit = 8;         // frames a radio accepts before send() fails with ESP_ERR_NO_MEM
+    uint32_t seed = 1;              // the same seed replays the same losses for the same traffic
+};
+
+class EspNowSimRadio;
+
+// In-memory medium connecting EspNowSimRadio instances, so several managers can
+// talk to each other without Wi-Fi, on target or under a host FreeRTOS port.
+// Frames and send completions are delivered from the medium's own task, as the
+// driver's callbacks are from the Wi-Fi task. Timing resolution is the tick.
+class EspNowSimMedium {
+public:
+    explicit EspNowSimMedium(const EspNowSimConfig& config = {});
+
+    // Takes effect for frames sent from now on
+    void setConfig(const EspNowSimConfig& config);
+
+private:
+    friend class EspNowSimRadio;
+
+    struct Event {
+        int64_t dueUs;
+        uint32_t order;             // keeps events due at the same time in FIFO order
+        EspNowSimRadio* radio;
+        bool completion;            // send completion for radio, else a frame arriving at it
+        bool success;
+        uint8_t mac[ESPNOW_MAC_LEN];    // completion: destination, frame: source
+        uint16_t len;
+        uint8_t data[ESPNOW_MAX_FRAME_LEN];
+    };
+
+    void attach(EspNowSimRadio* radio);
+    esp_err_t transmit(EspNowSimRadio& from, const uint8_t* mac, const uint8_t* data, size_t len);
+    void push();
+    bool chance(float rate);
+    uint32_t nextRandom();
+
+    static void mediumTask(void* pvParameter);
+
+    EspNowSimConfig config;
+    SemaphoreHandle_t mutex;
+    TaskHandle_t taskHandle = nullptr;
+    std::vector<EspNowSimRadio*> radios;
+    std::vector<Event> events;      // min-heap on (dueUs, order)
+    uint32_t eventOrder = 0;
+    uint32_t randomState;
+};
+
+// EspNowRadio on a simulated medium. The radio hears every frame sent on its
+// channel to its MAC or to the broadcast address; peers need not be added.
+class EspNowSimRadio : public EspNowRadio {
+public:
+    EspNowSimRadio(EspNowSimMedium& medium, const uint8_t* mac);
+
+    esp_err_t begin() override;
+    esp_err_t addPeer(const uint8_t* mac, const uint8_t* lmk = nullptr) override;
+    esp_err_t removePeer(const uint8_t* mac) override;
+    esp_err_t send(const uint8_t* mac, const uint8_t* data, size_t len) override;
+    uint8_t getChannel() override;
+    esp_err_t setChannel(uint8_t channel) override;
+
+    const uint8_t* mac() const { return address; }
+
+private:
+    friend class EspNowSimMedium;
+
+    EspNowSimMedium& medium;
+    uint8_t address[ESPNOW_MAC_LEN];
+    uint8_t channel = 1;
+
+    // Guarded by the medium's mutex
+    int queued = 0;                 // frames sent whose completion is still due
+    int64_t busyUntilUs = 0;        // end of the airtime of the last frame sent
+    int64_t lastArrivalUs = 0;      // arrivals stay in order unless deliberately reordered
+};
@@ -0,0 +1,4 @@
+// Host build only
+#pragma once
+
+typedef const char *esp_event_base_t;
@@ -0,0 +1,5 @@
+// Host build only: the types espnow_driver_radio.hpp declares callbacks with
+#pragma once
+
+typedef struct esp_now_recv_info esp_now_recv_info_t;
+typedef enum { ESP_NOW_SEND_SUCCESS, ESP_NOW_SEND_FAIL } esp_now_send_status_t;
@@ -0,0 +1,11 @@
+// Host build only
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+inline uint32_t esp_random()
+{
+    static std::mt19937 generator(1);
+    return generator();
+}
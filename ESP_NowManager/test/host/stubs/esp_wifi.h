@@ -0,0 +1,2 @@
+// Host build only: nothing of it is used without the driver
+#pragma once
@@ -0,0 +1,11 @@
+// Host build only: there is no ESP-NOW driver, so a manager must be given a
+// radio. Defined so the manager links.
+#include "espnow_driver_radio.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+EspNowDriverRadio &EspNowDriverRadio::instance()
+{
+    fprintf(stderr, "No ESP-NOW driver on the host; pass the manager a radio\n");
+    abort();
+}
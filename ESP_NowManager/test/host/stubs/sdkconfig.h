@@ -0,0 +1,2 @@
+// Host build only: no Kconfig, so every option takes its default
+#pragma once
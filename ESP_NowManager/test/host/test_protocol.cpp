@@ -0,0 +1,177 @@
+// Host test of the manager's protocol: two EspNowManagers talking over the
+// simulated medium, each through an EspNowSimRadio, on host threads.
+//
+//   make -C ESP_NowManager/test/host
+//
+// Several senders share one link that loses and reorders frames, so messages
+// go out with a window of them in flight, some fragmented: each must arrive
+// once, whole, and in order per sender, with the losses made up by
+// retransmission. Only a fragment lost MAX_RETRIES + 1 times running may cost
+// its message, which is rare at this loss rate but not impossible. Then a message lost for good must not hold back ordered
+// delivery of the next one past the reorder timeout, set short here.
+
+#include "espnow_comm.hpp"
+#include "espnow_sim_radio.hpp"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int fails = 0;
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+static const uint8_t MAC_A[ESPNOW_MAC_LEN] = {0x02, 0, 0, 0, 0, 0x0A};
+static const uint8_t MAC_B[ESPNOW_MAC_LEN] = {0x02, 0, 0, 0, 0, 0x0B};
+
+// Polls cond, under mutex, until it holds or ms have passed
+template <typename Cond> static bool waitFor(std::mutex &mutex, int ms, Cond cond)
+{
+    for (int waited = 0;; waited += 10)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (cond())
+                return true;
+        }
+        if (waited >= ms)
+            return false;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+static const int SENDERS = 4;
+static const int MESSAGES = 25;
+
+// Message k of sender s: a header naming both, then a fill derived from them,
+// long enough every few messages to take several frames
+static std::vector<uint8_t> makeMessage(int s, int k)
+{
+    std::vector<uint8_t> message(2 + (s * 131 + k * 397) % 3000);
+    message[0] = s;
+    message[1] = k;
+    for (size_t i = 2; i < message.size(); i++)
+        message[i] = (uint8_t)(s * 7 + k * 13 + i);
+    return message;
+}
+
+static void testLossyLink()
+{
+    EspNowSimConfig link;
+    link.lossRate = 0.15f;
+    link.reorderRate = 0.2f;
+    // Never freed, nor is anything else the tasks use: they never end
+    EspNowSimMedium *medium = new EspNowSimMedium(link);
+    EspNowManager *a = new EspNowManager(new EspNowSimRadio(*medium, MAC_A));
+    EspNowManager *b = new EspNowManager(new EspNowSimRadio(*medium, MAC_B));
+
+    static std::mutex mutex;
+    static int next[SENDERS], received, corrupt, outOfOrder;
+    b->setOrderedDelivery(true);
+    b->registerCommandHandler([&](const uint8_t *, const uint8_t *data, size_t len) {
+        std::lock_guard<std::mutex> lock(mutex);
+        received++;
+        if (len < 2 || data[0] >= SENDERS || makeMessage(data[0], data[1]) != std::vector<uint8_t>(data, data + len))
+        {
+            corrupt++;
+            return;
+        }
+        // Later is fine: the sender may have given up on the ones between
+        if (data[1] < next[data[0]])
+            outOfOrder++;
+        next[data[0]] = data[1] + 1;
+    });
+    CHECK(a->begin(MAC_B) && b->begin(MAC_A));
+
+    std::atomic<int> failedSends{0};
+    std::vector<std::thread> senders;
+    for (int s = 0; s < SENDERS; s++)
+    {
+        senders.emplace_back([&, s] {
+            for (int k = 0; k < MESSAGES; k++)
+            {
+                std::vector<uint8_t> message = makeMessage(s, k);
+                if (a->sendWithAck(message.data(), message.size(), pdMS_TO_TICKS(10000)) != ESP_OK)
+                    failedSends++;
+            }
+        });
+    }
+    for (std::thread &sender : senders)
+        sender.join();
+    // The last window is still in flight. Each fragment given up on loses at
+    // most one message; the ones after it wait out the reorder timeout.
+    for (int waited = 0; waited < 20000; waited += 10)
+    {
+        uint32_t dropped = a->getStats().dropped;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (received + dropped >= SENDERS * MESSAGES)
+            break;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    vTaskDelay(pdMS_TO_TICKS(ESPNOW_REORDER_TIMEOUT_MS + 500));
+
+    EspNowStats sent = a->getStats(), got = b->getStats();
+    std::lock_guard<std::mutex> lock(mutex);
+    printf("lossy link: %d of %d delivered, %u retransmissions (%u fast), %u fragments given up, %u duplicates\n",
+           received, SENDERS * MESSAGES, sent.retransmissions, sent.fastRetransmissions, sent.dropped,
+           got.duplicatesReceived);
+    CHECK(failedSends == 0);
+    CHECK(corrupt == 0 && outOfOrder == 0);
+    CHECK(received <= SENDERS * MESSAGES && received + (int)sent.dropped >= SENDERS * MESSAGES);
+    CHECK(sent.retransmissions > 0);
+    CHECK(got.messagesReassembled > 0);
+}
+
+// Drops every transmission of sequence number 1, the second message sent
+class DropOneRadio : public EspNowSimRadio {
+public:
+    using EspNowSimRadio::EspNowSimRadio;
+
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t len) override
+    {
+        EspNowPacket packet;
+        if (espnowDecodeFrame(data, len, packet) && packet.type == MessageType::DATA && packet.seq == 1)
+            return ESP_OK;
+        return EspNowSimRadio::send(mac, data, len);
+    }
+};
+
+static void testReorderTimeout()
+{
+    EspNowSimMedium *medium = new EspNowSimMedium();
+    EspNowManager *a = new EspNowManager(new DropOneRadio(*medium, MAC_A));
+    EspNowManager *b = new EspNowManager(new EspNowSimRadio(*medium, MAC_B));
+
+    static std::mutex mutex;
+    static std::vector<std::string> received;
+    b->setOrderedDelivery(true);
+    b->registerCommandHandler([&](const uint8_t *, const uint8_t *data, size_t len) {
+        std::lock_guard<std::mutex> lock(mutex);
+        received.emplace_back((const char *)data, len);
+    });
+    CHECK(a->begin(MAC_B) && b->begin(MAC_A));
+
+    CHECK(a->sendWithAck((const uint8_t *)"m0", 2) == ESP_OK);
+    CHECK(waitFor(mutex, 1000, [&] { return received.size() == 1; }));
+    CHECK(a->sendWithAck((const uint8_t *)"m1", 2) == ESP_OK);
+    CHECK(a->sendWithAck((const uint8_t *)"m2", 2) == ESP_OK);
+    // m2 arrives at once but waits for m1, which never does
+    CHECK(!waitFor(mutex, ESPNOW_REORDER_TIMEOUT_MS / 2, [&] { return received.size() > 1; }));
+    CHECK(waitFor(mutex, ESPNOW_REORDER_TIMEOUT_MS + 1000, [&] { return received.size() > 1; }));
+
+    CHECK(b->getStats().reorderTimeouts == 1);
+    std::lock_guard<std::mutex> lock(mutex);
+    CHECK(received.size() == 2 && received[0] == "m0" && received.back() == "m2");
+}
+
+int main()
+{
+    testLossyLink();
+    testReorderTimeout();
+
+    printf(fails ? "FAILED\n" : "all ok\n");
+    fflush(stdout);
+    // The managers' and the medium's tasks never end; leave them running
+    _Exit(fails != 0);
+}
@@ -0,0 +1,138 @@
+// Host test for EspNowRxRing: the radio callback's producer side against the
+// receive task's consumer side, on two threads.
+//
+//   make -C ESP_NowManager/test/host
+//
+// Checks the ring's bookkeeping when full, then streams frames through it
+// unpaced, to catch ordering and torn-copy errors under contention, and with
+// a slow consumer the producer never gets more than a ring ahead of, which
+// must refuse nothing however the threads are scheduled.
+
+#include "espnow_rx_ring.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+static int fails = 0;
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+static const uint8_t MAC[ESPNOW_MAC_LEN] = {1, 2, 3, 4, 5, 6};
+
+using Clock = std::chrono::steady_clock;
+
+// Frame i carries its index and a length and fill derived from it, so the
+// consumer can tell a reordered, lost or half-copied frame
+static size_t frameLen(uint32_t i) { return 4 + i % (ESPNOW_MAX_FRAME_LEN - 3); }
+
+static void makeFrame(uint32_t i, uint8_t *buf)
+{
+    memcpy(buf, &i, 4);
+    memset(buf + 4, (uint8_t)i, frameLen(i) - 4);
+}
+
+static bool checkFrame(const EspNowRxFrame &frame, uint32_t expect)
+{
+    uint32_t i;
+    memcpy(&i, frame.data, 4);
+    if (i != expect || frame.len != frameLen(i) || memcmp(frame.srcMac, MAC, ESPNOW_MAC_LEN) || frame.rssi != -40)
+        return false;
+    for (size_t k = 4; k < frame.len; k++)
+    {
+        if (frame.data[k] != (uint8_t)i)
+            return false;
+    }
+    return true;
+}
+
+static void testFull()
+{
+    static EspNowRxRing<4> ring;
+    EspNowRxInfo info = {MAC, -40};
+    uint8_t buf[ESPNOW_MAX_FRAME_LEN + 1];
+    CHECK(!ring.push(info, buf, sizeof(buf)));
+    CHECK(ring.front() == nullptr);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        makeFrame(i, buf);
+        CHECK(ring.push(info, buf, frameLen(i)));
+    }
+    makeFrame(4, buf);
+    CHECK(!ring.push(info, buf, frameLen(4)));
+    CHECK(ring.overflows() == 1 && ring.maxDepth() == 4);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        CHECK(ring.front() && checkFrame(*ring.front(), i));
+        ring.pop();
+    }
+    CHECK(ring.front() == nullptr);
+}
+
+// Pushes count frames, each once the consumer is less than maxLag frames
+// behind if maxLag is not 0; returns the frames the ring refused. The
+// consumer spends workUs on each frame it takes.
+template <size_t Capacity>
+static uint32_t stream(EspNowRxRing<Capacity> &ring, uint32_t count, uint32_t maxLag, uint32_t workUs)
+{
+    bool ok = true;
+    uint32_t accepted = 0;
+    std::atomic<uint32_t> popped{0};
+    std::atomic<bool> done{false};
+    std::thread consumer([&] {
+        uint32_t expect = 0;
+        while (!done || ring.front())
+        {
+            const EspNowRxFrame *frame = ring.front();
+            if (!frame)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            uint32_t i;
+            memcpy(&i, frame->data, 4);
+            // Refused frames leave gaps, never reorderings
+            if (i < expect || !checkFrame(*frame, i))
+                ok = false;
+            expect = i + 1;
+            auto until = Clock::now() + std::chrono::microseconds(workUs);
+            while (Clock::now() < until)
+                ;
+            ring.pop();
+            popped++;
+        }
+    });
+
+    EspNowRxInfo info = {MAC, -40};
+    uint8_t buf[ESPNOW_MAX_FRAME_LEN];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        while (maxLag && accepted - popped >= maxLag)
+            std::this_thread::yield();
+        makeFrame(i, buf);
+        if (ring.push(info, buf, frameLen(i)))
+            accepted++;
+    }
+    done = true;
+    consumer.join();
+    CHECK(ok);
+    CHECK(accepted + ring.overflows() == count);
+    return count - accepted;
+}
+
+int main()
+{
+    testFull();
+
+    static EspNowRxRing<16> unpaced;
+    uint32_t refused = stream(unpaced, 200000, 0, 0);
+    printf("unpaced: %u of 200000 refused, max depth %u\n", refused, unpaced.maxDepth());
+
+    // A consumer slower than the producer, never more than the ring behind
+    static EspNowRxRing<16> lagging;
+    refused = stream(lagging, 5000, 16, 100);
+    printf("lagging: %u of 5000 refused, max depth %u\n", refused, lagging.maxDepth());
+    CHECK(refused == 0 && lagging.maxDepth() <= 16);
+
+    printf(fails ? "FAILED\n" : "all ok\n");
+    return fails != 0;
+}
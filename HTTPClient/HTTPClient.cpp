@@ -1110,7 +1110,8 @@ String HTTPClient::getString(void)
         if (sstring.reserve((_size + 1)))
         {
             writeToStream(&sstring);
-            return sstring;
+            // Moves the body out rather than copying it
+            return sstring.readString();
         }
         else
         {
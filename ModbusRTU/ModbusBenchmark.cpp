@@ -0,0 +1,124 @@
+#include "ModbusBenchmark.hpp"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <algorithm>
+
+static const char *TAG = "ModbusBench";
+
+ModbusBenchmark::ModbusBenchmark(const ModbusSimConfig &config) : bus(config), master(bus) {
+    resultMutex = xSemaphoreCreateMutex();
+}
+
+esp_err_t ModbusBenchmark::begin() {
+    return master.begin();
+}
+
+// Bus task. Polls completing after their run has its count are not counted.
+void ModbusBenchmark::onPoll(uint32_t id, esp_err_t err) {
+    xSemaphoreTake(resultMutex, portMAX_DELAY);
+    if (id == runId && completed < target) {
+        completed++;
+        if (err != ESP_OK) {
+            failed++;
+        }
+        lastUs = esp_timer_get_time();
+        lastBusUs = bus.busTimeUs();
+    }
+    xSemaphoreGive(resultMutex);
+}
+
+// Polls bench.registers holding registers from each of bench.slaves slaves,
+// until bench.transactions polls have completed or they stop completing.
+esp_err_t ModbusBenchmark::run(const ModbusBenchmarkCase &bench, ModbusBenchmarkResult &result) {
+    result = {};
+    if (bench.slaves == 0 || bench.slaves > MODBUS_MAX_SLAVE || bench.registers == 0 || bench.registers > 125 ||
+        bench.transactions == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // No polls are left from the last run, so the bus is idle while slaves are added
+    while (slaves.size() < bench.slaves) {
+        slaves.push_back(std::make_unique<ModbusSimSlave>(slaves.size() + 1));
+        bus.addSlave(slaves.back().get());
+    }
+
+    int64_t startUs = esp_timer_get_time();
+    int64_t startBusUs = bus.busTimeUs();
+    xSemaphoreTake(resultMutex, portMAX_DELAY);
+    uint32_t id = ++runId;
+    target = bench.transactions;
+    completed = 0;
+    failed = 0;
+    lastUs = startUs;
+    lastBusUs = startBusUs;
+    xSemaphoreGive(resultMutex);
+
+    ModbusMaster::BusStats before = master.getBusStats();
+    std::vector<int> polls;
+    for (uint8_t slave = 1; slave <= bench.slaves; slave++) {
+        polls.push_back(master.addPoll(slave, ModbusFunction::ReadHoldingRegisters, 0, bench.registers,
+                                       bench.periodMs,
+                                       [this, id](esp_err_t err, const ModbusResponse &) { onPoll(id, err); }));
+    }
+
+    size_t done;
+    size_t progress = 0;
+    int64_t progressUs = startUs;
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        int64_t now = esp_timer_get_time();
+        xSemaphoreTake(resultMutex, portMAX_DELAY);
+        done = completed;
+        xSemaphoreGive(resultMutex);
+        if (done >= bench.transactions) {
+            break;
+        }
+        if (done != progress) {
+            progress = done;
+            progressUs = now;
+        } else if (now - progressUs > IDLE_TIMEOUT_MS * 1000LL) {
+            break;
+        }
+    }
+
+    for (int poll : polls) {
+        master.removePoll(poll);
+    }
+    ModbusMaster::BusStats after = master.getBusStats();
+
+    xSemaphoreTake(resultMutex, portMAX_DELAY);
+    runId++;    // anything later is no longer this run's
+    result.transactions = completed;
+    result.failures = failed;
+    int64_t elapsedUs = lastUs - startUs;
+    int64_t busUs = lastBusUs - startBusUs;
+    xSemaphoreGive(resultMutex);
+
+    if (elapsedUs > 0) {
+        result.perSecond = result.transactions * 1e6f / std::max(elapsedUs, busUs);
+        result.masterPerSecond = result.transactions * 1e6f / elapsedUs;
+    }
+    result.latePolls = after.latePolls - before.latePolls;
+    result.passed = result.transactions == bench.transactions && result.failures == 0 &&
+                    (bench.minPerSecond <= 0 || result.perSecond >= bench.minPerSecond);
+    return ESP_OK;
+}
+
+esp_err_t ModbusBenchmark::runAll(const ModbusBenchmarkCase *cases, size_t count) {
+    bool allPassed = true;
+    ESP_LOGI(TAG, "slaves  regs  period(ms)  trans  failures  trans/s  master trans/s  late");
+    for (size_t i = 0; i < count; i++) {
+        ModbusBenchmarkResult result;
+        esp_err_t err = run(cases[i], result);
+        if (err != ESP_OK) {
+            return err;
+        }
+        ESP_LOGI(TAG, "%6u %5u %11lu %6u %9lu %8.1f %15.1f %5lu  %s", cases[i].slaves, cases[i].registers,
+                 (unsigned long)cases[i].periodMs, (unsigned)result.transactions, (unsigned long)result.failures,
+                 result.perSecond, result.masterPerSecond, (unsigned long)result.latePolls,
+                 result.passed ? "pass" : "FAIL");
+        allPassed &= result.passed;
+    }
+    return allPassed ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ModbusMaster.hpp"
+#include "ModbusSimBus.hpp"
+#include <memory>
+#include <vector>
+
+struct ModbusBenchmarkCase {
+    uint8_t slaves;                 // each polled for holding registers, 1-247
+    uint16_t registers;             // per poll, 1-125
+    uint32_t periodMs;              // per slave, 0 for as often as the bus allows
+    size_t transactions;
+    float minPerSecond;             // gate, 0 to skip
+};
+
+struct ModbusBenchmarkResult {
+    size_t transactions;            // polls completed, answered or not
+    uint32_t failures;
+    float perSecond;                // over the modeled bus time or the real time, whichever is longer
+    float masterPerSecond;          // over the real time only: the master's own ceiling, without a real-time bus
+    uint32_t latePolls;
+    bool passed;                    // every poll answered and the case's gate met
+};
+
+// A master polling simulated slaves on a ModbusSimBus, for measuring the
+// scheduling rather than a bus. Run the cases before and after a change with
+// the same bus config: a case that no longer meets its gate fails the run.
+class ModbusBenchmark {
+public:
+    explicit ModbusBenchmark(const ModbusSimConfig &bus = {});
+
+    esp_err_t begin();
+
+    esp_err_t run(const ModbusBenchmarkCase &bench, ModbusBenchmarkResult &result);
+    // Runs and logs every case; ESP_FAIL if any of them did not pass
+    esp_err_t runAll(const ModbusBenchmarkCase *cases, size_t count);
+
+private:
+    // How long a run waits for the next completed poll before giving up
+    static constexpr uint32_t IDLE_TIMEOUT_MS = 2000;
+
+    void onPoll(uint32_t id, esp_err_t err);
+
+    ModbusSimBus bus;
+    std::vector<std::unique_ptr<ModbusSimSlave>> slaves;
+    ModbusMaster master;
+
+    // Filled by the poll callbacks, on the bus task
+    SemaphoreHandle_t resultMutex;
+    uint32_t runId = 0;
+    size_t target = 0;
+    size_t completed = 0;
+    uint32_t failed = 0;
+    int64_t lastUs = 0;             // real and modeled bus time of the last counted poll
+    int64_t lastBusUs = 0;
+};
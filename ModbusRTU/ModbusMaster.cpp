@@ -0,0 +1,532 @@
+#include "ModbusMaster.hpp"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <algorithm>
+#include <cstring>
+
+static const char *TAG = "ModbusMaster";
+
+#ifdef CONFIG_MODBUS_RTU_RESPONSE_TIMEOUT_MS
+#define MODBUS_RESPONSE_TIMEOUT_MS CONFIG_MODBUS_RTU_RESPONSE_TIMEOUT_MS
+#else
+#define MODBUS_RESPONSE_TIMEOUT_MS 100
+#endif
+
+#ifdef CONFIG_MODBUS_RTU_RETRIES
+#define MODBUS_RETRIES CONFIG_MODBUS_RTU_RETRIES
+#else
+#define MODBUS_RETRIES 1
+#endif
+
+#ifdef CONFIG_MODBUS_RTU_OFFLINE_AFTER
+#define MODBUS_OFFLINE_AFTER CONFIG_MODBUS_RTU_OFFLINE_AFTER
+#else
+#define MODBUS_OFFLINE_AFTER 3
+#endif
+
+#ifdef CONFIG_MODBUS_RTU_OFFLINE_RETRY_MS
+#define MODBUS_OFFLINE_RETRY_MS CONFIG_MODBUS_RTU_OFFLINE_RETRY_MS
+#else
+#define MODBUS_OFFLINE_RETRY_MS 5000
+#endif
+
+#ifdef CONFIG_MODBUS_RTU_BROADCAST_DELAY_MS
+#define MODBUS_BROADCAST_DELAY_MS CONFIG_MODBUS_RTU_BROADCAST_DELAY_MS
+#else
+#define MODBUS_BROADCAST_DELAY_MS 100
+#endif
+
+#ifdef CONFIG_MODBUS_RTU_TASK_PRIORITY
+#define MODBUS_TASK_PRIORITY CONFIG_MODBUS_RTU_TASK_PRIORITY
+#else
+#define MODBUS_TASK_PRIORITY 10
+#endif
+
+#define MODBUS_TASK_STACK_SIZE 4096
+#define MODBUS_REQUEST_QUEUE_LEN 8
+
+// Limits of one request, from the protocol specification
+#define MODBUS_MAX_READ_BITS 2000
+#define MODBUS_MAX_READ_REGISTERS 125
+#define MODBUS_MAX_WRITE_BITS 1968
+#define MODBUS_MAX_WRITE_REGISTERS 123
+
+ModbusMaster::ModbusMaster(ModbusTransport &transport)
+    : transport(transport), responseTimeoutMs(MODBUS_RESPONSE_TIMEOUT_MS), retries(MODBUS_RETRIES) {
+    mutex = xSemaphoreCreateMutex();
+    queueMutex = xSemaphoreCreateMutex();
+    stopped = xSemaphoreCreateBinary();
+}
+
+ModbusMaster::~ModbusMaster() {
+    end();
+    vSemaphoreDelete(mutex);
+    vSemaphoreDelete(queueMutex);
+    vSemaphoreDelete(stopped);
+}
+
+esp_err_t ModbusMaster::begin() {
+    if (taskHandle) {
+        return ESP_OK;
+    }
+    QueueHandle_t queue = xQueueCreate(MODBUS_REQUEST_QUEUE_LEN, sizeof(Request *));
+    if (!queue) {
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    requests = queue;
+    stopping = false;
+    if (xTaskCreate(busTask, "modbus", MODBUS_TASK_STACK_SIZE, this, MODBUS_TASK_PRIORITY, &taskHandle) != pdPASS) {
+        vQueueDelete(requests);
+        requests = nullptr;
+        taskHandle = nullptr;
+        xSemaphoreGive(queueMutex);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(queueMutex);
+    return ESP_OK;
+}
+
+void ModbusMaster::end() {
+    if (!taskHandle) {
+        return;
+    }
+    // Once stopping is set under the lock, no request or poll sends to the
+    // queue again; whatever got in first is failed by the bus task
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    stopping = true;
+    Request *wake = nullptr;
+    xQueueSend(requests, &wake, portMAX_DELAY);
+    xSemaphoreGive(queueMutex);
+    xSemaphoreTake(stopped, portMAX_DELAY);
+
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    vQueueDelete(requests);
+    requests = nullptr;
+    taskHandle = nullptr;
+    xSemaphoreGive(queueMutex);
+}
+
+void ModbusMaster::busTask(void *arg) {
+    ModbusMaster *self = static_cast<ModbusMaster *>(arg);
+    TickType_t wait = 0;
+    Request *req;
+
+    while (!self->stopping) {
+        if (xQueueReceive(self->requests, &req, wait) == pdTRUE) {
+            if (req) {
+                self->execute(*req);
+            }
+            wait = 0;
+            continue;
+        }
+        self->runDuePoll(&wait);
+    }
+
+    // Fail what was queued behind the stop
+    while (xQueueReceive(self->requests, &req, 0) == pdTRUE) {
+        if (req) {
+            TaskHandle_t waiter = req->waiter;
+            req->result = ESP_ERR_INVALID_STATE;
+            req->done = true;
+            xTaskNotifyGive(waiter);
+        }
+    }
+    xSemaphoreGive(self->stopped);
+    vTaskDelete(nullptr);
+}
+
+// Runs the most overdue poll, or sets *wait to the ticks until one is due
+bool ModbusMaster::runDuePoll(TickType_t *wait) {
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Poll *next = nullptr;
+    int64_t nextDueUs = 0;
+    for (Poll &poll : polls) {
+        int64_t dueUs = poll.dueUs;
+        auto slave = slaves.find(poll.adu[0]);
+        if (slave != slaves.end() && slave->second.stats.offline) {
+            dueUs = std::max(dueUs, slave->second.retryAtUs);
+        }
+        if (!next || dueUs < nextDueUs) {
+            next = &poll;
+            nextDueUs = dueUs;
+        }
+    }
+    if (!next || nextDueUs > now) {
+        xSemaphoreGive(mutex);
+        if (!next) {
+            *wait = portMAX_DELAY;
+        } else {
+            TickType_t ticks = pdMS_TO_TICKS((nextDueUs - now + 999) / 1000);
+            *wait = ticks > 0 ? ticks : 1;
+        }
+        return false;
+    }
+
+    uint8_t adu[sizeof(next->adu)];
+    memcpy(adu, next->adu, sizeof(adu));
+    size_t expected = next->expected;
+    PollCallback cb = next->cb;
+    if (next->periodUs > 0 && now - next->dueUs >= next->periodUs) {
+        busStats.latePolls++;
+    }
+    // Not caught up in a burst when late: the period restarts from now
+    next->dueUs = std::max(next->dueUs + next->periodUs, now);
+    xSemaphoreGive(mutex);
+
+    ModbusResponse response;
+    esp_err_t err = transact(adu, sizeof(adu), expected, response);
+    if (cb) {
+        cb(err, response);
+    }
+    *wait = 0;
+    return true;
+}
+
+esp_err_t ModbusMaster::request(Request &req) {
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    if (!taskHandle || stopping || xTaskGetCurrentTaskHandle() == taskHandle) {
+        xSemaphoreGive(queueMutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    req.waiter = xTaskGetCurrentTaskHandle();
+    req.done = false;
+    Request *pending = &req;
+    // May wait for room while holding the lock; the bus task frees it
+    xQueueSend(requests, &pending, portMAX_DELAY);
+    xSemaphoreGive(queueMutex);
+    // Takes the one notification the bus task gives once done is set, so
+    // none is left over for the task's next wait. Other notifications to
+    // this task must not end the wait early.
+    do {
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    } while (!req.done);
+    return req.result;
+}
+
+void ModbusMaster::execute(Request &req) {
+    ModbusResponse response;
+    esp_err_t err = transact(req.adu, req.length, req.expected, response);
+    if (err == ESP_OK) {
+        if (req.values) {
+            for (size_t i = 0; i < req.count; i++) {
+                req.values[i] = response.reg(i);
+            }
+        } else if (req.bits) {
+            memcpy(req.bits, response.data, response.length);
+        }
+    }
+    TaskHandle_t waiter = req.waiter;
+    req.result = err;
+    req.done = true;
+    xTaskNotifyGive(waiter);
+}
+
+esp_err_t ModbusMaster::transact(const uint8_t *adu, size_t length, size_t expected, ModbusResponse &response) {
+    uint8_t slave = adu[0];
+    response = {};
+    response.slave = slave;
+    response.function = static_cast<ModbusFunction>(adu[1]);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    // An offline slave gets one attempt, not the full retries
+    bool offline = slaves[slave].stats.offline;
+    xSemaphoreGive(mutex);
+    int attempts = (offline || slave == MODBUS_BROADCAST) ? 1 : retries + 1;
+    uint32_t timeoutMs = responseTimeoutMs + (expected * transport.charTimeUs() + 999) / 1000;
+
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    for (int attempt = 0; attempt < attempts; attempt++) {
+        err = transport.send(adu, length);
+        if (err != ESP_OK) {
+            break;
+        }
+        if (slave == MODBUS_BROADCAST) {
+            // No reply; give the slaves time to act on it
+            vTaskDelay(pdMS_TO_TICKS(MODBUS_BROADCAST_DELAY_MS));
+            break;
+        }
+        int64_t sentUs = esp_timer_get_time();
+        size_t n = transport.receive(reply, sizeof(reply), timeoutMs);
+        err = n > 0 ? parse(adu, n, expected, response) : ESP_ERR_TIMEOUT;
+        record(slave, err, response.exception, esp_timer_get_time() - sentUs);
+        if (err != ESP_ERR_TIMEOUT && err != ESP_ERR_INVALID_CRC && err != ESP_ERR_INVALID_SIZE) {
+            break;
+        }
+        transport.discard();
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    busStats.transactions++;
+    if (err != ESP_OK) {
+        busStats.failures++;
+    }
+    if (slave != MODBUS_BROADCAST) {
+        Slave &state = slaves[slave];
+        if (err == ESP_ERR_TIMEOUT) {
+            if (++state.failures >= MODBUS_OFFLINE_AFTER) {
+                if (!state.stats.offline) {
+                    ESP_LOGW(TAG, "Slave %u not answering, polled every %d ms until it does", slave,
+                             MODBUS_OFFLINE_RETRY_MS);
+                }
+                state.stats.offline = true;
+                state.retryAtUs = esp_timer_get_time() + MODBUS_OFFLINE_RETRY_MS * 1000LL;
+            }
+        } else {
+            if (state.stats.offline) {
+                ESP_LOGI(TAG, "Slave %u back online", slave);
+            }
+            state.failures = 0;
+            state.stats.offline = false;
+        }
+    }
+    xSemaphoreGive(mutex);
+    return err;
+}
+
+esp_err_t ModbusMaster::parse(const uint8_t *adu, size_t length, size_t expected, ModbusResponse &response) {
+    if (!modbusCheckCrc(reply, length)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    // Another slave's late reply
+    if (reply[0] != adu[0]) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (reply[1] == (adu[1] | MODBUS_EXCEPTION_FLAG) && length == 5) {
+        response.exception = reply[2];
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (reply[1] != adu[1] || length != expected) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    switch (response.function) {
+        case ModbusFunction::ReadCoils:
+        case ModbusFunction::ReadDiscreteInputs:
+        case ModbusFunction::ReadHoldingRegisters:
+        case ModbusFunction::ReadInputRegisters:
+            if (reply[2] != length - 5) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            response.data = reply + 3;
+            response.length = reply[2];
+            break;
+        default:
+            response.data = reply + 2;
+            response.length = 4;
+            break;
+    }
+    return ESP_OK;
+}
+
+void ModbusMaster::record(uint8_t slave, esp_err_t err, uint8_t exception, uint32_t latencyUs) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    SlaveStats &stats = slaves[slave].stats;
+    stats.requests++;
+    switch (err) {
+        case ESP_ERR_TIMEOUT:
+            stats.timeouts++;
+            break;
+        case ESP_ERR_INVALID_CRC:
+            stats.crcErrors++;
+            break;
+        case ESP_ERR_INVALID_RESPONSE:
+            stats.exceptions++;
+            stats.lastException = exception;
+            stats.replies++;
+            stats.lastLatencyUs = latencyUs;
+            break;
+        case ESP_OK:
+            stats.replies++;
+            stats.lastLatencyUs = latencyUs;
+            break;
+        default:
+            break;
+    }
+    xSemaphoreGive(mutex);
+}
+
+size_t ModbusMaster::expectedReply(ModbusFunction function, uint16_t count) {
+    switch (function) {
+        case ModbusFunction::ReadCoils:
+        case ModbusFunction::ReadDiscreteInputs:
+            return 5 + (count + 7) / 8;
+        case ModbusFunction::ReadHoldingRegisters:
+        case ModbusFunction::ReadInputRegisters:
+            return 5 + 2 * count;
+        default:
+            return 8;
+    }
+}
+
+size_t ModbusMaster::buildRead(uint8_t *adu, uint8_t slave, ModbusFunction function, uint16_t address,
+                               uint16_t count) {
+    adu[0] = slave;
+    adu[1] = static_cast<uint8_t>(function);
+    adu[2] = address >> 8;
+    adu[3] = address & 0xFF;
+    adu[4] = count >> 8;
+    adu[5] = count & 0xFF;
+    return modbusAppendCrc(adu, 6);
+}
+
+esp_err_t ModbusMaster::readCoils(uint8_t slave, uint16_t address, uint16_t count, uint8_t *bits) {
+    if (slave == MODBUS_BROADCAST || slave > MODBUS_MAX_SLAVE || count == 0 || count > MODBUS_MAX_READ_BITS ||
+        !bits) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    Request req = {};
+    req.length = buildRead(req.adu, slave, ModbusFunction::ReadCoils, address, count);
+    req.expected = expectedReply(ModbusFunction::ReadCoils, count);
+    req.bits = bits;
+    return request(req);
+}
+
+esp_err_t ModbusMaster::readDiscreteInputs(uint8_t slave, uint16_t address, uint16_t count, uint8_t *bits) {
+    if (slave == MODBUS_BROADCAST || slave > MODBUS_MAX_SLAVE || count == 0 || count > MODBUS_MAX_READ_BITS ||
+        !bits) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    Request req = {};
+    req.length = buildRead(req.adu, slave, ModbusFunction::ReadDiscreteInputs, address, count);
+    req.expected = expectedReply(ModbusFunction::ReadDiscreteInputs, count);
+    req.bits = bits;
+    return request(req);
+}
+
+esp_err_t ModbusMaster::readHoldingRegisters(uint8_t slave, uint16_t address, uint16_t count, uint16_t *values) {
+    if (slave == MODBUS_BROADCAST || slave > MODBUS_MAX_SLAVE || count == 0 || count > MODBUS_MAX_READ_REGISTERS ||
+        !values) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    Request req = {};
+    req.length = buildRead(req.adu, slave, ModbusFunction::ReadHoldingRegisters, address, count);
+    req.expected = expectedReply(ModbusFunction::ReadHoldingRegisters, count);
+    req.count = count;
+    req.values = values;
+    return request(req);
+}
+
+esp_err_t ModbusMaster::readInputRegisters(uint8_t slave, uint16_t address, uint16_t count, uint16_t *values) {
+    if (slave == MODBUS_BROADCAST || slave > MODBUS_MAX_SLAVE || count == 0 || count > MODBUS_MAX_READ_REGISTERS ||
+        !values) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    Request req = {};
+    req.length = buildRead(req.adu, slave, ModbusFunction::ReadInputRegisters, address, count);
+    req.expected = expectedReply(ModbusFunction::ReadInputRegisters, count);
+    req.count = count;
+    req.values = values;
+    return request(req);
+}
+
+esp_err_t ModbusMaster::writeSingleCoil(uint8_t slave, uint16_t address, bool value) {
+    if (slave > MODBUS_MAX_SLAVE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    Request req = {};
+    req.length = buildRead(req.adu, slave, ModbusFunction::WriteSingleCoil, address, value ? 0xFF00 : 0x0000);
+    req.expected = expectedReply(ModbusFunction::WriteSingleCoil, 1);
+    return request(req);
+}
+
+esp_err_t ModbusMaster::writeSingleRegister(uint8_t slave, uint16_t address, uint16_t value) {
+    if (slave > MODBUS_MAX_SLAVE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    Request req = {};
+    req.length = buildRead(req.adu, slave, ModbusFunction::WriteSingleRegister, address, value);
+    req.expected = expectedReply(ModbusFunction::WriteSingleRegister, 1);
+    return request(req);
+}
+
+esp_err_t ModbusMaster::writeMultipleCoils(uint8_t slave, uint16_t address, uint16_t count, const uint8_t *bits) {
+    if (slave > MODBUS_MAX_SLAVE || count == 0 || count > MODBUS_MAX_WRITE_BITS || !bits) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    Request req = {};
+    size_t bytes = (count + 7) / 8;
+    buildRead(req.adu, slave, ModbusFunction::WriteMultipleCoils, address, count);
+    req.adu[6] = bytes;
+    memcpy(req.adu + 7, bits, bytes);
+    req.length = modbusAppendCrc(req.adu, 7 + bytes);
+    req.expected = expectedReply(ModbusFunction::WriteMultipleCoils, count);
+    return request(req);
+}
+
+esp_err_t ModbusMaster::writeMultipleRegisters(uint8_t slave, uint16_t address, uint16_t count,
+                                               const uint16_t *values) {
+    if (slave > MODBUS_MAX_SLAVE || count == 0 || count > MODBUS_MAX_WRITE_REGISTERS || !values) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    Request req = {};
+    buildRead(req.adu, slave, ModbusFunction::WriteMultipleRegisters, address, count);
+    req.adu[6] = 2 * count;
+    for (size_t i = 0; i < count; i++) {
+        req.adu[7 + 2 * i] = values[i] >> 8;
+        req.adu[8 + 2 * i] = values[i] & 0xFF;
+    }
+    req.length = modbusAppendCrc(req.adu, 7 + 2 * count);
+    req.expected = expectedReply(ModbusFunction::WriteMultipleRegisters, count);
+    return request(req);
+}
+
+int ModbusMaster::addPoll(uint8_t slave, ModbusFunction function, uint16_t address, uint16_t count,
+                          uint32_t periodMs, PollCallback cb) {
+    bool bits = function == ModbusFunction::ReadCoils || function == ModbusFunction::ReadDiscreteInputs;
+    bool registers = function == ModbusFunction::ReadHoldingRegisters ||
+                     function == ModbusFunction::ReadInputRegisters;
+    if (slave == MODBUS_BROADCAST || slave > MODBUS_MAX_SLAVE || (!bits && !registers) || count == 0 ||
+        count > (bits ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS)) {
+        return -1;
+    }
+
+    Poll poll;
+    buildRead(poll.adu, slave, function, address, count);
+    poll.expected = expectedReply(function, count);
+    poll.periodUs = periodMs * 1000LL;
+    poll.dueUs = esp_timer_get_time();
+    poll.cb = cb;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    poll.id = nextPollId++;
+    polls.push_back(poll);
+    xSemaphoreGive(mutex);
+
+    // Wake the bus task to schedule it
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    if (requests && !stopping) {
+        Request *wake = nullptr;
+        xQueueSend(requests, &wake, 0);
+    }
+    xSemaphoreGive(queueMutex);
+    return poll.id;
+}
+
+void ModbusMaster::removePoll(int id) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    polls.erase(std::remove_if(polls.begin(), polls.end(), [id](const Poll &poll) { return poll.id == id; }),
+                polls.end());
+    xSemaphoreGive(mutex);
+}
+
+ModbusMaster::SlaveStats ModbusMaster::getSlaveStats(uint8_t slave) {
+    SlaveStats stats = {};
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    auto it = slaves.find(slave);
+    if (it != slaves.end()) {
+        stats = it->second.stats;
+    }
+    xSemaphoreGive(mutex);
+    return stats;
+}
+
+ModbusMaster::BusStats ModbusMaster::getBusStats() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    BusStats stats = busStats;
+    xSemaphoreGive(mutex);
+    return stats;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "ModbusRTU.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <vector>
+
+// Modbus RTU master. One task owns the bus and runs a transaction at a time,
+// back to back: requests made from other tasks first, then whichever poll is
+// most overdue. Polls repeat a read at their own period, with the request
+// encoded once when added. A slave that stops answering is taken offline and
+// polled only every CONFIG_MODBUS_RTU_OFFLINE_RETRY_MS, so a dead device does
+// not eat the bus time of the live ones with its timeouts.
+class ModbusMaster {
+public:
+    // From the bus task; keep it short, the bus waits for it
+    using PollCallback = std::function<void(esp_err_t err, const ModbusResponse &response)>;
+
+    struct SlaveStats {
+        uint32_t requests;
+        uint32_t replies;
+        uint32_t timeouts;
+        uint32_t crcErrors;
+        uint32_t exceptions;
+        uint8_t lastException;
+        uint32_t lastLatencyUs;     // from the end of the request to the end of the reply
+        bool offline;
+    };
+
+    struct BusStats {
+        uint32_t transactions;
+        uint32_t failures;          // after the retries
+        uint32_t latePolls;         // polls run a period or more after they were due
+    };
+
+    explicit ModbusMaster(ModbusTransport &transport);
+    // Stops the bus task
+    ~ModbusMaster();
+
+    esp_err_t begin();
+    void end();
+
+    // Per attempt; extended by the time the expected reply takes on the wire
+    void setResponseTimeout(uint32_t ms) { responseTimeoutMs = ms; }
+    // Further attempts after a timeout or a corrupted reply
+    void setRetries(int count) { retries = count; }
+
+    // Blocking requests from any task but the bus task, run ahead of polls.
+    // A slave's refusal is ESP_ERR_INVALID_RESPONSE, with its exception code
+    // in the slave's stats. Bits are packed LSB first, as on the wire.
+    esp_err_t readCoils(uint8_t slave, uint16_t address, uint16_t count, uint8_t *bits);
+    esp_err_t readDiscreteInputs(uint8_t slave, uint16_t address, uint16_t count, uint8_t *bits);
+    esp_err_t readHoldingRegisters(uint8_t slave, uint16_t address, uint16_t count, uint16_t *values);
+    esp_err_t readInputRegisters(uint8_t slave, uint16_t address, uint16_t count, uint16_t *values);
+    esp_err_t writeSingleCoil(uint8_t slave, uint16_t address, bool value);
+    esp_err_t writeSingleRegister(uint8_t slave, uint16_t address, uint16_t value);
+    esp_err_t writeMultipleCoils(uint8_t slave, uint16_t address, uint16_t count, const uint8_t *bits);
+    esp_err_t writeMultipleRegisters(uint8_t slave, uint16_t address, uint16_t count, const uint16_t *values);
+
+    // Reads with function (01-04) every periodMs, 0 for as often as the bus
+    // allows; returns an id for removePoll(), or -1
+    int addPoll(uint8_t slave, ModbusFunction function, uint16_t address, uint16_t count, uint32_t periodMs,
+                PollCallback cb);
+    void removePoll(int id);
+
+    SlaveStats getSlaveStats(uint8_t slave);
+    BusStats getBusStats();
+
+private:
+    struct Request {
+        uint8_t adu[MODBUS_MAX_ADU];
+        size_t length;
+        size_t expected;            // reply length, 0 if none comes
+        uint16_t count;             // values to copy out
+        uint8_t *bits;
+        uint16_t *values;
+        esp_err_t result;
+        TaskHandle_t waiter;
+        std::atomic<bool> done;     // set after result, which the waiter then reads
+    };
+
+    struct Poll {
+        int id;
+        uint8_t adu[8];
+        size_t expected;
+        int64_t periodUs;
+        int64_t dueUs;
+        PollCallback cb;
+    };
+
+    struct Slave {
+        SlaveStats stats;
+        int failures;               // consecutive
+        int64_t retryAtUs;          // while offline
+    };
+
+    static void busTask(void *arg);
+    bool runDuePoll(TickType_t *wait);
+    esp_err_t request(Request &req);
+    void execute(Request &req);
+    esp_err_t transact(const uint8_t *adu, size_t length, size_t expected, ModbusResponse &response);
+    esp_err_t parse(const uint8_t *adu, size_t length, size_t expected, ModbusResponse &response);
+    void record(uint8_t slave, esp_err_t err, uint8_t exception, uint32_t latencyUs);
+    static size_t expectedReply(ModbusFunction function, uint16_t count);
+    static size_t buildRead(uint8_t *adu, uint8_t slave, ModbusFunction function, uint16_t address, uint16_t count);
+
+    ModbusTransport &transport;
+    uint32_t responseTimeoutMs;
+    int retries;
+
+    TaskHandle_t taskHandle = nullptr;
+    SemaphoreHandle_t stopped;              // given by the bus task as it exits
+    std::atomic<bool> stopping{false};
+    QueueHandle_t requests = nullptr;       // Request *, nullptr to wake the task
+    SemaphoreHandle_t queueMutex;           // held to send to requests, so end() cannot delete it meanwhile
+
+    SemaphoreHandle_t mutex;                // polls, slaves and bus stats
+    std::vector<Poll> polls;
+    int nextPollId = 1;
+    std::map<uint8_t, Slave> slaves;
+    BusStats busStats = {};
+    uint8_t reply[MODBUS_MAX_ADU];
+};
@@ -0,0 +1,42 @@
+#include "ModbusRTU.hpp"
+#include <array>
+
+static constexpr std::array<uint16_t, 256> CRC_TABLE = [] {
+    std::array<uint16_t, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint16_t modbusCrc16(const uint8_t *data, size_t length, uint16_t crc) {
+    while (length--) {
+        crc = (crc >> 8) ^ CRC_TABLE[(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+size_t modbusAppendCrc(uint8_t *adu, size_t length) {
+    uint16_t crc = modbusCrc16(adu, length);
+    adu[length] = crc & 0xFF;
+    adu[length + 1] = crc >> 8;
+    return length + 2;
+}
+
+bool modbusCheckCrc(const uint8_t *adu, size_t length) {
+    if (length < 4) return false;
+    uint16_t crc = modbusCrc16(adu, length - 2);
+    return adu[length - 2] == (crc & 0xFF) && adu[length - 1] == (crc >> 8);
+}
+
+uint32_t modbusCharTimeUs(uint32_t baud) {
+    return (11 * 1000000UL + baud - 1) / baud;
+}
+
+uint32_t modbusFrameGapUs(uint32_t baud) {
+    return baud > 19200 ? 1750 : (modbusCharTimeUs(baud) * 7 + 1) / 2;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "esp_err.h"
+#include <cstddef>
+#include <cstdint>
+
+// Modbus RTU on a serial line. An ADU is the slave address, the PDU (function
+// code and its data, big-endian) and a CRC-16 sent low byte first. Frames are
+// told apart by silence: at least 3.5 character times between them.
+
+static constexpr size_t MODBUS_MAX_ADU = 256;
+static constexpr uint8_t MODBUS_BROADCAST = 0;
+static constexpr uint8_t MODBUS_MAX_SLAVE = 247;
+static constexpr uint8_t MODBUS_EXCEPTION_FLAG = 0x80;
+
+enum class ModbusFunction : uint8_t {
+    ReadCoils = 0x01,
+    ReadDiscreteInputs = 0x02,
+    ReadHoldingRegisters = 0x03,
+    ReadInputRegisters = 0x04,
+    WriteSingleCoil = 0x05,
+    WriteSingleRegister = 0x06,
+    WriteMultipleCoils = 0x0F,
+    WriteMultipleRegisters = 0x10
+};
+
+// Exception codes a slave answers with
+static constexpr uint8_t MODBUS_ILLEGAL_FUNCTION = 0x01;
+static constexpr uint8_t MODBUS_ILLEGAL_DATA_ADDRESS = 0x02;
+static constexpr uint8_t MODBUS_ILLEGAL_DATA_VALUE = 0x03;
+
+// A reply, valid for the duration of the callback it is passed to
+struct ModbusResponse {
+    uint8_t slave;
+    ModbusFunction function;
+    uint8_t exception;          // the slave's exception code, 0 if it did not refuse
+    const uint8_t *data;        // reads: the values after the byte count; writes: address and value/count
+    size_t length;
+
+    uint16_t reg(size_t i) const { return data[2 * i] << 8 | data[2 * i + 1]; }
+    bool bit(size_t i) const { return data[i / 8] & (1 << (i % 8)); }
+};
+
+// CRC-16/MODBUS (reflected 0x8005, initial 0xFFFF), a byte per table lookup
+uint16_t modbusCrc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+// Appends the CRC to an ADU of length bytes; returns the new length
+size_t modbusAppendCrc(uint8_t *adu, size_t length);
+// True if the ADU is long enough and its CRC matches
+bool modbusCheckCrc(const uint8_t *adu, size_t length);
+
+// One character on the wire: start, 8 data, parity or second stop, stop bit
+uint32_t modbusCharTimeUs(uint32_t baud);
+// The silence that ends a frame: 3.5 characters, fixed at 1750 us above 19200 baud
+uint32_t modbusFrameGapUs(uint32_t baud);
+
+// Carries ADUs between the master and the bus. ModbusSerialTransport drives a
+// UART; ModbusSimBus (CONFIG_MODBUS_RTU_SIM) answers from simulated slaves.
+class ModbusTransport {
+public:
+    virtual ~ModbusTransport() = default;
+
+    // Sends an ADU once the bus has been silent for the frame gap
+    virtual esp_err_t send(const uint8_t *adu, size_t length) = 0;
+    // Waits up to timeoutMs for a whole frame, ended by the frame gap; returns
+    // its length, 0 if none came
+    virtual size_t receive(uint8_t *adu, size_t size, uint32_t timeoutMs) = 0;
+    // Drops anything received, such as a reply that came too late
+    virtual void discard() = 0;
+    virtual uint32_t charTimeUs() const = 0;
+};
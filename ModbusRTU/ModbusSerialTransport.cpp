@@ -0,0 +1,126 @@
+#include "ModbusSerialTransport.hpp"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "freertos/task.h"
+#include <algorithm>
+
+static const char *TAG = "ModbusSerial";
+
+// uart_set_rx_timeout() takes at most 126; some chips and baud rates allow less
+#define MODBUS_MAX_RX_TIMEOUT 126
+// 3.5 characters, rounded up
+#define MODBUS_MIN_RX_TIMEOUT 4
+
+ModbusSerialTransport::ModbusSerialTransport(HardwareSerial &serial) : serial(serial) {
+    frameEnd = xSemaphoreCreateBinary();
+}
+
+ModbusSerialTransport::~ModbusSerialTransport() {
+    end();
+    vSemaphoreDelete(frameEnd);
+}
+
+esp_err_t ModbusSerialTransport::begin(uint32_t baud, uint32_t config, int8_t rxPin, int8_t txPin, int8_t dePin) {
+    charUs = modbusCharTimeUs(baud);
+    gapUs = modbusFrameGapUs(baud);
+
+    // Room for a whole frame plus whatever arrives while it is read
+    serial.setRxBufferSize(2 * MODBUS_MAX_ADU);
+    serial.begin(baud, config, rxPin, txPin);
+    if (!serial) {
+        return ESP_FAIL;
+    }
+    if (dePin >= 0) {
+        serial.setPins(rxPin, txPin, -1, dePin);
+        if (!serial.setMode(UART_MODE_RS485_HALF_DUPLEX)) {
+            ESP_LOGE(TAG, "RS-485 half-duplex mode not supported on UART%d", serial.getUartNum());
+            serial.end();
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    // The RX timeout counts in characters: the first whole one past 3.5.
+    // At high baud rates the fixed 1750 us gap takes more characters than
+    // the hardware counts; any timeout of 4 or more still ends a frame
+    // correctly, so take the longest one the UART accepts.
+    int timeout = std::min((gapUs + charUs - 1) / charUs, (uint32_t)MODBUS_MAX_RX_TIMEOUT);
+    while (!serial.setRxTimeout(timeout)) {
+        if (--timeout < MODBUS_MIN_RX_TIMEOUT) {
+            ESP_LOGE(TAG, "UART%d cannot time out a frame gap at %lu baud", serial.getUartNum(), (unsigned long)baud);
+            serial.end();
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    // A threshold no frame reaches, so only the idle line calls back
+    serial.onReceive([this]() { xSemaphoreGive(frameEnd); }, MODBUS_MAX_ADU + 1);
+
+    idleSinceUs = esp_timer_get_time();
+    ESP_LOGI(TAG, "UART%d at %lu baud, frame gap %lu us%s", serial.getUartNum(), (unsigned long)baud,
+             (unsigned long)gapUs, dePin >= 0 ? ", RS-485" : "");
+    return ESP_OK;
+}
+
+void ModbusSerialTransport::end() {
+    serial.onReceive(nullptr);
+    serial.end();
+}
+
+esp_err_t ModbusSerialTransport::send(const uint8_t *adu, size_t length) {
+    // Keep the bus quiet for a frame gap after the last frame on it: the
+    // whole ticks of it asleep, only the rest spinning
+    int64_t quietUs = idleSinceUs + gapUs - esp_timer_get_time();
+    if (quietUs > 0) {
+        uint32_t tickUs = portTICK_PERIOD_MS * 1000;
+        if (quietUs >= tickUs) {
+            vTaskDelay(quietUs / tickUs);
+        }
+        quietUs = idleSinceUs + gapUs - esp_timer_get_time();
+        if (quietUs > 0) {
+            esp_rom_delay_us(quietUs);
+        }
+    }
+    discard();
+
+    if (serial.write(adu, length) != length) {
+        return ESP_FAIL;
+    }
+    // Returns once the last bit is out, when DE has been released
+    serial.flush();
+    idleSinceUs = esp_timer_get_time();
+    return ESP_OK;
+}
+
+size_t ModbusSerialTransport::receive(uint8_t *adu, size_t size, uint32_t timeoutMs) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wait = pdMS_TO_TICKS(timeoutMs);
+
+    while (true) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= wait || xSemaphoreTake(frameEnd, wait - elapsed) != pdTRUE) {
+            return 0;
+        }
+        int available = serial.available();
+        if (available <= 0) {
+            continue;
+        }
+        // The frame gap has passed already
+        idleSinceUs = esp_timer_get_time() - gapUs;
+        size_t length = serial.readBytes(adu, std::min((size_t)available, size));
+        if (available > (int)size) {
+            ESP_LOGW(TAG, "Frame of %d bytes dropped", available);
+            discard();
+            continue;
+        }
+        return length;
+    }
+}
+
+void ModbusSerialTransport::discard() {
+    uint8_t scratch[64];
+    int available;
+    while ((available = serial.available()) > 0) {
+        serial.readBytes(scratch, std::min((size_t)available, sizeof(scratch)));
+    }
+    xSemaphoreTake(frameEnd, 0);
+}
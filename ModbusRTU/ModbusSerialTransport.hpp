@@ -0,0 +1,35 @@
+#pragma once
+
+#include "ModbusRTU.hpp"
+#include "Serial.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Modbus RTU over a HardwareSerial port. The UART's RX timeout is set to the
+// frame gap, so the port's onReceive() task is woken exactly when a reply
+// ends; no polling and no software timers. With a DE pin the port runs in
+// RS-485 half-duplex mode and the UART switches the transceiver itself. Wire
+// the transceiver's /RE with DE, so it does not echo what the master sends.
+class ModbusSerialTransport : public ModbusTransport {
+public:
+    explicit ModbusSerialTransport(HardwareSerial &serial);
+    ~ModbusSerialTransport() override;
+
+    // Takes over the port, including its onReceive() callback. dePin is the
+    // transceiver's driver enable, -1 for a link that needs none.
+    esp_err_t begin(uint32_t baud, uint32_t config = SERIAL_8E1, int8_t rxPin = -1, int8_t txPin = -1,
+                    int8_t dePin = -1);
+    void end();
+
+    esp_err_t send(const uint8_t *adu, size_t length) override;
+    size_t receive(uint8_t *adu, size_t size, uint32_t timeoutMs) override;
+    void discard() override;
+    uint32_t charTimeUs() const override { return charUs; }
+
+private:
+    HardwareSerial &serial;
+    SemaphoreHandle_t frameEnd = nullptr;   // given by the port's RX task when the line goes idle
+    uint32_t charUs = 0;
+    uint32_t gapUs = 0;
+    int64_t idleSinceUs = 0;                // when the bus last fell silent
+};
@@ -0,0 +1,216 @@
+#include "ModbusSimBus.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_rom_sys.h"
+#include <cstring>
+
+ModbusSimSlave::ModbusSimSlave(uint8_t address, uint16_t registers, uint16_t coils)
+    : holdingRegisters(registers), inputRegisters(registers), coils(coils), discreteInputs(coils),
+      slaveAddress(address) {}
+
+size_t ModbusSimSlave::handle(const uint8_t *adu, size_t length, uint8_t *reply) {
+    // A slave stays silent on a frame it cannot trust
+    if (!modbusCheckCrc(adu, length)) {
+        return 0;
+    }
+    if (adu[0] != slaveAddress && adu[0] != MODBUS_BROADCAST) {
+        return 0;
+    }
+
+    size_t replyLength = 0;
+    uint8_t exception = execute(adu, length - 2, reply, replyLength);
+    if (adu[0] == MODBUS_BROADCAST) {
+        return 0;
+    }
+    reply[0] = slaveAddress;
+    if (exception) {
+        reply[1] = adu[1] | MODBUS_EXCEPTION_FLAG;
+        reply[2] = exception;
+        replyLength = 3;
+    }
+    return modbusAppendCrc(reply, replyLength);
+}
+
+// Runs the request in adu (without its CRC) and builds the reply after the
+// address; returns an exception code, 0 on success
+uint8_t ModbusSimSlave::execute(const uint8_t *adu, size_t length, uint8_t *reply, size_t &replyLength) {
+    uint8_t function = adu[1];
+    reply[1] = function;
+    if (length < 6) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    uint16_t address = adu[2] << 8 | adu[3];
+    uint16_t count = adu[4] << 8 | adu[5];
+
+    switch (static_cast<ModbusFunction>(function)) {
+        case ModbusFunction::ReadCoils:
+        case ModbusFunction::ReadDiscreteInputs: {
+            const std::vector<uint8_t> &bits =
+                function == static_cast<uint8_t>(ModbusFunction::ReadCoils) ? coils : discreteInputs;
+            if (count == 0 || count > 2000) {
+                return MODBUS_ILLEGAL_DATA_VALUE;
+            }
+            if (address + count > bits.size()) {
+                return MODBUS_ILLEGAL_DATA_ADDRESS;
+            }
+            size_t bytes = (count + 7) / 8;
+            reply[2] = bytes;
+            memset(reply + 3, 0, bytes);
+            for (size_t i = 0; i < count; i++) {
+                if (bits[address + i]) {
+                    reply[3 + i / 8] |= 1 << (i % 8);
+                }
+            }
+            replyLength = 3 + bytes;
+            return 0;
+        }
+
+        case ModbusFunction::ReadHoldingRegisters:
+        case ModbusFunction::ReadInputRegisters: {
+            const std::vector<uint16_t> &registers =
+                function == static_cast<uint8_t>(ModbusFunction::ReadHoldingRegisters) ? holdingRegisters
+                                                                                         : inputRegisters;
+            if (count == 0 || count > 125) {
+                return MODBUS_ILLEGAL_DATA_VALUE;
+            }
+            if (address + count > registers.size()) {
+                return MODBUS_ILLEGAL_DATA_ADDRESS;
+            }
+            reply[2] = 2 * count;
+            for (size_t i = 0; i < count; i++) {
+                reply[3 + 2 * i] = registers[address + i] >> 8;
+                reply[4 + 2 * i] = registers[address + i] & 0xFF;
+            }
+            replyLength = 3 + 2 * count;
+            return 0;
+        }
+
+        case ModbusFunction::WriteSingleCoil:
+            if (count != 0xFF00 && count != 0x0000) {
+                return MODBUS_ILLEGAL_DATA_VALUE;
+            }
+            if (address >= coils.size()) {
+                return MODBUS_ILLEGAL_DATA_ADDRESS;
+            }
+            coils[address] = count ? 1 : 0;
+            break;
+
+        case ModbusFunction::WriteSingleRegister:
+            if (address >= holdingRegisters.size()) {
+                return MODBUS_ILLEGAL_DATA_ADDRESS;
+            }
+            holdingRegisters[address] = count;
+            break;
+
+        case ModbusFunction::WriteMultipleCoils:
+            if (count == 0 || count > 1968 || length != 7 + adu[6] || adu[6] != (count + 7) / 8) {
+                return MODBUS_ILLEGAL_DATA_VALUE;
+            }
+            if (address + count > coils.size()) {
+                return MODBUS_ILLEGAL_DATA_ADDRESS;
+            }
+            for (size_t i = 0; i < count; i++) {
+                coils[address + i] = (adu[7 + i / 8] >> (i % 8)) & 1;
+            }
+            break;
+
+        case ModbusFunction::WriteMultipleRegisters:
+            if (count == 0 || count > 123 || length != 7 + adu[6] || adu[6] != 2 * count) {
+                return MODBUS_ILLEGAL_DATA_VALUE;
+            }
+            if (address + count > holdingRegisters.size()) {
+                return MODBUS_ILLEGAL_DATA_ADDRESS;
+            }
+            for (size_t i = 0; i < count; i++) {
+                holdingRegisters[address + i] = adu[7 + 2 * i] << 8 | adu[8 + 2 * i];
+            }
+            break;
+
+        default:
+            return MODBUS_ILLEGAL_FUNCTION;
+    }
+
+    // Writes echo the address and the value or count
+    memcpy(reply + 2, adu + 2, 4);
+    replyLength = 6;
+    return 0;
+}
+
+ModbusSimBus::ModbusSimBus(const ModbusSimConfig &config) {
+    setConfig(config);
+}
+
+void ModbusSimBus::setConfig(const ModbusSimConfig &config) {
+    this->config = config;
+    charUs = modbusCharTimeUs(config.baud);
+    gapUs = modbusFrameGapUs(config.baud);
+    randomState = config.seed ? config.seed : 1;
+}
+
+void ModbusSimBus::addSlave(ModbusSimSlave *slave) {
+    slaves.push_back(slave);
+}
+
+uint32_t ModbusSimBus::nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+bool ModbusSimBus::chance(float rate) {
+    return rate > 0 && nextRandom() < rate * 4294967296.0f;
+}
+
+void ModbusSimBus::elapse(uint32_t us) {
+    busUs += us;
+    if (!config.realTime) {
+        return;
+    }
+    uint32_t tickUs = portTICK_PERIOD_MS * 1000;
+    if (us >= tickUs) {
+        vTaskDelay(us / tickUs);
+    }
+    esp_rom_delay_us(us % tickUs);
+}
+
+// Every slave sees the request, as on a shared bus; at most the addressed one
+// answers, after its turnaround
+esp_err_t ModbusSimBus::send(const uint8_t *adu, size_t length) {
+    if (length < 4 || length > MODBUS_MAX_ADU) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    elapse(gapUs + length * charUs);
+
+    pendingLength = 0;
+    bool lost = chance(config.lossRate);
+    for (ModbusSimSlave *slave : slaves) {
+        size_t n = slave->handle(adu, length, pending);
+        if (n > 0 && !lost) {
+            pendingLength = n;
+        }
+    }
+    if (pendingLength > 0 && chance(config.corruptRate)) {
+        pending[nextRandom() % pendingLength] ^= 1 << (nextRandom() % 8);
+    }
+    return ESP_OK;
+}
+
+size_t ModbusSimBus::receive(uint8_t *adu, size_t size, uint32_t timeoutMs) {
+    if (pendingLength == 0 || pendingLength > size) {
+        pendingLength = 0;
+        elapse(timeoutMs * 1000);
+        return 0;
+    }
+    // The reply, then the gap that ends it
+    elapse(config.turnaroundUs + pendingLength * charUs + gapUs);
+    size_t length = pendingLength;
+    memcpy(adu, pending, length);
+    pendingLength = 0;
+    return length;
+}
+
+void ModbusSimBus::discard() {
+    pendingLength = 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ModbusRTU.hpp"
+#include <vector>
+
+// Bus model shared by the slaves on a ModbusSimBus
+struct ModbusSimConfig {
+    uint32_t baud = 115200;         // sets the character time and frame gap
+    uint32_t turnaroundUs = 500;    // a slave's processing time before it answers
+    float lossRate = 0.0f;          // chance a request goes unanswered
+    float corruptRate = 0.0f;       // chance a reply arrives with a bit flipped
+    bool realTime = false;          // wait out the modeled time, else only account for it
+    uint32_t seed = 1;              // the same seed replays the same losses for the same traffic
+};
+
+// A slave with a register and coil map of its own, answering functions 01-06,
+// 0F and 10 as a device would, exceptions included. Set its values up before
+// the master begins; they are not guarded against the bus task.
+class ModbusSimSlave {
+public:
+    explicit ModbusSimSlave(uint8_t address, uint16_t registers = 128, uint16_t coils = 128);
+
+    uint8_t address() const { return slaveAddress; }
+
+    // Builds the reply to a request into reply; returns its length, 0 if the
+    // request is not for this slave, is corrupted or was a broadcast
+    size_t handle(const uint8_t *adu, size_t length, uint8_t *reply);
+
+    std::vector<uint16_t> holdingRegisters;
+    std::vector<uint16_t> inputRegisters;
+    std::vector<uint8_t> coils;             // a byte per coil, 0 or 1
+    std::vector<uint8_t> discreteInputs;
+
+private:
+    uint8_t execute(const uint8_t *adu, size_t length, uint8_t *reply, size_t &replyLength);
+
+    uint8_t slaveAddress;
+};
+
+// ModbusTransport that loops the master's requests back to simulated slaves,
+// for testing and benchmarking a master without a bus. Bus time is modeled
+// from the frame lengths, gaps and turnaround at the configured baud rate and
+// accumulated in busTimeUs(); a request nobody answers costs the full timeout.
+class ModbusSimBus : public ModbusTransport {
+public:
+    explicit ModbusSimBus(const ModbusSimConfig &config = {});
+
+    void setConfig(const ModbusSimConfig &config);
+    // Not owned; add them before the master begins
+    void addSlave(ModbusSimSlave *slave);
+
+    esp_err_t send(const uint8_t *adu, size_t length) override;
+    size_t receive(uint8_t *adu, size_t size, uint32_t timeoutMs) override;
+    void discard() override;
+    uint32_t charTimeUs() const override { return charUs; }
+
+    // Modeled time the bus has been in use since it was created
+    int64_t busTimeUs() const { return busUs; }
+
+private:
+    void elapse(uint32_t us);
+    bool chance(float rate);
+    uint32_t nextRandom();
+
+    ModbusSimConfig config;
+    uint32_t charUs;
+    uint32_t gapUs;
+    uint32_t randomState;
+    std::vector<ModbusSimSlave *> slaves;
+    volatile int64_t busUs = 0;
+    uint8_t pending[MODBUS_MAX_ADU];        // reply to the last request
+    size_t pendingLength = 0;
+};
@@ -0,0 +1,8 @@
+// Host build only
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+inline void esp_rom_delay_us(uint32_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
@@ -0,0 +1,60 @@
+// Host build only: FreeRTOS on std::thread, enough for the master and the
+// simulated bus. A tick is a millisecond.
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// A counting semaphore, also standing in for task notifications
+struct HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t count = 0;
+    uint32_t max = 1;
+    std::recursive_timed_mutex recursive;
+
+    bool take(TickType_t ticks, bool all = false, uint32_t *taken = nullptr)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto ready = [this] { return count > 0; };
+        if (ticks == portMAX_DELAY)
+            cv.wait(lock, ready);
+        else if (!cv.wait_for(lock, std::chrono::milliseconds(ticks), ready))
+            return false;
+        if (taken)
+            *taken = count;
+        count = all ? 0 : count - 1;
+        return true;
+    }
+
+    bool give()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (count >= max)
+            return false;
+        count++;
+        cv.notify_one();
+        return true;
+    }
+};
+
+inline TickType_t xTaskGetTickCount()
+{
+    using namespace std::chrono;
+    static const auto start = steady_clock::now();
+    return (TickType_t)duration_cast<milliseconds>(steady_clock::now() - start).count();
+}
@@ -0,0 +1,59 @@
+// Host build only: a queue of fixed-size items that blocks like FreeRTOS's
+#pragma once
+
+#include "FreeRTOS.h"
+#include <cstring>
+#include <deque>
+#include <vector>
+
+struct HostQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t length;
+    size_t itemSize;
+    std::deque<std::vector<uint8_t>> items;
+
+    // Waits up to ticks for ready(), with the lock held on return
+    template <typename Ready> bool wait(std::unique_lock<std::mutex> &lock, TickType_t ticks, Ready ready)
+    {
+        if (ticks == portMAX_DELAY)
+        {
+            changed.wait(lock, ready);
+            return true;
+        }
+        return changed.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+    }
+};
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    QueueHandle_t queue = new HostQueue;
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+inline void vQueueDelete(QueueHandle_t queue) { delete queue; }
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!queue->wait(lock, ticks, [queue] { return queue->items.size() < queue->length; }))
+        return pdFALSE;
+    const uint8_t *bytes = (const uint8_t *)item;
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!queue->wait(lock, ticks, [queue] { return !queue->items.empty(); }))
+        return pdFALSE;
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
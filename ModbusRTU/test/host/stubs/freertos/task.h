@@ -0,0 +1,64 @@
+// Host build only: tasks are detached threads, each with a notification count
+#pragma once
+
+#include "FreeRTOS.h"
+#include <thread>
+
+struct HostTask {
+    HostSemaphore notification;
+    HostTask() { notification.max = UINT32_MAX; }
+};
+
+typedef HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+inline TaskHandle_t &hostCurrentTask()
+{
+    thread_local TaskHandle_t current = nullptr;
+    return current;
+}
+
+// The calling thread's task, made on first use for threads that are not tasks
+inline TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    TaskHandle_t &current = hostCurrentTask();
+    if (!current)
+        current = new HostTask;
+    return current;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *, uint32_t, void *arg, UBaseType_t,
+                                          TaskHandle_t *handle, int)
+{
+    // Created here so the handle is valid before the task runs
+    TaskHandle_t task = new HostTask;
+    if (handle)
+        *handle = task;
+    std::thread([task, function, arg] {
+        hostCurrentTask() = task;
+        function(arg);
+    }).detach();
+    return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack, void *arg,
+                              UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(function, name, stack, arg, priority, handle, 0);
+}
+
+inline void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
+inline void vTaskDelete(TaskHandle_t) {}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notification.give();
+    return pdPASS;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    uint32_t count = 0;
+    xTaskGetCurrentTaskHandle()->notification.take(ticks, clearOnExit, &count);
+    return count;
+}
@@ -0,0 +1,175 @@
+// Host tests for ModbusMaster against ModbusSimSlaves on a ModbusSimBus, with
+// FreeRTOS stubbed on std::thread.
+//
+//   make -C ModbusRTU/test/host
+//
+// Reads see what writes left; a refusal comes back as the slave's exception,
+// a corrupted reply as a CRC error and a silent slave as a timeout, each
+// after the retries and counted in the slave's stats. Then polls keep their
+// period, even one too long for microseconds in 32 bits, and requests racing
+// end() fail cleanly instead of using the freed queue.
+
+#include "ModbusMaster.hpp"
+#include "ModbusSimBus.hpp"
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+static int fails = 0;
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+static void testReadWrite(ModbusMaster &master) {
+    const uint16_t values[3] = {0x1234, 0xBEEF, 7};
+    uint16_t read[3] = {};
+    CHECK(master.writeMultipleRegisters(1, 10, 3, values) == ESP_OK);
+    CHECK(master.readHoldingRegisters(1, 10, 3, read) == ESP_OK);
+    CHECK(read[0] == 0x1234 && read[1] == 0xBEEF && read[2] == 7);
+
+    CHECK(master.writeSingleRegister(2, 0, 42) == ESP_OK);
+    CHECK(master.readHoldingRegisters(2, 0, 1, read) == ESP_OK && read[0] == 42);
+    // Slave 1 kept its own map
+    CHECK(master.readHoldingRegisters(1, 0, 1, read) == ESP_OK && read[0] == 0);
+
+    const uint8_t bits[2] = {0x05, 0x01};       // coils 0, 2 and 8
+    uint8_t readBits[2] = {};
+    CHECK(master.writeMultipleCoils(1, 0, 9, bits) == ESP_OK);
+    CHECK(master.writeSingleCoil(1, 1, true) == ESP_OK);
+    CHECK(master.readCoils(1, 0, 9, readBits) == ESP_OK);
+    CHECK(readBits[0] == 0x07 && readBits[1] == 0x01);
+
+    ModbusMaster::SlaveStats stats = master.getSlaveStats(1);
+    CHECK(stats.requests == 6 && stats.replies == 6 && !stats.offline);
+}
+
+static void testArguments(ModbusMaster &master) {
+    const uint16_t value = 1;
+    const uint8_t bit = 1;
+    uint16_t read;
+    CHECK(master.readHoldingRegisters(MODBUS_BROADCAST, 0, 1, &read) == ESP_ERR_INVALID_ARG);
+    CHECK(master.readHoldingRegisters(MODBUS_MAX_SLAVE + 1, 0, 1, &read) == ESP_ERR_INVALID_ARG);
+    CHECK(master.readHoldingRegisters(1, 0, 126, &read) == ESP_ERR_INVALID_ARG);
+    CHECK(master.writeSingleCoil(MODBUS_MAX_SLAVE + 1, 0, true) == ESP_ERR_INVALID_ARG);
+    CHECK(master.writeSingleRegister(255, 0, 1) == ESP_ERR_INVALID_ARG);
+    CHECK(master.writeMultipleCoils(MODBUS_MAX_SLAVE + 1, 0, 1, &bit) == ESP_ERR_INVALID_ARG);
+    CHECK(master.writeMultipleRegisters(MODBUS_MAX_SLAVE + 1, 0, 1, &value) == ESP_ERR_INVALID_ARG);
+    CHECK(master.writeMultipleRegisters(1, 0, 124, &value) == ESP_ERR_INVALID_ARG);
+    CHECK(master.getSlaveStats(MODBUS_MAX_SLAVE + 1).requests == 0);
+}
+
+static void testException(ModbusMaster &master) {
+    uint16_t read[4];
+    ModbusMaster::SlaveStats before = master.getSlaveStats(1);
+    // The slave has 128 registers
+    CHECK(master.readHoldingRegisters(1, 126, 4, read) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(master.writeSingleCoil(1, 500, true) == ESP_ERR_INVALID_RESPONSE);
+    ModbusMaster::SlaveStats stats = master.getSlaveStats(1);
+    // Answered, so neither retried nor counted against the slave
+    CHECK(stats.requests == before.requests + 2 && stats.exceptions == before.exceptions + 2);
+    CHECK(stats.lastException == MODBUS_ILLEGAL_DATA_ADDRESS && !stats.offline);
+}
+
+static void testCrcError(ModbusMaster &master, ModbusSimBus &bus) {
+    uint16_t read;
+    ModbusSimConfig config;
+    config.corruptRate = 1.0f;
+    bus.setConfig(config);
+    master.setRetries(2);
+    ModbusMaster::SlaveStats before = master.getSlaveStats(2);
+    CHECK(master.readHoldingRegisters(2, 0, 1, &read) == ESP_ERR_INVALID_CRC);
+    ModbusMaster::SlaveStats stats = master.getSlaveStats(2);
+    CHECK(stats.requests == before.requests + 3 && stats.crcErrors == before.crcErrors + 3);
+    CHECK(stats.replies == before.replies && !stats.offline);
+
+    bus.setConfig(ModbusSimConfig());
+    CHECK(master.readHoldingRegisters(2, 0, 1, &read) == ESP_OK && read == 42);
+}
+
+static void testTimeout(ModbusMaster &master) {
+    uint16_t read;
+    master.setRetries(1);
+    // Nothing answers at address 9; it goes offline after three transactions
+    for (int i = 0; i < 3; i++) {
+        CHECK(master.readHoldingRegisters(9, 0, 1, &read) == ESP_ERR_TIMEOUT);
+    }
+    ModbusMaster::SlaveStats stats = master.getSlaveStats(9);
+    CHECK(stats.requests == 6 && stats.timeouts == 6 && stats.replies == 0 && stats.offline);
+    // Offline, it gets a single attempt
+    CHECK(master.readHoldingRegisters(9, 0, 1, &read) == ESP_ERR_TIMEOUT);
+    CHECK(master.getSlaveStats(9).requests == 7);
+    CHECK(master.getBusStats().failures >= 4);
+}
+
+static void testPolls(ModbusMaster &master) {
+    std::atomic<int> often{0}, rarely{0}, bad{0};
+    int fast = master.addPoll(1, ModbusFunction::ReadHoldingRegisters, 10, 2, 20,
+                              [&](esp_err_t err, const ModbusResponse &response) {
+                                  if (err != ESP_OK || response.length != 4 || response.reg(1) != 0xBEEF) {
+                                      bad++;
+                                  }
+                                  often++;
+                              });
+    // 4294968 s in microseconds wraps a uint32_t to 704 us
+    int slow = master.addPoll(2, ModbusFunction::ReadCoils, 0, 8, 4294968,
+                              [&](esp_err_t, const ModbusResponse &) { rarely++; });
+    CHECK(fast > 0 && slow > 0);
+    CHECK(master.addPoll(MODBUS_MAX_SLAVE + 1, ModbusFunction::ReadCoils, 0, 1, 10, nullptr) == -1);
+    CHECK(master.addPoll(1, ModbusFunction::WriteSingleCoil, 0, 1, 10, nullptr) == -1);
+
+    vTaskDelay(pdMS_TO_TICKS(300));
+    master.removePoll(fast);
+    master.removePoll(slow);
+    int polled = often;
+    CHECK(polled >= 5 && polled <= 20 && bad == 0);
+    CHECK(rarely == 1);
+    vTaskDelay(pdMS_TO_TICKS(50));
+    CHECK(often == polled);
+}
+
+static void testEndRacingRequests(ModbusMaster &master) {
+    for (int round = 0; round < 20; round++) {
+        CHECK(master.begin() == ESP_OK);
+        std::atomic<int> unexpected{0};
+        std::vector<std::thread> clients;
+        for (int c = 0; c < 4; c++) {
+            clients.emplace_back([&master, &unexpected, c] {
+                uint16_t read;
+                for (int i = 0; i < 20; i++) {
+                    esp_err_t err = master.readHoldingRegisters(1 + c % 2, 0, 1, &read);
+                    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+                        unexpected++;
+                    }
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(round * 50));
+        master.end();
+        for (std::thread &client : clients) {
+            client.join();
+        }
+        CHECK(unexpected == 0);
+    }
+    uint16_t read;
+    CHECK(master.readHoldingRegisters(1, 0, 1, &read) == ESP_ERR_INVALID_STATE);
+}
+
+int main() {
+    ModbusSimBus bus;
+    ModbusSimSlave one(1), two(2);
+    bus.addSlave(&one);
+    bus.addSlave(&two);
+    ModbusMaster master(bus);
+    CHECK(master.begin() == ESP_OK);
+
+    testReadWrite(master);
+    testArguments(master);
+    testException(master);
+    testCrcError(master, bus);
+    testTimeout(master);
+    testPolls(master);
+    master.end();
+    testEndRacingRequests(master);
+
+    printf(fails ? "FAILED\n" : "all ok\n");
+    return fails != 0;
+}
@@ -0,0 +1,420 @@
+#include "OTAEspNow.hpp"
+#include "OTAVerifier.hpp"
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include <algorithm>
+#include <cstring>
+
+static const char *TAG = "OTAEspNow";
+
+static uint16_t readU16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t readU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeU16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void writeU32(uint8_t *p, uint32_t v) {
+    writeU16(p, v);
+    writeU16(p + 2, v >> 16);
+}
+
+OTAEspNow::OTAEspNow(EspNowManager &manager) : manager(manager), sink(BLOCK_SIZE, SINK_BLOCKS) {
+    statusMutex = xSemaphoreCreateMutex();
+    listenMutex = xSemaphoreCreateMutex();
+}
+
+OTAEspNow::~OTAEspNow() {
+    stop();
+    vSemaphoreDelete(listenMutex);
+    vSemaphoreDelete(statusMutex);
+}
+
+void OTAEspNow::setCompletionCallback(CompletionCallback cb) {
+    completeCb = cb;
+}
+
+// Holds listenMutex throughout, so a concurrent listen() or distribute()
+// sees either nothing or a whole listener
+esp_err_t OTAEspNow::listen(const uint8_t *mac) {
+    xSemaphoreTake(listenMutex, portMAX_DELAY);
+    xSemaphoreTake(statusMutex, portMAX_DELAY);
+    bool busy = listening || distributing;
+    xSemaphoreGive(statusMutex);
+    if (busy) {
+        xSemaphoreGive(listenMutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    rxPool = (uint8_t *)malloc(RX_BUFFERS * (BLOCK_HEADER_LEN + BLOCK_SIZE));
+    freeBuffers = xQueueCreate(RX_BUFFERS, sizeof(uint8_t *));
+    rxMessages = xQueueCreate(RX_BUFFERS + 1, sizeof(RxMessage));
+    if (!rxPool || !freeBuffers || !rxMessages) {
+        deleteListener();
+        xSemaphoreGive(listenMutex);
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < RX_BUFFERS; ++i) {
+        uint8_t *buffer = rxPool + i * (BLOCK_HEADER_LEN + BLOCK_SIZE);
+        xQueueSend(freeBuffers, &buffer, 0);
+    }
+
+    memcpy(gatewayMac, mac, ESPNOW_MAC_LEN);
+    blockCount = 0;
+    active = false;
+    if (xTaskCreate(writerTask, "ota_espnow_task", 4096, this, 5, &writerHandle) != pdPASS) {
+        writerHandle = nullptr;
+        deleteListener();
+        xSemaphoreGive(listenMutex);
+        return ESP_FAIL;
+    }
+    listening = true;
+    xSemaphoreGive(listenMutex);
+    return ESP_OK;
+}
+
+// The writer task ends behind the messages queued already; its queues go
+// once it has
+void OTAEspNow::stop() {
+    xSemaphoreTake(listenMutex, portMAX_DELAY);
+    bool wasListening = listening;
+    listening = false;
+    xSemaphoreGive(listenMutex);
+    if (!wasListening) return;
+
+    RxMessage quit = {nullptr, 0};
+    stopperHandle = xTaskGetCurrentTaskHandle();
+    xQueueSend(rxMessages, &quit, portMAX_DELAY);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    writerHandle = nullptr;
+    deleteListener();
+}
+
+void OTAEspNow::deleteListener() {
+    if (freeBuffers) vQueueDelete(freeBuffers);
+    if (rxMessages) vQueueDelete(rxMessages);
+    free(rxPool);
+    freeBuffers = nullptr;
+    rxMessages = nullptr;
+    rxPool = nullptr;
+}
+
+// Manager's receive task: only copies the message for the writer task, so
+// flash erases never hold up the radio. Without a free buffer the message is
+// dropped and the block comes again in a repair round.
+bool OTAEspNow::handleMessage(const uint8_t *mac, const uint8_t *data, size_t len) {
+    if (len < HEADER_LEN || data[0] != MAGIC) return false;
+
+    if ((MessageType)data[1] == MessageType::STATUS) {
+        xSemaphoreTake(statusMutex, portMAX_DELAY);
+        size_t bitmapLen = (blockCount + 7) / 8;
+        if (distributing && readU32(data + 2) == imageId && len == HEADER_LEN + 1 + bitmapLen) {
+            for (Receiver &receiver : receivers) {
+                if (memcmp(receiver.mac, mac, ESPNOW_MAC_LEN) != 0) continue;
+                receiver.state = (ReceiverState)data[HEADER_LEN];
+                receiver.missing.assign(data + HEADER_LEN + 1, data + len);
+                receiver.replied = true;
+            }
+        }
+        xSemaphoreGive(statusMutex);
+        return true;
+    }
+
+    if (len > BLOCK_HEADER_LEN + BLOCK_SIZE) return true;
+    xSemaphoreTake(listenMutex, portMAX_DELAY);
+    RxMessage message;
+    if (listening && memcmp(mac, gatewayMac, ESPNOW_MAC_LEN) == 0 &&
+        xQueueReceive(freeBuffers, &message.data, 0) == pdTRUE) {
+        memcpy(message.data, data, len);
+        message.length = len;
+        xQueueSend(rxMessages, &message, 0);
+    }
+    xSemaphoreGive(listenMutex);
+    return true;
+}
+
+void OTAEspNow::writerTask(void *arg) {
+    OTAEspNow *self = static_cast<OTAEspNow *>(arg);
+    RxMessage message;
+    while (xQueueReceive(self->rxMessages, &message, portMAX_DELAY) == pdTRUE && message.data) {
+        switch ((MessageType)message.data[1]) {
+        case MessageType::ANNOUNCE:
+            if (message.length == ANNOUNCE_LEN) self->handleAnnounce(message.data);
+            break;
+        case MessageType::BLOCK:
+            if (message.length > BLOCK_HEADER_LEN) self->handleBlock(message.data, message.length);
+            break;
+        case MessageType::STATUS_REQUEST:
+            if (self->blockCount > 0 && readU32(message.data + 2) == self->imageId) self->sendStatus();
+            break;
+        default:
+            break;
+        }
+        xQueueSend(self->freeBuffers, &message.data, 0);
+    }
+
+    // Told to stop
+    if (self->active) self->fail(ESP_ERR_INVALID_STATE);
+    xTaskNotifyGive(self->stopperHandle);
+    vTaskDelete(NULL);
+}
+
+// Announcements repeat every round; only a new image starts over, and
+// abandons the one before, reported as failed before the new one is checked
+void OTAEspNow::handleAnnounce(const uint8_t *data) {
+    uint32_t id = readU32(data + 2);
+    if (blockCount > 0 && id == imageId) return;
+    if (active) {
+        ESP_LOGW(TAG, "Image %08lx abandoned for a new one", (unsigned long)imageId);
+        fail(ESP_ERR_INVALID_STATE);
+    }
+
+    uint32_t size = readU32(data + HEADER_LEN);
+    uint16_t announcedBlockSize = readU16(data + HEADER_LEN + 4);
+    if (size == 0 || announcedBlockSize == 0 || announcedBlockSize > BLOCK_SIZE) return;
+
+    imageId = id;
+    imageSize = size;
+    blockSize = announcedBlockSize;
+    blockCount = (size + blockSize - 1) / blockSize;
+    memcpy(digest, data + HEADER_LEN + 6, sizeof(digest));
+    received.assign((blockCount + 7) / 8, 0);
+    receivedCount = 0;
+    active = true;
+    state = ReceiverState::RECEIVING;
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (!partition || size > partition->size) {
+        ESP_LOGE(TAG, "No update partition for an image of %lu bytes", (unsigned long)size);
+        fail(ESP_ERR_INVALID_SIZE);
+        return;
+    }
+    sink.setPartition(partition);
+    esp_err_t err = sink.begin(0);
+    if (err != ESP_OK) {
+        fail(err);
+        return;
+    }
+    ESP_LOGI(TAG, "Receiving image of %lu bytes in %lu blocks", (unsigned long)size, (unsigned long)blockCount);
+}
+
+// Blocks may come in any order; the sink erases each sector before the
+// first block that reaches into it
+void OTAEspNow::handleBlock(const uint8_t *data, size_t len) {
+    uint32_t index = readU16(data + HEADER_LEN);
+    if (!active || readU32(data + 2) != imageId || index >= blockCount || testBit(received, index)) return;
+
+    uint32_t offset = index * blockSize;
+    size_t length = std::min<uint32_t>(blockSize, imageSize - offset);
+    const uint8_t *payload = data + BLOCK_HEADER_LEN;
+    if (len - BLOCK_HEADER_LEN != length) return;
+
+    if (index == 0 && !OTAVerifier::checkHeader(payload, length)) {
+        fail(ESP_ERR_INVALID_VERSION);
+        return;
+    }
+
+    uint8_t *block = sink.acquire();
+    memcpy(block, payload, length);
+    // Reports a failed write of an earlier block
+    esp_err_t err = sink.submitAt(block, length, offset);
+    if (err != ESP_OK) {
+        fail(err);
+        return;
+    }
+
+    setBit(received, index);
+    if (++receivedCount == blockCount) finishImage();
+}
+
+// Once every block is in flash, checks the image as a whole the way the
+// gateway hashed its copy, then makes it the one to boot
+void OTAEspNow::finishImage() {
+    uint8_t sha[32];
+    esp_err_t err = sink.end(true);
+    if (err == ESP_OK) err = esp_partition_get_sha256(sink.getPartition(), sha);
+    if (err == ESP_OK && memcmp(sha, digest, sizeof(sha)) != 0) {
+        ESP_LOGE(TAG, "Image SHA-256 does not match the gateway's");
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err == ESP_OK) err = sink.commit();
+    if (err != ESP_OK) {
+        fail(err);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Image received. Ready for restart.");
+    active = false;
+    state = ReceiverState::COMPLETE;
+    sendStatus();
+    if (completeCb) completeCb(ESP_OK);
+}
+
+// Abandons what the sink holds, if it still does
+void OTAEspNow::fail(esp_err_t err) {
+    sink.end(false);
+    active = false;
+    state = ReceiverState::FAILED;
+    sendStatus();
+    if (completeCb) completeCb(err);
+}
+
+void OTAEspNow::sendStatus() {
+    std::vector<uint8_t> message(HEADER_LEN + 1 + received.size(), 0);
+    size_t pos = writeHeader(message.data(), MessageType::STATUS);
+    message[pos++] = (uint8_t)state;
+    for (uint32_t i = 0; state == ReceiverState::RECEIVING && i < blockCount; ++i) {
+        if (!testBit(received, i)) message[pos + i / 8] |= 1 << (i % 8);
+    }
+    esp_err_t err = manager.sendWithAck(gatewayMac, message.data(), message.size(), pdMS_TO_TICKS(STATUS_TIMEOUT_MS));
+    if (err != ESP_OK) ESP_LOGW(TAG, "Status not sent: %s", esp_err_to_name(err));
+}
+
+size_t OTAEspNow::writeHeader(uint8_t *out, MessageType type) const {
+    out[0] = MAGIC;
+    out[1] = (uint8_t)type;
+    writeU32(out + 2, imageId);
+    return HEADER_LEN;
+}
+
+// To every receiver that is still receiving
+esp_err_t OTAEspNow::sendToPending(const uint8_t *data, size_t len) {
+    std::vector<uint8_t> macs;
+    xSemaphoreTake(statusMutex, portMAX_DELAY);
+    for (const Receiver &receiver : receivers) {
+        if (receiver.state == ReceiverState::RECEIVING) macs.insert(macs.end(), receiver.mac, receiver.mac + ESPNOW_MAC_LEN);
+    }
+    xSemaphoreGive(statusMutex);
+    if (macs.empty()) return ESP_OK;
+    return manager.sendMulticast((const uint8_t(*)[ESPNOW_MAC_LEN])macs.data(), macs.size() / ESPNOW_MAC_LEN, data, len);
+}
+
+// True once every receiver still receiving has answered the status request
+bool OTAEspNow::waitForStatus() {
+    for (uint32_t waited = 0; waited < STATUS_TIMEOUT_MS; waited += 10) {
+        bool all = true;
+        xSemaphoreTake(statusMutex, portMAX_DELAY);
+        for (const Receiver &receiver : receivers) {
+            all &= receiver.replied || receiver.state != ReceiverState::RECEIVING;
+        }
+        xSemaphoreGive(statusMutex);
+        if (all) return true;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return false;
+}
+
+// Each round announces the image, sends every block some receiver still
+// misses and collects their bitmaps. The first round sends them all.
+esp_err_t OTAEspNow::distribute(const esp_partition_t *image, const uint8_t (*macs)[ESPNOW_MAC_LEN], size_t count,
+                                int maxRounds) {
+    // Claimed under both locks, as listen() checks them; no STATUS matches
+    // until the receivers are set up below
+    xSemaphoreTake(listenMutex, portMAX_DELAY);
+    xSemaphoreTake(statusMutex, portMAX_DELAY);
+    bool busy = listening || distributing;
+    if (!busy) {
+        distributing = true;
+        receivers.clear();
+    }
+    xSemaphoreGive(statusMutex);
+    xSemaphoreGive(listenMutex);
+    if (busy) return ESP_ERR_INVALID_STATE;
+
+    esp_image_metadata_t metadata;
+    const esp_partition_pos_t position = {.offset = image->address, .size = image->size};
+    if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &position, &metadata) != ESP_OK ||
+        esp_partition_get_sha256(image, digest) != ESP_OK) {
+        ESP_LOGE(TAG, "No valid app image to distribute");
+        xSemaphoreTake(statusMutex, portMAX_DELAY);
+        distributing = false;
+        xSemaphoreGive(statusMutex);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(statusMutex, portMAX_DELAY);
+    imageId = readU32(digest);
+    imageSize = metadata.image_len;
+    blockSize = BLOCK_SIZE;
+    blockCount = (imageSize + blockSize - 1) / blockSize;
+    if (blockCount > UINT16_MAX + 1) {
+        distributing = false;
+        xSemaphoreGive(statusMutex);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t bitmapLen = (blockCount + 7) / 8;
+    receivers.assign(count, Receiver{});
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(receivers[i].mac, macs[i], ESPNOW_MAC_LEN);
+        receivers[i].state = ReceiverState::RECEIVING;
+        receivers[i].missing.assign(bitmapLen, 0);
+        for (uint32_t block = 0; block < blockCount; ++block) setBit(receivers[i].missing, block);
+    }
+    xSemaphoreGive(statusMutex);
+
+    std::vector<uint8_t> message(BLOCK_HEADER_LEN + BLOCK_SIZE);
+    std::vector<uint8_t> wanted(bitmapLen);
+    esp_err_t err = ESP_OK;
+    int pending = count;
+    for (int round = 0; round <= maxRounds && pending > 0 && err == ESP_OK; ++round) {
+        std::fill(wanted.begin(), wanted.end(), 0);
+        xSemaphoreTake(statusMutex, portMAX_DELAY);
+        for (Receiver &receiver : receivers) {
+            if (receiver.state != ReceiverState::RECEIVING) continue;
+            receiver.replied = false;
+            for (size_t i = 0; i < bitmapLen; ++i) wanted[i] |= receiver.missing[i];
+        }
+        xSemaphoreGive(statusMutex);
+
+        size_t pos = writeHeader(message.data(), MessageType::ANNOUNCE);
+        writeU32(&message[pos], imageSize);
+        writeU16(&message[pos + 4], blockSize);
+        memcpy(&message[pos + 6], digest, sizeof(digest));
+        err = sendToPending(message.data(), ANNOUNCE_LEN);
+
+        uint32_t sent = 0;
+        for (uint32_t block = 0; block < blockCount && err == ESP_OK; ++block) {
+            if (!testBit(wanted, block)) continue;
+            uint32_t offset = block * blockSize;
+            size_t length = std::min<uint32_t>(blockSize, imageSize - offset);
+            writeHeader(message.data(), MessageType::BLOCK);
+            writeU16(&message[HEADER_LEN], block);
+            err = esp_partition_read(image, offset, &message[BLOCK_HEADER_LEN], length);
+            if (err == ESP_OK) err = sendToPending(message.data(), BLOCK_HEADER_LEN + length);
+            sent++;
+        }
+
+        writeHeader(message.data(), MessageType::STATUS_REQUEST);
+        if (err == ESP_OK) err = sendToPending(message.data(), HEADER_LEN);
+        bool allReplied = err == ESP_OK && waitForStatus();
+
+        pending = 0;
+        xSemaphoreTake(statusMutex, portMAX_DELAY);
+        for (const Receiver &receiver : receivers) {
+            pending += receiver.state == ReceiverState::RECEIVING;
+        }
+        xSemaphoreGive(statusMutex);
+        ESP_LOGI(TAG, "Round %d: %lu blocks sent, %d receivers still receiving%s", round, (unsigned long)sent, pending,
+                 allReplied ? "" : ", some silent");
+    }
+
+    xSemaphoreTake(statusMutex, portMAX_DELAY);
+    distributing = false;
+    bool failed = false;
+    for (const Receiver &receiver : receivers) {
+        failed |= receiver.state == ReceiverState::FAILED;
+    }
+    xSemaphoreGive(statusMutex);
+
+    if (err != ESP_OK) return err;
+    if (failed) return ESP_FAIL;
+    return pending > 0 ? ESP_ERR_TIMEOUT : ESP_OK;
+}
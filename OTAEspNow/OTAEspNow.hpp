@@ -0,0 +1,129 @@
+#pragma once
+
+#include "espnow_comm.hpp"
+#include "OTAPartitionSink.hpp"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <functional>
+#include <vector>
+
+// Passes an app image from one gateway, which downloaded it once (e.g. with
+// OTAUpdater), to its EspNowManager peers. The image goes out in numbered
+// blocks, multicast to every receiver still missing part of it. Receivers
+// pass each block to a partition sink as it comes, at its place in the
+// image, and report a bitmap of what they miss. Repair rounds then resend those blocks until every receiver
+// has the whole image, verified against the gateway's SHA-256, set to boot.
+//
+// The manager has one command handler, so the application forwards its
+// messages to handleMessage(), which takes the ones meant for OTA.
+class OTAEspNow {
+public:
+    // Receiver outcome: ESP_OK once the new image is set to boot. Runs on the
+    // writer task, which stop() waits for, so it must not call stop().
+    using CompletionCallback = std::function<void(esp_err_t result)>;
+
+    explicit OTAEspNow(EspNowManager &manager);
+    ~OTAEspNow();
+
+    // Receiver: accepts images from gatewayMac, a peer of the manager
+    esp_err_t listen(const uint8_t *gatewayMac);
+    // Receiver: stops listening. An image being received is abandoned and
+    // reported as ESP_ERR_INVALID_STATE, as is one a new announcement
+    // replaces. Not from the manager's handlers or the completion callback.
+    void stop();
+    void setCompletionCallback(CompletionCallback cb);
+
+    // Gateway: sends the app image in the partition to the receivers, which
+    // must be peers of the manager. Blocks until they all have it (ESP_OK),
+    // one of them failed (ESP_FAIL), or maxRounds repair rounds left some
+    // without it (ESP_ERR_TIMEOUT). Not from the manager's handlers.
+    esp_err_t distribute(const esp_partition_t *image, const uint8_t (*receivers)[ESPNOW_MAC_LEN], size_t count,
+                         int maxRounds = 8);
+
+    // Takes the message if it is an OTA one; call from the command handler
+    bool handleMessage(const uint8_t *mac, const uint8_t *data, size_t len);
+
+private:
+    // Wire format, little-endian: magic, type, image id (the first bytes of
+    // the image's SHA-256), then
+    //   ANNOUNCE        u32 image size, u16 block size, the 32-byte SHA-256
+    //   BLOCK           u16 block index, the block's bytes
+    //   STATUS_REQUEST  nothing
+    //   STATUS          u8 ReceiverState, bitmap of blocks still missing
+    static constexpr uint8_t MAGIC = 0xA7;
+    static constexpr size_t HEADER_LEN = 6;
+    static constexpr size_t ANNOUNCE_LEN = HEADER_LEN + 4 + 2 + 32;
+    static constexpr size_t BLOCK_HEADER_LEN = HEADER_LEN + 2;
+    static constexpr size_t BLOCK_SIZE = 1024;
+    static constexpr int RX_BUFFERS = 4;            // messages waiting for the writer task
+    static constexpr int SINK_BLOCKS = 2;           // blocks waiting for the flash task
+    static constexpr uint32_t STATUS_TIMEOUT_MS = 3000;
+    static_assert(BLOCK_HEADER_LEN + BLOCK_SIZE <= ESPNOW_MAX_MESSAGE_LEN, "a block must fit in one message");
+
+    enum class MessageType : uint8_t { ANNOUNCE = 1, BLOCK = 2, STATUS_REQUEST = 3, STATUS = 4 };
+    enum class ReceiverState : uint8_t { RECEIVING = 0, COMPLETE = 1, FAILED = 2 };
+
+    // A message copied out of the manager's receive task
+    struct RxMessage {
+        uint8_t *data;
+        uint16_t length;
+    };
+
+    // Gateway's view of one receiver
+    struct Receiver {
+        uint8_t mac[ESPNOW_MAC_LEN];
+        ReceiverState state;
+        bool replied;           // STATUS received this round
+        std::vector<uint8_t> missing;
+    };
+
+    static void writerTask(void *arg);
+    void deleteListener();
+    void handleAnnounce(const uint8_t *data);
+    void handleBlock(const uint8_t *data, size_t len);
+    void finishImage();
+    void fail(esp_err_t err);
+    void sendStatus();
+
+    size_t writeHeader(uint8_t *out, MessageType type) const;
+    esp_err_t sendToPending(const uint8_t *data, size_t len);
+    bool waitForStatus();
+
+    static bool testBit(const std::vector<uint8_t> &bits, size_t i) { return bits[i / 8] & (1 << (i % 8)); }
+    static void setBit(std::vector<uint8_t> &bits, size_t i) { bits[i / 8] |= 1 << (i % 8); }
+
+    EspNowManager &manager;
+
+    // Image being passed on, on either side
+    uint32_t imageId = 0;
+    uint32_t imageSize = 0;
+    uint16_t blockSize = BLOCK_SIZE;
+    uint32_t blockCount = 0;
+    uint8_t digest[32];
+
+    // Receiver, owned by the writer task apart from the queues. listening
+    // and the queues are guarded by listenMutex, for stop(); where both
+    // locks are held, listenMutex is taken first.
+    SemaphoreHandle_t listenMutex;
+    uint8_t gatewayMac[ESPNOW_MAC_LEN];
+    bool listening = false;
+    OTAPartitionSink sink;
+    ReceiverState state = ReceiverState::RECEIVING;
+    bool active = false;
+    std::vector<uint8_t> received;
+    uint32_t receivedCount = 0;
+    uint8_t *rxPool = nullptr;
+    QueueHandle_t freeBuffers = nullptr;
+    QueueHandle_t rxMessages = nullptr;
+    TaskHandle_t writerHandle = nullptr;
+    TaskHandle_t stopperHandle = nullptr;   // task waiting in stop()
+    CompletionCallback completeCb;
+
+    // Gateway, guarded by statusMutex
+    SemaphoreHandle_t statusMutex;
+    bool distributing = false;
+    std::vector<Receiver> receivers;
+};
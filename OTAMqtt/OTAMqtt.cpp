@@ -0,0 +1,273 @@
+#include "OTAMqtt.hpp"
+
+#include "esp_log.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef CONFIG_OTA_MQTT_WINDOW
+#define OTA_MQTT_WINDOW CONFIG_OTA_MQTT_WINDOW
+#else
+#define OTA_MQTT_WINDOW 16
+#endif
+
+// How long a read waits for the next chunk before the updater is told the
+// source dropped, to retry or give up as it would over HTTP
+#define OTA_MQTT_READ_TIMEOUT_MS 10000
+
+static const char *TAG = "OTAMqtt";
+
+OTAMqtt::OTAMqtt(MqttClient &mqtt) : client(mqtt), windowSize(OTA_MQTT_WINDOW) {
+    lock = xSemaphoreCreateMutex();
+    chunkArrived = xSemaphoreCreateBinary();
+    updater.setResultCallback([this](OTAUpdater::State result, esp_err_t err) { onResult(result, err); });
+    updater.setProgressCallback([this](const OTAUpdater::Progress &progress) {
+        if (progressCb) progressCb(progress.received, progress.total, progress.percent);
+    });
+}
+
+OTAMqtt::~OTAMqtt() {
+    stop();
+    updater.wait();
+    free(window);
+    vSemaphoreDelete(chunkArrived);
+    vSemaphoreDelete(lock);
+}
+
+void OTAMqtt::setProgressCallback(ProgressCallback cb) {
+    progressCb = cb;
+}
+
+void OTAMqtt::setCompletionCallback(CompletionCallback cb) {
+    completeCb = cb;
+}
+
+esp_err_t OTAMqtt::listen(const String &topicPrefix) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool listening = prefix.length() > 0;
+    if (!listening) prefix = topicPrefix;
+    xSemaphoreGive(lock);
+    if (listening) return ESP_ERR_INVALID_STATE;
+    client.registerCborCallback(topicPrefix + "/begin", [this](const CborValue &root) { handleBegin(root); },
+                                {"id", "size", "chunk", "sha256"});
+    client.registerCborCallback(topicPrefix + "/chunk", [this](const CborValue &root) { handleChunk(root); }, {"id", "i", "d"});
+    return ESP_OK;
+}
+
+void OTAMqtt::stop() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    String topicPrefix = prefix;
+    prefix = "";
+    active = false;
+    xSemaphoreGive(lock);
+    if (topicPrefix.length() == 0) return;
+    client.unregisterCallback(topicPrefix + "/begin");
+    client.unregisterCallback(topicPrefix + "/chunk");
+    updater.cancel();
+    xSemaphoreGive(chunkArrived);
+}
+
+// The sender repeats begin until it is acknowledged; only a new image id
+// starts over, once the update of the last one has ended and reported
+void OTAMqtt::handleBegin(const CborValue &root) {
+    uint32_t id = root.get("id").toInt();
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool known = chunkCount > 0 && id == imageId;
+    if (known) sendAck();
+    xSemaphoreGive(lock);
+    if (known) return;
+
+    OTAUpdater::State current = updater.getState();
+    if (current == OTAUpdater::State::Running || current == OTAUpdater::State::Paused) {
+        ESP_LOGW(TAG, "Image %lu announced, dropping the one in progress", (unsigned long)id);
+        xSemaphoreTake(lock, portMAX_DELAY);
+        active = false;
+        xSemaphoreGive(lock);
+        updater.cancel();
+        xSemaphoreGive(chunkArrived);
+        return;
+    }
+    // An update that has ended may still be reporting its result, which
+    // would land on the new image; the next begin finds it done
+    if (!updater.wait(0)) return;
+
+    size_t digestLength = 0;
+    const uint8_t *sha = root.get("sha256").bytes(digestLength);
+    int64_t size = root.get("size").toInt();
+    int64_t chunk = root.get("chunk").toInt();
+    if (!sha || digestLength != 32 || size <= 0 || chunk <= 0 || (size_t)chunk > MAX_CHUNK) {
+        ESP_LOGE(TAG, "Invalid image announcement");
+        return;
+    }
+    if (!window && !(window = (uint8_t *)malloc(windowSize * MAX_CHUNK))) {
+        ESP_LOGE(TAG, "No memory for a window of %lu chunks", (unsigned long)windowSize);
+        return;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    imageId = id;
+    imageSize = size;
+    chunkSize = chunk;
+    chunkCount = (imageSize + chunkSize - 1) / chunkSize;
+    state = State::RECEIVING;
+    active = true;
+    restartWindow();
+    xSemaphoreGive(lock);
+    xSemaphoreTake(chunkArrived, 0);
+
+    esp_err_t err = updater.init(*this);
+    if (err == ESP_OK) err = updater.setExpectedDigest(sha, imageSize);
+    if (err == ESP_OK) err = updater.start();
+    if (err != ESP_OK) {
+        // A start that fails reports no result, so the sender is told here
+        onResult(OTAUpdater::State::Failed, err);
+        return;
+    }
+    ESP_LOGI(TAG, "Receiving image of %lu bytes in %lu chunks", (unsigned long)imageSize, (unsigned long)chunkCount);
+    xSemaphoreTake(lock, portMAX_DELAY);
+    sendAck();
+    xSemaphoreGive(lock);
+}
+
+// Holds a chunk of the window until the reader gets to it
+void OTAMqtt::handleChunk(const CborValue &root) {
+    size_t length = 0;
+    const uint8_t *data = root.get("d").bytes(length);
+    int64_t index = root.get("i").toInt(-1);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (chunkCount == 0 || (uint32_t)root.get("id").toInt() != imageId || !data) {
+        xSemaphoreGive(lock);
+        return;
+    }
+    if (!active || index < nextMissing || index >= chunkCount || (index < readChunk + windowSize && isHeld(index))) {
+        // Finished, or a resend of what the sender missed an ack for
+        sendAck();
+    } else if (index < readChunk + windowSize) {
+        if (length == std::min<uint32_t>(chunkSize, imageSize - index * chunkSize)) {
+            memcpy(window + (index % windowSize) * MAX_CHUNK, data, length);
+            held |= 1ULL << (index % windowSize);
+            bool readable = index == nextMissing;
+            while (nextMissing < chunkCount && nextMissing < readChunk + windowSize && isHeld(nextMissing)) {
+                nextMissing++;
+            }
+            if (readable) xSemaphoreGive(chunkArrived);
+            ackIfDue(index);
+        } else {
+            ESP_LOGW(TAG, "Chunk %d has %u bytes", (int)index, (unsigned)length);
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+// Caller holds lock. Acks when the sender needs one to go on: half the
+// window taken up in order or freed by the reader, the end of the window
+// reached past a gap, or the last chunk in
+void OTAMqtt::ackIfDue(uint32_t index) {
+    uint32_t half = (windowSize + 1) / 2;
+    if (nextMissing - ackedNext >= half || readChunk + windowSize - ackedLimit >= half ||
+        index + 1 == ackedLimit || nextMissing == chunkCount) {
+        sendAck();
+    }
+}
+
+// Caller holds lock. Nothing received, the sender to start from chunk 0.
+void OTAMqtt::restartWindow() {
+    held = 0;
+    readChunk = 0;
+    readOffset = 0;
+    nextMissing = 0;
+    ackedNext = 0;
+    ackedLimit = 0;
+}
+
+esp_err_t OTAMqtt::open(uint32_t offset, uint32_t *start) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (!active) {
+        xSemaphoreGive(lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (offset != readChunk * chunkSize + readOffset) {
+        restartWindow();
+        sendAck();
+    }
+    *start = readChunk * chunkSize + readOffset;
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+// Waits up to OTA_MQTT_READ_TIMEOUT_MS for the next chunk in order; fails
+// once stopped, so a cancel does not wait for it
+int OTAMqtt::read(uint8_t *buffer, size_t length) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    while (active && readChunk == nextMissing && readChunk < chunkCount) {
+        xSemaphoreGive(lock);
+        if (xSemaphoreTake(chunkArrived, pdMS_TO_TICKS(OTA_MQTT_READ_TIMEOUT_MS)) != pdTRUE) {
+            ESP_LOGW(TAG, "No chunk %lu from the sender", (unsigned long)readChunk);
+            return -1;
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+    }
+    if (!active) {
+        xSemaphoreGive(lock);
+        return -1;
+    }
+
+    size_t total = 0;
+    while (total < length && readChunk < nextMissing) {
+        uint32_t chunkLength = std::min<uint32_t>(chunkSize, imageSize - readChunk * chunkSize);
+        size_t n = std::min<size_t>(length - total, chunkLength - readOffset);
+        memcpy(buffer + total, window + (readChunk % windowSize) * MAX_CHUNK + readOffset, n);
+        total += n;
+        readOffset += n;
+        if (readOffset == chunkLength) {
+            // Its slot is free for the chunk a window further on
+            held &= ~(1ULL << (readChunk % windowSize));
+            readChunk++;
+            readOffset = 0;
+        }
+    }
+    if (readChunk + windowSize - ackedLimit >= (windowSize + 1) / 2) sendAck();
+    xSemaphoreGive(lock);
+    return total;
+}
+
+bool OTAMqtt::complete() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool done = chunkCount > 0 && readChunk == chunkCount;
+    xSemaphoreGive(lock);
+    return done;
+}
+
+// From the updater's task: tells the sender how the image ended
+void OTAMqtt::onResult(OTAUpdater::State result, esp_err_t err) {
+    if (result == OTAUpdater::State::Cancelled) err = ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    active = false;
+    state = result == OTAUpdater::State::Succeeded ? State::COMPLETE : State::FAILED;
+    sendAck();
+    xSemaphoreGive(lock);
+    if (result == OTAUpdater::State::Succeeded) ESP_LOGI(TAG, "Image received. Ready for restart.");
+    if (completeCb) completeCb(err);
+}
+
+// Caller holds lock
+void OTAMqtt::sendAck() {
+    if (prefix.length() == 0) return;
+    uint32_t limit = std::min(readChunk + windowSize, chunkCount);
+    uint8_t sack[(OTA_MQTT_WINDOW + 7) / 8] = {};
+    for (uint32_t i = nextMissing; i < limit; ++i) {
+        if (isHeld(i)) sack[(i - nextMissing) / 8] |= 1 << ((i - nextMissing) % 8);
+    }
+
+    uint8_t buffer[64];
+    CborWriter writer(buffer, sizeof(buffer));
+    writer.beginMap(5);
+    writer.writeText("id").writeUInt(imageId);
+    writer.writeText("next").writeUInt(nextMissing);
+    writer.writeText("window").writeUInt(limit - nextMissing);
+    writer.writeText("sack").writeBytes(sack, sizeof(sack));
+    writer.writeText("state").writeUInt((uint8_t)state);
+    if (client.publishCbor(prefix + "/ack", writer) < 0) ESP_LOGW(TAG, "Ack not sent");
+    ackedNext = nextMissing;
+    ackedLimit = readChunk + windowSize;
+}
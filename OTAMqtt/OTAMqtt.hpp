@@ -0,0 +1,97 @@
+#pragma once
+
+#include "mqttNew.hpp"
+#include "OTAPipeline.hpp"
+#include "OTAUpdater.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <functional>
+
+// Receives an app image published in chunks over MQTT, for sites that only
+// allow outbound MQTT. Under the topic prefix given to listen():
+//   <prefix>/begin  from the sender: CBOR map {"id": image id, "size": image
+//                   bytes, "chunk": chunk bytes, "sha256": the 32-byte
+//                   SHA-256 of the image file as sent, checked as it streams}
+//   <prefix>/chunk  from the sender: {"id", "i": chunk index, "d": its bytes}
+//   <prefix>/ack    from the device: {"id", "next": first chunk missing,
+//                   "window": chunks the sender may send from next on,
+//                   "sack": bitmap of the ones of those already received,
+//                   "state": 0 receiving, 1 done, 2 failed}
+// The sender keeps at most the window in flight and resends what the bitmap
+// misses, or everything unacknowledged when no ack comes for a while. Chunks
+// may come in any order and more than once. A "next" that goes back to 0
+// asks for the image again from the start.
+//
+// The chunks are the OTASource of an OTAUpdater of its own: held in a window
+// of OTA_MQTT_WINDOW chunks until the ones before them are in, then
+// read in order into the partition sink, and verified as they stream.
+//
+// MqttClient passes each message up in one piece, so a chunk message must
+// fit the MQTT client's receive buffer (1 KB by default).
+class OTAMqtt : public OTASource {
+public:
+    using ProgressCallback = std::function<void(int progress, int total, int percent)>;
+    // ESP_OK once the new image is set to boot
+    using CompletionCallback = std::function<void(esp_err_t result)>;
+
+    explicit OTAMqtt(MqttClient &mqtt);
+    // Stops listening and waits for an update in progress to end
+    ~OTAMqtt() override;
+
+    esp_err_t listen(const String &topicPrefix);
+    // Stops listening; an update in progress is cancelled
+    void stop();
+    void setProgressCallback(ProgressCallback cb);
+    void setCompletionCallback(CompletionCallback cb);
+
+    // OTASource, for the updater. The chunks cannot be skipped to: open()
+    // goes on where the last read stopped, or asks for the image again.
+    esp_err_t open(uint32_t offset, uint32_t *start) override;
+    int read(uint8_t *buffer, size_t length) override;
+    bool complete() override;
+    void close() override {}
+    int size() const override { return imageSize; }
+    // Nothing tells a changed image by after a reboot, so it never resumes
+    const char *name() const override { return "mqtt"; }
+    const char *tag() const override { return ""; }
+
+private:
+    static constexpr size_t MAX_CHUNK = 768;
+
+    enum class State : uint8_t { RECEIVING = 0, COMPLETE = 1, FAILED = 2 };
+
+    void handleBegin(const CborValue &root);
+    void handleChunk(const CborValue &root);
+    void onResult(OTAUpdater::State result, esp_err_t err);
+    void restartWindow();
+    void ackIfDue(uint32_t index);
+    void sendAck();
+
+    bool isHeld(uint32_t i) const { return held & (1ULL << (i % windowSize)); }
+
+    MqttClient &client;
+    ProgressCallback progressCb;
+    CompletionCallback completeCb;
+
+    // Image being received. The MQTT task adds chunks, the updater's task
+    // reads them; both under lock.
+    SemaphoreHandle_t lock;
+    String prefix;                      // empty when not listening
+    SemaphoreHandle_t chunkArrived;     // given when the reader may go on
+    uint32_t imageId = 0;
+    uint32_t imageSize = 0;
+    uint32_t chunkSize = 0;
+    uint32_t chunkCount = 0;
+    State state = State::RECEIVING;
+    bool active = false;
+    const uint32_t windowSize;
+    uint8_t *window = nullptr;          // windowSize chunks, by index % windowSize
+    uint64_t held = 0;                  // bit per window slot holding a chunk
+    uint32_t readChunk = 0;             // chunk being read, the oldest held
+    uint32_t readOffset = 0;            // within it
+    uint32_t nextMissing = 0;
+    uint32_t ackedNext = 0;             // nextMissing and the window's end in the last ack
+    uint32_t ackedLimit = 0;
+
+    OTAUpdater updater;
+};
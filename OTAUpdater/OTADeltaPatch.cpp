@@ -0,0 +1,126 @@
+#include "OTADeltaPatch.hpp"
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include <algorithm>
+#include <cstring>
+
+static const char *TAG = "OTADeltaPatch";
+
+static const char PATCH_MAGIC[8] = {'O', 'T', 'A', 'D', 'I', 'F', 'F', '1'};
+
+static uint32_t readU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+esp_err_t OTADeltaPatch::begin(const esp_partition_t *basePartition) {
+    esp_app_desc_t desc;
+    esp_err_t err = esp_ota_get_partition_description(basePartition, &desc);
+    if (err != ESP_OK) return err;
+
+    base = basePartition;
+    memcpy(baseSha, desc.app_elf_sha256, sizeof(baseSha));
+    state = State::Header;
+    fieldLength = 0;
+    newSize = 0;
+    produced = 0;
+    oldPos = 0;
+    return ESP_OK;
+}
+
+esp_err_t OTADeltaPatch::parseHeader() {
+    if (memcmp(field, PATCH_MAGIC, sizeof(PATCH_MAGIC)) != 0) {
+        ESP_LOGE(TAG, "Not a delta patch");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (memcmp(field + 12, baseSha, sizeof(baseSha)) != 0) {
+        ESP_LOGE(TAG, "Patch is for a different base image");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    newSize = readU32(field + 8);
+    state = newSize > 0 ? State::Record : State::Done;
+    return ESP_OK;
+}
+
+esp_err_t OTADeltaPatch::parseRecord() {
+    diffLeft = readU32(field);
+    extraLeft = readU32(field + 4);
+    seek = (int32_t)readU32(field + 8);
+    if (diffLeft + (uint64_t)extraLeft > newSize - produced || oldPos + (uint64_t)diffLeft > base->size) {
+        ESP_LOGE(TAG, "Patch record out of range at %lu", (unsigned long)produced);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    state = diffLeft > 0 ? State::Diff : State::Extra;
+    return ESP_OK;
+}
+
+// Adds the diff bytes to the old image, OLD_CHUNK at a time
+esp_err_t OTADeltaPatch::applyDiff(const uint8_t *data, size_t length, const Output &out) {
+    while (length > 0) {
+        size_t n = std::min(length, OLD_CHUNK);
+        esp_err_t err = esp_partition_read(base, oldPos, oldData, n);
+        if (err != ESP_OK) return err;
+        for (size_t i = 0; i < n; ++i) {
+            oldData[i] += data[i];
+        }
+        if (!out(oldData, n)) return ESP_FAIL;
+        oldPos += n;
+        data += n;
+        length -= n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t OTADeltaPatch::apply(const uint8_t *data, size_t length, const Output &out) {
+    esp_err_t err = ESP_OK;
+    while (length > 0 && err == ESP_OK) {
+        switch (state) {
+        case State::Header:
+        case State::Record: {
+            size_t want = (state == State::Header ? HEADER_LEN : RECORD_LEN) - fieldLength;
+            size_t n = std::min(length, want);
+            memcpy(field + fieldLength, data, n);
+            fieldLength += n;
+            data += n;
+            length -= n;
+            if (n == want) {
+                fieldLength = 0;
+                err = state == State::Header ? parseHeader() : parseRecord();
+            }
+            break;
+        }
+        case State::Diff: {
+            size_t n = std::min<size_t>(length, diffLeft);
+            err = applyDiff(data, n, out);
+            diffLeft -= n;
+            produced += n;
+            data += n;
+            length -= n;
+            if (diffLeft == 0) state = State::Extra;
+            break;
+        }
+        case State::Extra: {
+            size_t n = std::min<size_t>(length, extraLeft);
+            if (n > 0 && !out(data, n)) err = ESP_FAIL;
+            extraLeft -= n;
+            produced += n;
+            data += n;
+            length -= n;
+            break;
+        }
+        case State::Done:
+            ESP_LOGE(TAG, "Data after the end of the patch");
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        if (err == ESP_OK && state == State::Extra && extraLeft == 0) {
+            if ((int64_t)oldPos + seek < 0 || (int64_t)oldPos + seek > base->size) {
+                ESP_LOGE(TAG, "Patch seeks outside the base image");
+                return ESP_ERR_INVALID_SIZE;
+            }
+            oldPos += seek;
+            state = produced == newSize ? State::Done : State::Record;
+        }
+    }
+    return err;
+}
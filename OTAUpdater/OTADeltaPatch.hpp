@@ -0,0 +1,58 @@
+#pragma once
+
+#include "OTAPipeline.hpp"
+#include "esp_partition.h"
+
+// Rebuilds a new image from the running one and a patch streamed in pieces of
+// any size, so a release that changes little downloads little. RAM use is
+// fixed: the old image is read from flash OLD_CHUNK bytes at a time.
+//
+// Patch format, little-endian, the bsdiff control/diff/extra streams
+// interleaved so they can be applied in one pass:
+//
+//   header  "OTADIFF1", uint32 new image size,
+//           the 32-byte app_elf_sha256 of the image it applies to
+//   records uint32 diffLen, uint32 extraLen, int32 seek,
+//           diffLen bytes each added to the next old byte,
+//           extraLen bytes copied as they are,
+//           then the old position moves by seek
+//
+// A patch ends when the new image size has been produced. Patches compress
+// well (the diff bytes are mostly zero); serve them gzipped with
+// Compression::Gzip.
+//
+// tools/otadiff.py makes them on the host, from the .bin the devices run
+// and the new one, and checks each rebuilds the new image before writing it:
+//   python tools/otadiff.py --gzip 15 old/app.bin new/app.bin app.patch.gz
+class OTADeltaPatch : public OTATransform {
+public:
+    // Fails if the base partition holds no readable app
+    esp_err_t begin(const esp_partition_t *base);
+    // ESP_ERR_INVALID_VERSION if the patch is for another base image
+    esp_err_t apply(const uint8_t *data, size_t length, const Output &out) override;
+    bool done() const override { return state == State::Done; }
+
+private:
+    static constexpr size_t OLD_CHUNK = 512;
+    static constexpr size_t HEADER_LEN = 8 + 4 + 32;
+    static constexpr size_t RECORD_LEN = 12;
+
+    enum class State { Header, Record, Diff, Extra, Done };
+
+    esp_err_t parseHeader();
+    esp_err_t parseRecord();
+    esp_err_t applyDiff(const uint8_t *data, size_t length, const Output &out);
+
+    const esp_partition_t *base = nullptr;
+    uint8_t baseSha[32];
+    State state = State::Header;
+    uint8_t field[HEADER_LEN];      // header or record being collected
+    size_t fieldLength = 0;
+    uint32_t newSize = 0;
+    uint32_t produced = 0;
+    uint32_t oldPos = 0;
+    uint32_t diffLeft = 0;
+    uint32_t extraLeft = 0;
+    int32_t seek = 0;
+    uint8_t oldData[OLD_CHUNK];
+};
@@ -0,0 +1,91 @@
+#include "OTAHttpSource.hpp"
+
+#include "esp_log.h"
+#include "esp_crt_bundle.h"
+#include <cstdio>
+#include <cstring>
+
+static const char *TAG = "OTAHttpSource";
+
+OTAHttpSource::OTAHttpSource(const String &url) : url(url) {}
+
+void OTAHttpSource::setUrl(const String &newUrl) {
+    url = newUrl;
+    imageTag[0] = '\0';
+}
+
+void OTAHttpSource::setTag(const char *tag) {
+    strlcpy(imageTag, tag, sizeof(imageTag));
+}
+
+// Captures the validator a range request must match
+esp_err_t OTAHttpSource::httpEvent(esp_http_client_event_t *evt) {
+    OTAHttpSource *self = static_cast<OTAHttpSource *>(evt->user_data);
+    if (evt->event_id == HTTP_EVENT_ON_HEADER &&
+        (strcasecmp(evt->header_key, "ETag") == 0 ||
+         (strcasecmp(evt->header_key, "Last-Modified") == 0 && self->responseTag[0] == '\0'))) {
+        strlcpy(self->responseTag, evt->header_value, sizeof(self->responseTag));
+    }
+    return ESP_OK;
+}
+
+esp_err_t OTAHttpSource::open(uint32_t offset, uint32_t *start) {
+    close();
+    esp_http_client_config_t config = {
+        .url = url.c_str(),
+        .timeout_ms = 5000,
+        .event_handler = httpEvent,
+        .buffer_size = 4096,
+        .user_data = this,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .keep_alive_enable = true,
+    };
+
+    client = esp_http_client_init(&config);
+    if (!client) return ESP_ERR_NO_MEM;
+    if (offset > 0) {
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%lu-", (unsigned long)offset);
+        esp_http_client_set_header(client, "Range", range);
+        if (imageTag[0] != '\0') esp_http_client_set_header(client, "If-Range", imageTag);
+    }
+
+    responseTag[0] = '\0';
+    if (esp_http_client_open(client, 0) != ESP_OK || esp_http_client_fetch_headers(client) < 0) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        close();
+        return ESP_FAIL;
+    }
+
+    int status = esp_http_client_get_status_code(client);
+    int64_t length = esp_http_client_get_content_length(client);
+    if (status == HttpStatus_Ok) {
+        // From the start: a new download, or a resume the server refused
+        if (offset > 0) ESP_LOGW(TAG, "Image changed or range not supported, restarting download");
+        strlcpy(imageTag, responseTag, sizeof(imageTag));
+        contentSize = length;
+        *start = 0;
+    } else if (status == HTTP_PARTIAL_CONTENT && offset > 0) {
+        contentSize = length >= 0 ? offset + length : -1;
+        *start = offset;
+    } else {
+        ESP_LOGE(TAG, "Unexpected HTTP status %d", status);
+        close();
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return ESP_OK;
+}
+
+int OTAHttpSource::read(uint8_t *buffer, size_t length) {
+    if (!client) return -1;
+    return esp_http_client_read(client, (char *)buffer, length);
+}
+
+bool OTAHttpSource::complete() {
+    return client && esp_http_client_is_complete_data_received(client);
+}
+
+void OTAHttpSource::close() {
+    if (client) esp_http_client_cleanup(client);
+    client = nullptr;
+}
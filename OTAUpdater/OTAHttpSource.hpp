@@ -0,0 +1,39 @@
+#pragma once
+
+#include "OTAPipeline.hpp"
+#include "WString.h"
+#include "esp_http_client.h"
+
+// Downloads the image over HTTP(S). Opening at an offset sends a Range
+// request conditional on the image's ETag (or Last-Modified): the server
+// answers with the rest of the same image, or all of a changed one.
+class OTAHttpSource : public OTASource {
+public:
+    explicit OTAHttpSource(const String &url = "");
+    ~OTAHttpSource() override { close(); }
+
+    void setUrl(const String &url);
+
+    esp_err_t open(uint32_t offset, uint32_t *start) override;
+    int read(uint8_t *buffer, size_t length) override;
+    bool complete() override;
+    void close() override;
+
+    int size() const override { return contentSize; }
+    const char *name() const override { return url.c_str(); }
+    const char *tag() const override { return imageTag; }
+    void setTag(const char *tag) override;
+
+private:
+    // ETag or Last-Modified of the image
+    static constexpr size_t TAG_LEN = 64;
+    static constexpr int HTTP_PARTIAL_CONTENT = 206;
+
+    static esp_err_t httpEvent(esp_http_client_event_t *evt);
+
+    String url;
+    esp_http_client_handle_t client = nullptr;
+    int contentSize = -1;
+    char imageTag[TAG_LEN] = "";
+    char responseTag[TAG_LEN] = "";
+};
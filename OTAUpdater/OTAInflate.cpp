@@ -0,0 +1,157 @@
+#include "OTAInflate.hpp"
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "rom/miniz.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static const char *TAG = "OTAInflate";
+
+static uint32_t readU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+esp_err_t OTAInflate::begin(int windowBits) {
+    end();
+    windowSize = (size_t)1 << windowBits;
+    decompressor = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+    window = (uint8_t *)malloc(windowSize);
+    if (!decompressor || !window) {
+        end();
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(decompressor);
+    windowPos = 0;
+    state = State::Header;
+    fieldLength = 0;
+    crc = 0;
+    size = 0;
+    return ESP_OK;
+}
+
+void OTAInflate::end() {
+    free(decompressor);
+    free(window);
+    decompressor = nullptr;
+    window = nullptr;
+}
+
+esp_err_t OTAInflate::parseHeader() {
+    if (field[0] != 0x1f || field[1] != 0x8b || field[2] != 8) {
+        ESP_LOGE(TAG, "Not a gzip stream");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    flags = field[3];
+    state = State::ExtraLength;
+    nextHeaderField();
+    return ESP_OK;
+}
+
+// Moves past optional header fields the stream does not have
+void OTAInflate::nextHeaderField() {
+    if (state == State::ExtraLength && !(flags & FEXTRA)) state = State::Name;
+    if (state == State::Name && !(flags & FNAME)) state = State::Comment;
+    if (state == State::Comment && !(flags & FCOMMENT)) state = State::HeaderCrc;
+    if (state == State::HeaderCrc) {
+        if (flags & FHCRC) {
+            skip = 2;
+        } else {
+            state = State::Deflate;
+        }
+    }
+}
+
+// Inflates into the window, which wraps: tinfl only looks back as far as
+// the stream's window, and each run of output is passed on as it is made
+esp_err_t OTAInflate::inflate(const uint8_t *&data, size_t &length, const Output &out) {
+    while (true) {
+        size_t inLength = length;
+        size_t outLength = windowSize - windowPos;
+        tinfl_status status = tinfl_decompress(decompressor, data, &inLength, window, window + windowPos, &outLength,
+                                               TINFL_FLAG_HAS_MORE_INPUT);
+        data += inLength;
+        length -= inLength;
+        if (outLength > 0) {
+            crc = esp_rom_crc32_le(crc, window + windowPos, outLength);
+            size += outLength;
+            if (!out(window + windowPos, outLength)) return ESP_FAIL;
+            windowPos = (windowPos + outLength) & (windowSize - 1);
+        }
+
+        if (status == TINFL_STATUS_DONE) {
+            state = State::Trailer;
+            return ESP_OK;
+        }
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Corrupt compressed data at %lu", (unsigned long)size);
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && length == 0) return ESP_OK;
+    }
+}
+
+esp_err_t OTAInflate::apply(const uint8_t *data, size_t length, const Output &out) {
+    esp_err_t err = ESP_OK;
+    while (length > 0 && err == ESP_OK) {
+        switch (state) {
+        case State::Header:
+        case State::Trailer:
+        case State::ExtraLength: {
+            size_t want = (state == State::Header ? 10 : state == State::Trailer ? 8 : 2) - fieldLength;
+            size_t n = std::min(length, want);
+            memcpy(field + fieldLength, data, n);
+            fieldLength += n;
+            data += n;
+            length -= n;
+            if (n < want) break;
+
+            fieldLength = 0;
+            if (state == State::Header) {
+                err = parseHeader();
+            } else if (state == State::ExtraLength) {
+                skip = field[0] | (field[1] << 8);
+                state = State::Extra;
+            } else if (readU32(field) != crc || readU32(field + 4) != size) {
+                ESP_LOGE(TAG, "Decompressed image fails its CRC or length check");
+                err = ESP_ERR_INVALID_CRC;
+            } else {
+                state = State::Done;
+            }
+            break;
+        }
+        case State::Extra:
+        case State::HeaderCrc: {
+            size_t n = std::min<size_t>(length, skip);
+            skip -= n;
+            data += n;
+            length -= n;
+            if (skip == 0) {
+                state = state == State::Extra ? State::Name : State::Deflate;
+                nextHeaderField();
+            }
+            break;
+        }
+        case State::Name:
+        case State::Comment: {
+            const uint8_t *zero = (const uint8_t *)memchr(data, 0, length);
+            size_t n = zero ? zero - data + 1 : length;
+            data += n;
+            length -= n;
+            if (zero) {
+                state = state == State::Name ? State::Comment : State::HeaderCrc;
+                nextHeaderField();
+            }
+            break;
+        }
+        case State::Deflate:
+            err = inflate(data, length, out);
+            break;
+        case State::Done:
+            ESP_LOGE(TAG, "Data after the end of the compressed image");
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return err;
+}
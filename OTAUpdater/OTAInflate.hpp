@@ -0,0 +1,46 @@
+#pragma once
+
+#include "OTAPipeline.hpp"
+
+struct tinfl_decompressor_tag;
+
+// Decompresses a gzip stream fed in pieces of any size, with the inflater
+// in ROM. Memory is fixed while begin() to end(): the inflater's state
+// (about 11 KB) and a 2^windowBits byte window, which must be at least the
+// window the image was compressed with: 32 KB for gzip(1), smaller with
+// e.g. zlib.compressobj(wbits=16 + 12) for a 4 KB window. The CRC-32 and
+// length in the gzip trailer are checked.
+class OTAInflate : public OTATransform {
+public:
+    ~OTAInflate() override { end(); }
+
+    esp_err_t begin(int windowBits);
+    void end();
+    esp_err_t apply(const uint8_t *data, size_t length, const Output &out) override;
+    bool done() const override { return state == State::Done; }
+
+private:
+    // Gzip flag bits
+    static constexpr uint8_t FHCRC = 0x02;
+    static constexpr uint8_t FEXTRA = 0x04;
+    static constexpr uint8_t FNAME = 0x08;
+    static constexpr uint8_t FCOMMENT = 0x10;
+
+    enum class State { Header, ExtraLength, Extra, Name, Comment, HeaderCrc, Deflate, Trailer, Done };
+
+    esp_err_t parseHeader();
+    void nextHeaderField();
+    esp_err_t inflate(const uint8_t *&data, size_t &length, const Output &out);
+
+    tinfl_decompressor_tag *decompressor = nullptr;
+    uint8_t *window = nullptr;
+    size_t windowSize = 0;
+    size_t windowPos = 0;
+    State state = State::Header;
+    uint8_t flags = 0;
+    uint8_t field[10];              // fixed header or trailer being collected
+    size_t fieldLength = 0;
+    uint32_t skip = 0;
+    uint32_t crc = 0;
+    uint32_t size = 0;
+};
@@ -0,0 +1,165 @@
+#include "OTAPartitionSink.hpp"
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "nvs.h"
+#include "spi_flash_mmu.h"
+#include <algorithm>
+#include <vector>
+
+static const char *TAG = "OTAPartitionSink";
+
+OTAPartitionSink::OTAPartitionSink(size_t blockSize, int blockCount) : size(blockSize), count(blockCount) {}
+
+void OTAPartitionSink::setPartition(const esp_partition_t *updatePartition) {
+    partition = updatePartition;
+}
+
+void OTAPartitionSink::setWrittenCallback(WrittenCallback cb) {
+    writtenCb = cb;
+}
+
+esp_err_t OTAPartitionSink::begin(uint32_t offset) {
+    if (flashTaskHandle) return ESP_ERR_INVALID_STATE;
+    if (!partition) partition = esp_ota_get_next_update_partition(NULL);
+    if (!partition) return ESP_ERR_NOT_FOUND;
+    if (offset == 0) forgetResumeState();
+
+    blockPool = (uint8_t *)malloc(count * size);
+    freeBlocks = xQueueCreate(count, sizeof(uint8_t *));
+    filledBlocks = xQueueCreate(count + 1, sizeof(Block));
+    if (!blockPool || !freeBlocks || !filledBlocks) {
+        ESP_LOGE(TAG, "No memory for %d OTA blocks of %u bytes", count, (unsigned)size);
+        deletePipeline();
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < count; ++i) {
+        uint8_t *block = blockPool + i * size;
+        xQueueSend(freeBlocks, &block, 0);
+    }
+
+    flashError = ESP_OK;
+    writeOffset = offset;
+    submitOffset = offset;
+    if (xTaskCreate(flashTask, "ota_flash_task", 4096, this, 5, &flashTaskHandle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start flash task");
+        flashTaskHandle = nullptr;
+        deletePipeline();
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Whatever writes the partition next, an OTAUpdater resuming the image it
+// left there would build on bytes that are no longer its own
+void OTAPartitionSink::forgetResumeState() {
+    nvs_handle_t nvs;
+    if (nvs_open(OTA_RESUME_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) return;
+    uint32_t address;
+    if (nvs_get_u32(nvs, "partition", &address) == ESP_OK && address == partition->address &&
+        nvs_erase_key(nvs, "offset") == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+void OTAPartitionSink::deletePipeline() {
+    if (freeBlocks) vQueueDelete(freeBlocks);
+    if (filledBlocks) vQueueDelete(filledBlocks);
+    free(blockPool);
+    freeBlocks = nullptr;
+    filledBlocks = nullptr;
+    blockPool = nullptr;
+}
+
+uint8_t *OTAPartitionSink::acquire() {
+    uint8_t *block = nullptr;
+    xQueueReceive(freeBlocks, &block, portMAX_DELAY);
+    return block;
+}
+
+esp_err_t OTAPartitionSink::submit(uint8_t *data, size_t length) {
+    esp_err_t err = submitAt(data, length, submitOffset);
+    submitOffset += length;
+    return err;
+}
+
+esp_err_t OTAPartitionSink::submitAt(uint8_t *data, size_t length, uint32_t offset) {
+    Block block = {data, (int)length, offset};
+    xQueueSend(filledBlocks, &block, portMAX_DELAY);
+    return flashError;
+}
+
+esp_err_t OTAPartitionSink::read(uint32_t offset, uint8_t *buffer, size_t length) {
+    return esp_partition_read(partition, offset, buffer, length);
+}
+
+// Ends the image (or abandons it) and waits for the flash task's verdict
+esp_err_t OTAPartitionSink::end(bool complete) {
+    if (!flashTaskHandle) return ESP_ERR_INVALID_STATE;
+
+    Block end = {nullptr, complete ? 0 : -1, 0};
+    ownerHandle = xTaskGetCurrentTaskHandle();
+    xQueueSend(filledBlocks, &end, portMAX_DELAY);
+    uint32_t result;
+    xTaskNotifyWait(0, UINT32_MAX, &result, portMAX_DELAY);
+    flashTaskHandle = nullptr;
+    deletePipeline();
+    return (esp_err_t)result;
+}
+
+// Validates the whole image before making it bootable
+esp_err_t OTAPartitionSink::commit() {
+    return esp_ota_set_boot_partition(partition);
+}
+
+// The image starts at the offset begin() was given; a sector it stopped in
+// on an earlier attempt is erased already. Other sectors are erased, in runs,
+// the first time a block reaches into them. The callback hears of each block
+// once it is in flash.
+void OTAPartitionSink::flashTask(void *arg) {
+    OTAPartitionSink *self = static_cast<OTAPartitionSink *>(arg);
+    bool complete = false;
+    esp_err_t err = ESP_OK;
+    std::vector<bool> erased(self->partition->size / SPI_FLASH_SEC_SIZE);
+    std::fill_n(erased.begin(), std::min<size_t>(erased.size(), (self->writeOffset + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE),
+                true);
+    Block block;
+
+    while (xQueueReceive(self->filledBlocks, &block, portMAX_DELAY) == pdTRUE) {
+        if (block.length <= 0) {
+            complete = block.length == 0;
+            break;
+        }
+        if (err == ESP_OK) {
+            uint32_t offset = block.offset;
+            uint32_t end = offset + block.length;
+            if (end > self->partition->size) err = ESP_ERR_INVALID_SIZE;
+            uint32_t sector = offset / SPI_FLASH_SEC_SIZE;
+            uint32_t lastSector = (end - 1) / SPI_FLASH_SEC_SIZE;
+            while (err == ESP_OK && sector <= lastSector) {
+                uint32_t run = sector;
+                while (run <= lastSector && !erased[run]) erased[run++] = true;
+                if (run > sector) {
+                    err = esp_partition_erase_range(self->partition, sector * SPI_FLASH_SEC_SIZE,
+                                                    (run - sector) * SPI_FLASH_SEC_SIZE);
+                }
+                sector = run + 1;
+            }
+            if (err == ESP_OK) err = esp_partition_write(self->partition, offset, block.data, block.length);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Flash write failed at %lu: %s", (unsigned long)offset, esp_err_to_name(err));
+                // The updater stops at its next submit
+                self->flashError = err;
+            } else {
+                if (end > self->writeOffset) self->writeOffset = end;
+                if (self->writtenCb) self->writtenCb(self->writeOffset);
+            }
+        }
+        xQueueSend(self->freeBlocks, &block.data, portMAX_DELAY);
+    }
+
+    if (err == ESP_OK && !complete) err = ESP_ERR_INVALID_STATE;
+    xTaskNotify(self->ownerHandle, (uint32_t)err, eSetValueWithOverwrite);
+    vTaskDelete(NULL);
+}
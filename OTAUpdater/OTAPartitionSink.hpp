@@ -0,0 +1,70 @@
+#pragma once
+
+#include "OTAPipeline.hpp"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+// NVS namespace of OTAUpdater's resume state, which names the partition its
+// partial image is in under "partition" and how much of it is in flash under
+// "offset"
+#define OTA_RESUME_NAMESPACE "ota_resume"
+
+// Writes the image to an app partition from a task of its own, so flash
+// erase and write overlap whatever fills the next block. Blocks rotate
+// through a pool of blockCount; each sector is erased just before the first
+// write into it.
+class OTAPartitionSink : public OTASink {
+public:
+    // Called from the flash task with the image bytes in flash after each block
+    using WrittenCallback = std::function<void(uint32_t written)>;
+
+    OTAPartitionSink(size_t blockSize, int blockCount);
+    ~OTAPartitionSink() override { end(false); }
+
+    // Defaults to the next update partition, chosen by begin()
+    void setPartition(const esp_partition_t *partition);
+    const esp_partition_t *getPartition() const { return partition; }
+    void setWrittenCallback(WrittenCallback cb);
+
+    // From offset 0 the partition's image is replaced, so any resume state
+    // saved for it is dropped first
+    esp_err_t begin(uint32_t offset) override;
+    size_t blockSize() const override { return size; }
+    uint8_t *acquire() override;
+    esp_err_t submit(uint8_t *block, size_t length) override;
+    // Stores the block at offset instead of after the last one, for images
+    // that arrive out of order; written() is then the furthest end stored
+    esp_err_t submitAt(uint8_t *block, size_t length, uint32_t offset);
+    esp_err_t read(uint32_t offset, uint8_t *buffer, size_t length) override;
+    esp_err_t end(bool complete) override;
+    esp_err_t commit() override;
+    uint32_t written() const override { return writeOffset; }
+
+private:
+    // A filled block; length 0 ends the image, -1 abandons it
+    struct Block {
+        uint8_t *data;
+        int length;
+        uint32_t offset;
+    };
+
+    static void flashTask(void *arg);
+    void forgetResumeState();
+    void deletePipeline();
+
+    const size_t size;
+    const int count;
+    const esp_partition_t *partition = nullptr;
+    WrittenCallback writtenCb;
+
+    uint8_t *blockPool = nullptr;
+    QueueHandle_t freeBlocks = nullptr;
+    QueueHandle_t filledBlocks = nullptr;
+    TaskHandle_t flashTaskHandle = nullptr;
+    TaskHandle_t ownerHandle = nullptr;     // task waiting in end()
+    volatile esp_err_t flashError = ESP_OK;
+    uint32_t submitOffset = 0;              // where submit() puts the next block
+    volatile uint32_t writeOffset = 0;      // end of the furthest block in flash
+};
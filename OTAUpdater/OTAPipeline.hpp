@@ -0,0 +1,75 @@
+#pragma once
+
+#include "esp_err.h"
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// The stages an OTAUpdater streams an image through: a source it pulls the
+// bytes from, transforms that decode them in order, and a sink that stores
+// the image. Each stage sees the data once, as it arrives, so an update
+// takes fixed memory whatever the image size.
+
+// Where the image comes from, read in order. Opening at an offset lets a
+// dropped or paused transfer go on where it stopped.
+class OTASource {
+public:
+    virtual ~OTASource() = default;
+
+    // Starts reading at offset, or from 0 if the source cannot skip there or
+    // its data changed; *start tells which. Fails if it is unreachable.
+    virtual esp_err_t open(uint32_t offset, uint32_t *start) = 0;
+    // Bytes read, 0 once no more are coming, negative if the read failed
+    virtual int read(uint8_t *buffer, size_t length) = 0;
+    // True once everything has been read
+    virtual bool complete() = 0;
+    virtual void close() = 0;
+
+    // Total bytes, or -1 if unknown; valid once open
+    virtual int size() const = 0;
+    // What identifies the data across reboots, to resume it: where it is,
+    // and a tag that changes with it ("" if the source has none)
+    virtual const char *name() const = 0;
+    virtual const char *tag() const = 0;
+    // Tag of the data an earlier run began, which open() at an offset must
+    // still find; sources without tags never resume and ignore it
+    virtual void setTag(const char *tag) {}
+};
+
+// Decodes a stream fed in pieces of any size
+class OTATransform {
+public:
+    // Takes decoded bytes in order; returns false to stop
+    using Output = std::function<bool(const uint8_t *data, size_t length)>;
+
+    virtual ~OTATransform() = default;
+
+    virtual esp_err_t apply(const uint8_t *data, size_t length, const Output &out) = 0;
+    // True once the whole stream has been decoded
+    virtual bool done() const = 0;
+};
+
+// Where the image goes, in blocks of blockSize() bytes: the updater fills a
+// block it took with acquire() and hands it back with submit(), to be
+// stored while it fills the next.
+class OTASink {
+public:
+    virtual ~OTASink() = default;
+
+    // Starts an image of which offset bytes are stored already
+    virtual esp_err_t begin(uint32_t offset) = 0;
+    virtual size_t blockSize() const = 0;
+    // Waits for a free block
+    virtual uint8_t *acquire() = 0;
+    // Returns the first error storing earlier blocks, if any
+    virtual esp_err_t submit(uint8_t *block, size_t length) = 0;
+    // Reads back stored image bytes
+    virtual esp_err_t read(uint32_t offset, uint8_t *buffer, size_t length) = 0;
+    // Waits for every block to be stored; complete is false to abandon the
+    // image. Frees the blocks.
+    virtual esp_err_t end(bool complete) = 0;
+    // Makes the complete image the one in use
+    virtual esp_err_t commit() = 0;
+    // Image bytes stored so far
+    virtual uint32_t written() const = 0;
+};
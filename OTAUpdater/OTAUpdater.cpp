@@ -1,188 +1,503 @@
 #include "OTAUpdater.hpp"
 
 #include "esp_log.h"
-#include "esp_crt_bundle.h"
-#include "esp_flash_partitions.h"
-#include "esp_system.h"
-#include "esp_app_format.h"
-#include <cstdio>
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
 #include <cstring>
-#include <cassert>
-
-#define BUFFSIZE 1024
+#include <algorithm>
+
+#ifdef CONFIG_OTA_UPDATER_BLOCK_SIZE
+#define OTA_BLOCK_SIZE CONFIG_OTA_UPDATER_BLOCK_SIZE
+#else
+#define OTA_BLOCK_SIZE (16 * 1024)
+#endif
+
+#ifdef CONFIG_OTA_UPDATER_BLOCK_COUNT
+#define OTA_BLOCK_COUNT CONFIG_OTA_UPDATER_BLOCK_COUNT
+#else
+#define OTA_BLOCK_COUNT 3
+#endif
+
+#ifdef CONFIG_OTA_UPDATER_RETRIES
+#define OTA_RETRIES CONFIG_OTA_UPDATER_RETRIES
+#else
+#define OTA_RETRIES 5
+#endif
+
+#ifdef CONFIG_OTA_UPDATER_INFLATE_WINDOW_BITS
+#define OTA_INFLATE_WINDOW_BITS CONFIG_OTA_UPDATER_INFLATE_WINDOW_BITS
+#else
+#define OTA_INFLATE_WINDOW_BITS 15
+#endif
+
+#define OTA_INPUT_CHUNK 4096
+#define OTA_RETRY_DELAY_MS 2000
 
 static const char *TAG = "OTAUpdater";
-static char otaWriteBuffer[BUFFSIZE + 1] = {0};
-
-// Static members
-bool OTAUpdater::headerChecked = false;
-bool OTAUpdater::isRunning = false;
-int OTAUpdater::binaryFileLength = 0;
-String OTAUpdater::otaUrl;
-TaskHandle_t OTAUpdater::otaTaskHandle = nullptr;
-OTAUpdater::ProgressCallback OTAUpdater::progressCb = nullptr;
-OTAUpdater::CompletionCallback OTAUpdater::completeCb = nullptr;
-OTAUpdater::BeforeStartCallback OTAUpdater::beforeStartCb = nullptr;
-
-esp_err_t OTAUpdater::init(const String &url) {
-    if (isRunning) {
+
+OTAUpdater::OTAUpdater() : sink(OTA_BLOCK_SIZE, OTA_BLOCK_COUNT) {
+    control = xEventGroupCreate();
+    xEventGroupSetBits(control, IDLE_BIT);
+    sink.setWrittenCallback([this](uint32_t written) {
+        if (resumeNvs && nvs_set_u32(resumeNvs, "offset", written) == ESP_OK) nvs_commit(resumeNvs);
+    });
+}
+
+OTAUpdater::~OTAUpdater() {
+    cancel();
+    wait();
+    vEventGroupDelete(control);
+}
+
+esp_err_t OTAUpdater::init(const String &url, ImageType type, Compression imageCompression) {
+    if (taskHandle) {
         ESP_LOGW(TAG, "OTA already running. Ignoring init.");
         return ESP_ERR_INVALID_STATE;
     }
+    httpSource.setUrl(url);
+    return init(httpSource, type, imageCompression);
+}
+
+esp_err_t OTAUpdater::init(OTASource &imageSource, ImageType type, Compression imageCompression) {
+    if (taskHandle) {
+        ESP_LOGW(TAG, "OTA already running. Ignoring init.");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    source = &imageSource;
+    imageType = type;
+    compression = imageCompression;
+    verifier.clear();
+    return ESP_OK;
+}
 
-    otaUrl = url;
+esp_err_t OTAUpdater::setExpectedDigest(const uint8_t sha256[32], int size) {
+    if (taskHandle) return ESP_ERR_INVALID_STATE;
+    verifier.setExpectedDigest(sha256, size);
     return ESP_OK;
 }
 
+esp_err_t OTAUpdater::setSignature(const uint8_t *sig, size_t length, const char *publicKeyPem) {
+    if (taskHandle) return ESP_ERR_INVALID_STATE;
+    return verifier.setSignature(sig, length, publicKeyPem);
+}
+
 void OTAUpdater::setProgressCallback(ProgressCallback cb) {
     progressCb = cb;
 }
 
-void OTAUpdater::setCompletionCallback(CompletionCallback cb) {
-    completeCb = cb;
+void OTAUpdater::setResultCallback(ResultCallback cb) {
+    resultCb = cb;
 }
 
 void OTAUpdater::setBeforeStartCallback(BeforeStartCallback cb) {
     beforeStartCb = cb;
 }
 
-int OTAUpdater::getProgress() {
-    return binaryFileLength;
-}
-
 esp_err_t OTAUpdater::start() {
-    if (isRunning) {
+    if (taskHandle) {
         ESP_LOGW(TAG, "OTA already running");
         return ESP_ERR_INVALID_STATE;
     }
+    if (!source) return ESP_ERR_INVALID_STATE;
 
     if (beforeStartCb) {
         beforeStartCb();
     }
 
-    isRunning = true;
-    headerChecked = false;
-    binaryFileLength = 0;
+    xEventGroupClearBits(control, PAUSE_BIT | RESUME_BIT | CANCEL_BIT | IDLE_BIT);
+    starts++;
+    received = 0;
+    resumedAt = 0;
+    lastPercent = -1;
+    activeUs = 0;
+    runningSince = esp_timer_get_time();
+    state = State::Running;
+
+    if (xTaskCreate(OTAUpdater::run, "ota_task", 8192, this, 5, &taskHandle) != pdPASS) {
+        taskHandle = nullptr;
+        state = State::Failed;
+        xEventGroupSetBits(control, IDLE_BIT);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
 
-    BaseType_t created = xTaskCreate(OTAUpdater::run, "ota_task", 8192, nullptr, 5, &otaTaskHandle);
-    return (created == pdPASS) ? ESP_OK : ESP_FAIL;
+esp_err_t OTAUpdater::pause() {
+    if (state != State::Running) return ESP_ERR_INVALID_STATE;
+    xEventGroupSetBits(control, PAUSE_BIT);
+    return ESP_OK;
+}
+
+esp_err_t OTAUpdater::resume() {
+    if (!taskHandle) return ESP_ERR_INVALID_STATE;
+    xEventGroupClearBits(control, PAUSE_BIT);
+    xEventGroupSetBits(control, RESUME_BIT);
+    return ESP_OK;
+}
+
+esp_err_t OTAUpdater::cancel() {
+    if (!taskHandle) return ESP_ERR_INVALID_STATE;
+    xEventGroupSetBits(control, CANCEL_BIT);
+    return ESP_OK;
+}
+
+// IDLE_BIT is set by the update's task as its last action, after its
+// result callback
+bool OTAUpdater::wait(TickType_t ticks) {
+    return xEventGroupWaitBits(control, IDLE_BIT, pdFALSE, pdTRUE, ticks) & IDLE_BIT;
+}
+
+int OTAUpdater::getProgress() const {
+    int total = source ? source->size() : -1;
+    return total > 0 ? (int)((int64_t)received * 100 / total) : -1;
+}
+
+OTAUpdater::Progress OTAUpdater::getStats() const {
+    int64_t since = runningSince;
+    int64_t us = activeUs + (since ? esp_timer_get_time() - since : 0);
+    Progress progress;
+    progress.received = received;
+    progress.written = sink.written();
+    progress.total = source ? source->size() : -1;
+    progress.percent = getProgress();
+    progress.bytesPerSecond = us > 0 ? (uint32_t)((int64_t)(received - resumedAt) * 1000000 / us) : 0;
+    return progress;
+}
+
+void OTAUpdater::reportProgress() {
+    if (!progressCb) return;
+    int percent = getProgress();
+    if (percent >= 0 && percent == lastPercent) return;
+    lastPercent = percent;
+    progressCb(getStats());
 }
 
 void OTAUpdater::run(void *arg) {
-    esp_http_client_config_t config = {
-        .url = otaUrl.c_str(),
-        .timeout_ms = 5000,
-        .crt_bundle_attach = esp_crt_bundle_attach,
-        .keep_alive_enable = true,
-    };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (!client || esp_http_client_open(client, 0) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        isRunning = false;
-        vTaskDelete(NULL);
-        return;
+    OTAUpdater *self = static_cast<OTAUpdater *>(arg);
+    self->finish(self->transfer());
+}
+
+// Every way an update ends comes here: releases what transfer() set up and
+// reports the outcome. The saved resume point, if any, stays for the next
+// start().
+void OTAUpdater::finish(esp_err_t err) {
+    sink.end(false);
+    source->close();
+    free(inputBuffer);
+    inputBuffer = nullptr;
+    inflater.end();
+    block = nullptr;
+    if (resumeNvs) nvs_close(resumeNvs);
+    resumeNvs = 0;
+
+    if (runningSince) activeUs += esp_timer_get_time() - runningSince;
+    runningSince = 0;
+
+    State result = State::Succeeded;
+    if (err != ESP_OK) {
+        result = (xEventGroupGetBits(control) & CANCEL_BIT) ? State::Cancelled : State::Failed;
+    }
+    if (result == State::Succeeded) {
+        ESP_LOGI(TAG, "OTA completed. Ready for restart.");
+    } else if (result == State::Cancelled) {
+        ESP_LOGW(TAG, "OTA cancelled");
+        err = ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "OTA failed: %s", esp_err_to_name(err));
     }
 
-    esp_http_client_fetch_headers(client);
+    uint32_t run = starts;
+    taskHandle = nullptr;
+    state = result;
+    if (resultCb) resultCb(result, err);
+    // Nothing of this object is touched after the bit is set, as the
+    // destructor may then return. A start() from resultCb handed the bit to
+    // its own task.
+    if (starts == run) xEventGroupSetBits(control, IDLE_BIT);
+    vTaskDelete(NULL);
+}
 
-    const esp_partition_t *updatePartition = esp_ota_get_next_update_partition(NULL);
-    assert(updatePartition);
+// Waits OTA_RETRY_DELAY_MS before another attempt, if one is left and the
+// update was not cancelled meanwhile
+bool OTAUpdater::retryAfterDelay() {
+    if (retries-- == 0) return false;
+    EventBits_t bits = xEventGroupWaitBits(control, CANCEL_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(OTA_RETRY_DELAY_MS));
+    return !(bits & CANCEL_BIT);
+}
 
-    esp_ota_handle_t updateHandle;
-    esp_err_t err;
+// Opens the source at offset, retrying while it is unreachable. An answer
+// it cannot use is not retried.
+esp_err_t OTAUpdater::openSource(uint32_t offset, uint32_t *start) {
+    while (true) {
+        esp_err_t err = source->open(offset, start);
+        if (err == ESP_OK || err == ESP_ERR_INVALID_RESPONSE) return err;
+        if (!retryAfterDelay()) return err;
+    }
+}
 
-    while (1) {
-        int data_read = esp_http_client_read(client, otaWriteBuffer, BUFFSIZE);
-        if (data_read < 0) {
-            ESP_LOGE(TAG, "HTTP read error");
-            esp_http_client_cleanup(client);
-            isRunning = false;
-            vTaskDelete(NULL);
-        } else if (data_read > 0) {
-            if (!headerChecked) {
-                if (data_read < sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                    ESP_LOGE(TAG, "Header too short");
-                    esp_http_client_cleanup(client);
-                    isRunning = false;
-                    vTaskDelete(NULL);
-                }
+// Holds the update while it is paused, with the source closed and the time
+// left out of the throughput; then opens it again where it stopped
+esp_err_t OTAUpdater::waitWhilePaused() {
+    source->close();
+    activeUs += esp_timer_get_time() - runningSince;
+    runningSince = 0;
+    state = State::Paused;
+    ESP_LOGI(TAG, "OTA paused at %lu", (unsigned long)received);
+
+    // A resume() that came before the pause took effect leaves RESUME_BIT
+    // set; only PAUSE_BIT tells whether to go on waiting
+    EventBits_t bits;
+    while (((bits = xEventGroupGetBits(control)) & PAUSE_BIT) && !(bits & CANCEL_BIT)) {
+        xEventGroupWaitBits(control, RESUME_BIT | CANCEL_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+        xEventGroupClearBits(control, RESUME_BIT);
+    }
+    runningSince = esp_timer_get_time();
+    state = State::Running;
+    if (bits & CANCEL_BIT) return ESP_ERR_INVALID_STATE;
+
+    uint32_t start;
+    esp_err_t err = openSource(received, &start);
+    if (err == ESP_OK && start != received) {
+        ESP_LOGE(TAG, "Image changed while paused");
+        clearResumeState();
+        err = ESP_ERR_INVALID_RESPONSE;
+    }
+    return err;
+}
 
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, &otaWriteBuffer[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
-
-                const esp_partition_t *running = esp_ota_get_running_partition();
-                esp_app_desc_t running_app_info;
-                if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK &&
-                    memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version)) == 0) {
-                    ESP_LOGW(TAG, "Same firmware version. Aborting.");
-                    esp_http_client_cleanup(client);
-                    isRunning = false;
-                    vTaskDelete(NULL);
-                }
+// Checks a full (or the last) block, then hands it to the sink. The last
+// one is held back unless the image as a whole verifies, so a bad image is
+// never complete in flash.
+esp_err_t OTAUpdater::queueBlock(bool last) {
+    esp_err_t err = verifier.update(block, blockLength);
+    if (err == ESP_OK && last) err = verifier.finish();
+    if (err != ESP_OK) {
+        // Resuming would only download the rest of the same bad image
+        clearResumeState();
+        return err;
+    }
+    err = sink.submit(block, blockLength);
+    block = nullptr;
+    return err;
+}
 
-                err = esp_ota_begin(updatePartition, OTA_WITH_SEQUENTIAL_WRITES, &updateHandle);
-                if (err != ESP_OK) {
-                    ESP_LOGE(TAG, "esp_ota_begin failed");
-                    esp_http_client_cleanup(client);
-                    isRunning = false;
-                    vTaskDelete(NULL);
-                }
+// Copies decoded image bytes into the sink's blocks
+bool OTAUpdater::queueImageData(const uint8_t *data, size_t length) {
+    while (length > 0) {
+        if (!block) {
+            block = sink.acquire();
+            blockLength = 0;
+        }
+        size_t n = std::min(length, OTA_BLOCK_SIZE - blockLength);
+        memcpy(block + blockLength, data, n);
+        blockLength += n;
+        data += n;
+        length -= n;
+        if (blockLength == OTA_BLOCK_SIZE && (blockError = queueBlock()) != ESP_OK) return false;
+    }
+    return true;
+}
 
-                headerChecked = true;
-            }
+// Runs data through the transforms from stage on, into the blocks
+esp_err_t OTAUpdater::applyTransform(size_t stage, const uint8_t *data, size_t length) {
+    if (stage == transforms.size()) return queueImageData(data, length) ? ESP_OK : blockError;
+    return transforms[stage]->apply(data, length, [this, stage](const uint8_t *out, size_t n) {
+        return applyTransform(stage + 1, out, n) == ESP_OK;
+    });
+}
 
-            if (esp_ota_write(updateHandle, (const void *)otaWriteBuffer, data_read) != ESP_OK) {
-                ESP_LOGE(TAG, "esp_ota_write failed");
-                esp_ota_abort(updateHandle);
-                esp_http_client_cleanup(client);
-                isRunning = false;
-                vTaskDelete(NULL);
-            }
+esp_err_t OTAUpdater::decode(const uint8_t *data, size_t length) {
+    blockError = ESP_OK;
+    esp_err_t err = applyTransform(0, data, length);
+    return blockError != ESP_OK ? blockError : err;
+}
+
+// Hashes what an earlier run left in flash, so a resumed image is verified
+// as a whole
+esp_err_t OTAUpdater::hashWritten(uint32_t length) {
+    for (uint32_t pos = 0; pos < length;) {
+        uint32_t n = std::min<uint32_t>(length - pos, OTA_BLOCK_SIZE);
+        esp_err_t err = sink.read(pos, block, n);
+        if (err == ESP_OK) err = verifier.update(block, n);
+        if (err != ESP_OK) return err;
+        pos += n;
+    }
+    return ESP_OK;
+}
 
-            binaryFileLength += data_read;
-
-            if (progressCb) {
-                int total = esp_http_client_get_content_length(client);
-                static int lastPercent = -1;
-                if (total > 0) {
-                    int percent = (binaryFileLength * 100) / total;
-                    if (percent != lastPercent) {
-                        lastPercent = percent;
-                        progressCb(binaryFileLength, total, percent);
-                    }
-                } else {
-                    progressCb(binaryFileLength, 0, 0);
+// Reads from the source into OTA_BLOCK_COUNT rotating blocks of OTA_BLOCK_SIZE
+// bytes, each handed to the sink once full, while the next one is being read.
+// A dropped source is reopened where it stopped, up to OTA_RETRIES times; a
+// transfer interrupted for good (or by a reboot) resumes from the last block
+// in flash on the next start() for the same source, if it has a tag.
+// A compressed image or a delta patch is decoded as it arrives, its output
+// filling the blocks; it reopens the same way but starts over after a reboot.
+esp_err_t OTAUpdater::transfer() {
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (!partition) return ESP_ERR_NOT_FOUND;
+    sink.setPartition(partition);
+
+    transforms.clear();
+    if (compression == Compression::Gzip) {
+        inputBuffer = (uint8_t *)malloc(OTA_INPUT_CHUNK);
+        if (!inputBuffer || inflater.begin(OTA_INFLATE_WINDOW_BITS) != ESP_OK) return ESP_ERR_NO_MEM;
+        transforms.push_back(&inflater);
+    }
+    if (imageType == ImageType::Delta) {
+        if (deltaPatch.begin(esp_ota_get_running_partition()) != ESP_OK) {
+            ESP_LOGE(TAG, "Running image unreadable, cannot apply a delta");
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (!inputBuffer && !(inputBuffer = (uint8_t *)malloc(OTA_INPUT_CHUNK))) return ESP_ERR_NO_MEM;
+        transforms.push_back(&deltaPatch);
+    }
+    bool encoded = !transforms.empty();
+
+    retries = OTA_RETRIES;
+    uint32_t start = 0;
+    esp_err_t err = openSource(encoded ? 0 : loadResumeOffset(), &start);
+    if (err != ESP_OK) return err;
+
+    // From 0, the sink drops what was saved for the image it replaces
+    err = sink.begin(start);
+    if (err != ESP_OK) return err;
+    if (start == 0) saveResumeState();
+    verifier.begin(start > 0);      // checked by the run that began the image
+    received = start;
+    resumedAt = start;
+    block = nullptr;
+    if (start > 0) {
+        ESP_LOGI(TAG, "Resuming OTA at %lu", (unsigned long)start);
+        block = sink.acquire();
+        blockLength = 0;
+        if ((err = hashWritten(start)) != ESP_OK) {
+            ESP_LOGE(TAG, "Cannot read back the partial image");
+            return err;
+        }
+    }
+
+    while (true) {
+        EventBits_t bits = xEventGroupGetBits(control);
+        if (bits & CANCEL_BIT) return ESP_ERR_INVALID_STATE;
+        if ((bits & PAUSE_BIT) && (err = waitWhilePaused()) != ESP_OK) return err;
+
+        if (!encoded && !block) {
+            block = sink.acquire();
+            blockLength = 0;
+        }
+
+        int data_read;
+        if (encoded) {
+            data_read = source->read(inputBuffer, OTA_INPUT_CHUNK);
+        } else {
+            data_read = source->read(block + blockLength, OTA_BLOCK_SIZE - blockLength);
+        }
+        if (data_read < 0) {
+            ESP_LOGW(TAG, "Read error at %lu", (unsigned long)received);
+            source->close();
+            if (!retryAfterDelay()) return ESP_FAIL;
+            if ((err = openSource(received, &start)) != ESP_OK) return err;
+            if (start != received) {
+                ESP_LOGE(TAG, "Image changed during the download");
+                clearResumeState();
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            continue;
+        } else if (data_read > 0) {
+            if (encoded) {
+                if ((err = decode(inputBuffer, data_read)) != ESP_OK) {
+                    ESP_LOGE(TAG, "Decoding the image failed: %s", esp_err_to_name(err));
+                    return err;
                 }
+            } else {
+                blockLength += data_read;
             }
-        } else {
-            if (esp_http_client_is_complete_data_received(client))
-                break;
+            received += data_read;
+            reportProgress();
+        } else if (source->complete()) {
+            break;
         }
-    }
 
-    if (!esp_http_client_is_complete_data_received(client)) {
-        ESP_LOGE(TAG, "Incomplete OTA image");
-        esp_ota_abort(updateHandle);
-        esp_http_client_cleanup(client);
-        isRunning = false;
-        vTaskDelete(NULL);
+        if (block && blockLength == OTA_BLOCK_SIZE && (err = queueBlock()) != ESP_OK) {
+            return err;
+        }
     }
 
-    if (esp_ota_end(updateHandle) != ESP_OK || esp_ota_set_boot_partition(updatePartition) != ESP_OK) {
-        ESP_LOGE(TAG, "OTA commit failed");
-        esp_http_client_cleanup(client);
-        isRunning = false;
-        vTaskDelete(NULL);
+    for (OTATransform *transform : transforms) {
+        if (!transform->done()) {
+            ESP_LOGE(TAG, "Incomplete OTA image");
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    if (block && blockLength > 0) {
+        err = queueBlock(true);
+    } else if ((err = verifier.finish()) != ESP_OK) {
+        clearResumeState();
     }
+    if (err != ESP_OK) return err;
 
-    ESP_LOGI(TAG, "OTA completed. Ready for restart.");
+    err = sink.end(true);
+    if (err == ESP_OK) err = sink.commit();
+    // Done with this image either way: a corrupt one must be downloaded afresh
+    clearResumeState();
+    return err;
+}
 
-    esp_http_client_cleanup(client);
-    if (completeCb) completeCb();
+// Where an interrupted transfer of the same source, tag and partition
+// stopped, or 0. NVS must have been initialised by the application.
+uint32_t OTAUpdater::loadResumeOffset() {
+    if (nvs_open(OTA_RESUME_NAMESPACE, NVS_READWRITE, &resumeNvs) != ESP_OK) {
+        ESP_LOGW(TAG, "NVS unavailable, downloads will not resume");
+        resumeNvs = 0;
+        return 0;
+    }
 
-    isRunning = false;
-    vTaskDelete(NULL);
+    char savedName[256];
+    char savedTag[64];
+    size_t nameLen = sizeof(savedName);
+    size_t tagLen = sizeof(savedTag);
+    uint32_t address = 0, size = 0, offset = 0;
+    if (nvs_get_str(resumeNvs, "url", savedName, &nameLen) != ESP_OK ||
+        nvs_get_str(resumeNvs, "tag", savedTag, &tagLen) != ESP_OK ||
+        nvs_get_u32(resumeNvs, "partition", &address) != ESP_OK ||
+        nvs_get_u32(resumeNvs, "size", &size) != ESP_OK ||
+        nvs_get_u32(resumeNvs, "offset", &offset) != ESP_OK)
+        return 0;
+    if (strcmp(savedName, source->name()) != 0 || address != sink.getPartition()->address || offset == 0 ||
+        offset >= size)
+        return 0;
+
+    source->setTag(savedTag);
+    return offset;
 }
 
+// A new transfer: remembers what identifies it, with nothing written yet.
+// The record is the partition's, as is the image it describes; a source
+// with nothing to tell a changed image by leaves it alone and never resumes.
+void OTAUpdater::saveResumeState() {
+    if (!resumeNvs) return;
+    if (source->tag()[0] == '\0' || source->size() <= 0) {
+        nvs_close(resumeNvs);
+        resumeNvs = 0;
+        return;
+    }
+    nvs_set_str(resumeNvs, "url", source->name());
+    nvs_set_str(resumeNvs, "tag", source->tag());
+    nvs_set_u32(resumeNvs, "partition", sink.getPartition()->address);
+    nvs_set_u32(resumeNvs, "size", source->size());
+    nvs_set_u32(resumeNvs, "offset", 0);
+    nvs_commit(resumeNvs);
+}
+
+// Drops this updater's record, unless another one has saved its own since
+void OTAUpdater::clearResumeState() {
+    if (!resumeNvs) return;
+    char savedName[256];
+    size_t nameLen = sizeof(savedName);
+    if (nvs_get_str(resumeNvs, "url", savedName, &nameLen) != ESP_OK || strcmp(savedName, source->name()) != 0)
+        return;
+    static const char *const keys[] = {"url", "tag", "partition", "size", "offset"};
+    for (const char *key : keys) nvs_erase_key(resumeNvs, key);
+    nvs_commit(resumeNvs);
+}
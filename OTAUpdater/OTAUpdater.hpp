@@ -1,35 +1,141 @@
 #pragma once
 
 #include "WString.h"
-#include "esp_ota_ops.h"
-#include "esp_http_client.h"
+#include "OTAPipeline.hpp"
+#include "OTAHttpSource.hpp"
+#include "OTAPartitionSink.hpp"
+#include "OTAVerifier.hpp"
+#include "OTADeltaPatch.hpp"
+#include "OTAInflate.hpp"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
 #include <functional>
+#include <vector>
 
+// Streams an app image into the next update partition through a pipeline:
+// a source it is pulled from (HTTP unless init() is given another), the
+// transforms it needs decoding with, the verifier, and a partition sink
+// that writes each block while the next one is read. An update runs in a
+// task of its own; it can be paused, resumed and cancelled, and its outcome
+// is reported once, whichever way it ends.
 class OTAUpdater
 {
 public:
-    using ProgressCallback = std::function<void(int progress, int total, int percent)>;
-    using CompletionCallback = std::function<void()>;
+    enum class State { Idle, Running, Paused, Succeeded, Failed, Cancelled };
+
+    struct Progress {
+        uint32_t received;          // source bytes, including any an earlier run left in flash
+        uint32_t written;           // image bytes in flash
+        int total;                  // source bytes, -1 if unknown
+        int percent;                // of total, -1 if unknown
+        uint32_t bytesPerSecond;    // source bytes read by this run, over its time not paused
+    };
+
+    using ProgressCallback = std::function<void(const Progress &progress)>;
+    // Called once per start(), from the update's task: Succeeded (err ESP_OK),
+    // Failed with the error, or Cancelled
+    using ResultCallback = std::function<void(State state, esp_err_t err)>;
     using BeforeStartCallback = std::function<void()>;
 
-    static esp_err_t init(const String &url);
-    static esp_err_t start();
-    static void setProgressCallback(ProgressCallback cb);
-    static void setCompletionCallback(CompletionCallback cb);
-    static void setBeforeStartCallback(BeforeStartCallback cb);
-    static int getProgress();
+    // What the source serves: a whole app image, or an OTADeltaPatch against
+    // the running one
+    enum class ImageType { Full, Delta };
+    // How it is compressed, decompressed in OTA_UPDATER_INFLATE_WINDOW_BITS
+    enum class Compression { None, Gzip };
+
+    OTAUpdater();
+    // Cancels a running update and waits for it to end
+    ~OTAUpdater();
+
+    // An image at url, over HTTP(S)
+    esp_err_t init(const String &url, ImageType type = ImageType::Full,
+                   Compression compression = Compression::None);
+    // An image from any source, which must outlive the update
+    esp_err_t init(OTASource &source, ImageType type = ImageType::Full,
+                   Compression compression = Compression::None);
+    // From a manifest, for the update init() was last called for: the
+    // decoded image's SHA-256 and size (-1 if unknown), and a signature over
+    // that SHA-256 with the signer's PEM public key (ECDSA or RSA). Checked as
+    // the image streams in, before its last block is written.
+    esp_err_t setExpectedDigest(const uint8_t sha256[32], int size = -1);
+    esp_err_t setSignature(const uint8_t *signature, size_t length, const char *publicKeyPem);
+    void setProgressCallback(ProgressCallback cb);
+    void setResultCallback(ResultCallback cb);
+    void setBeforeStartCallback(BeforeStartCallback cb);
+
+    esp_err_t start();
+    // Take effect at the next read: a paused update closes its source and
+    // opens it again where it stopped on resume()
+    esp_err_t pause();
+    esp_err_t resume();
+    esp_err_t cancel();
+    // Waits for a started update to end, its result callback included; not
+    // from that callback. False if it has not within ticks.
+    bool wait(TickType_t ticks = portMAX_DELAY);
+
+    State getState() const { return state; }
+    // Percent of the source read, or -1 if its size is unknown
+    int getProgress() const;
+    Progress getStats() const;
 
 private:
-    OTAUpdater() = default;
+    // Control bits for the update's task
+    static constexpr EventBits_t PAUSE_BIT = BIT0;
+    static constexpr EventBits_t RESUME_BIT = BIT1;
+    static constexpr EventBits_t CANCEL_BIT = BIT2;
+    static constexpr EventBits_t IDLE_BIT = BIT3;   // no task, or it is about to delete itself
 
     static void run(void *arg);
-    static bool headerChecked;
-    static bool isRunning;
-    static int binaryFileLength;
-    static String otaUrl;
-    static TaskHandle_t otaTaskHandle;
-
-    static ProgressCallback progressCb;
-    static CompletionCallback completeCb;
-    static BeforeStartCallback beforeStartCb;
+    esp_err_t transfer();
+    void finish(esp_err_t err);
+    esp_err_t openSource(uint32_t offset, uint32_t *start);
+    esp_err_t waitWhilePaused();
+    bool retryAfterDelay();
+    esp_err_t queueBlock(bool last = false);
+    bool queueImageData(const uint8_t *data, size_t length);
+    esp_err_t decode(const uint8_t *data, size_t length);
+    esp_err_t applyTransform(size_t stage, const uint8_t *data, size_t length);
+    esp_err_t hashWritten(uint32_t length);
+    void reportProgress();
+    uint32_t loadResumeOffset();
+    void saveResumeState();
+    void clearResumeState();
+
+    volatile State state = State::Idle;
+    EventGroupHandle_t control;
+    TaskHandle_t taskHandle = nullptr;
+    uint32_t starts = 0;
+
+    // Pipeline
+    OTASource *source = nullptr;
+    OTAHttpSource httpSource;
+    ImageType imageType = ImageType::Full;
+    Compression compression = Compression::None;
+    OTAInflate inflater;
+    OTADeltaPatch deltaPatch;
+    std::vector<OTATransform *> transforms;
+    uint8_t *inputBuffer = nullptr;     // encoded data, before it is decoded
+    OTAVerifier verifier;
+    OTAPartitionSink sink;
+    uint8_t *block = nullptr;           // being filled for the sink
+    size_t blockLength = 0;
+    esp_err_t blockError = ESP_OK;      // why the transforms' output was refused
+    int retries = 0;
+
+    // Progress
+    volatile uint32_t received = 0;
+    uint32_t resumedAt = 0;
+    int lastPercent = -1;
+    int64_t activeUs = 0;               // running time before the current stretch
+    int64_t runningSince = 0;           // start of the current stretch, 0 while paused
+
+    // Resume state, mirrored in NVS once the image is identified by a tag;
+    // open while this updater owns the record
+    nvs_handle_t resumeNvs = 0;
+
+    ProgressCallback progressCb;
+    ResultCallback resultCb;
+    BeforeStartCallback beforeStartCb;
 };
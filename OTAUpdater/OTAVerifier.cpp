@@ -0,0 +1,115 @@
+#include "OTAVerifier.hpp"
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_app_format.h"
+#include "mbedtls/pk.h"
+#include <cstring>
+
+static const char *TAG = "OTAVerifier";
+
+OTAVerifier::OTAVerifier() {
+    mbedtls_sha256_init(&sha);
+}
+
+OTAVerifier::~OTAVerifier() {
+    mbedtls_sha256_free(&sha);
+}
+
+bool OTAVerifier::checkHeader(const uint8_t *data, int length) {
+    if (length < sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+        ESP_LOGE(TAG, "Header too short");
+        return false;
+    }
+    if (data[0] != ESP_IMAGE_HEADER_MAGIC) {
+        ESP_LOGE(TAG, "Not an app image");
+        return false;
+    }
+
+    esp_app_desc_t new_app_info;
+    memcpy(&new_app_info, &data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_app_desc_t running_app_info;
+    if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK &&
+        memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version)) == 0) {
+        ESP_LOGW(TAG, "Same firmware version. Aborting.");
+        return false;
+    }
+    return true;
+}
+
+void OTAVerifier::setExpectedDigest(const uint8_t sha256[32], int size) {
+    memcpy(expectedDigest, sha256, sizeof(expectedDigest));
+    expectedSize = size;
+    hasDigest = true;
+}
+
+esp_err_t OTAVerifier::setSignature(const uint8_t *sig, size_t length, const char *publicKeyPem) {
+    // Refuse a key that will not parse now rather than every image later
+    mbedtls_pk_context pk;
+    mbedtls_pk_init(&pk);
+    int ret = mbedtls_pk_parse_public_key(&pk, (const unsigned char *)publicKeyPem, strlen(publicKeyPem) + 1);
+    mbedtls_pk_free(&pk);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Invalid public key: -0x%04x", -ret);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    signature.assign(sig, sig + length);
+    publicKey = publicKeyPem;
+    return ESP_OK;
+}
+
+void OTAVerifier::clear() {
+    hasDigest = false;
+    expectedSize = -1;
+    signature.clear();
+}
+
+void OTAVerifier::begin(bool checked) {
+    mbedtls_sha256_starts(&sha, 0);
+    hashedLength = 0;
+    headerChecked = checked;
+}
+
+esp_err_t OTAVerifier::update(const uint8_t *data, size_t length) {
+    if (!headerChecked && !(headerChecked = checkHeader(data, length))) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    mbedtls_sha256_update(&sha, data, length);
+    hashedLength += length;
+    if (expectedSize >= 0 && hashedLength > expectedSize) {
+        ESP_LOGE(TAG, "Image larger than the expected %d bytes", expectedSize);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t OTAVerifier::finish() {
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+
+    if (expectedSize >= 0 && hashedLength != expectedSize) {
+        ESP_LOGE(TAG, "Image is %d bytes, expected %d", hashedLength, expectedSize);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (hasDigest && memcmp(digest, expectedDigest, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "Image SHA-256 does not match the manifest");
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (!signature.empty()) {
+        mbedtls_pk_context pk;
+        mbedtls_pk_init(&pk);
+        int ret = mbedtls_pk_parse_public_key(&pk, (const unsigned char *)publicKey.c_str(), publicKey.length() + 1);
+        if (ret == 0) {
+            ret = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, digest, sizeof(digest), signature.data(), signature.size());
+        }
+        mbedtls_pk_free(&pk);
+        if (ret != 0) {
+            ESP_LOGE(TAG, "Image signature invalid: -0x%04x", -ret);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "WString.h"
+#include "esp_err.h"
+#include "mbedtls/sha256.h"
+#include <vector>
+
+// Checks a decoded image as it streams past, before its last bytes are
+// stored: the app header of its first block, then, if a manifest gave them,
+// its size, SHA-256 and a signature over that SHA-256.
+class OTAVerifier {
+public:
+    OTAVerifier();
+    ~OTAVerifier();
+
+    // True if the first bytes of an app image are acceptable to flash: an
+    // image header, and a version other than the running one. Shared by
+    // every OTA source.
+    static bool checkHeader(const uint8_t *data, int length);
+
+    // The image's SHA-256 and size (-1 if unknown)
+    void setExpectedDigest(const uint8_t sha256[32], int size = -1);
+    // Over the SHA-256, with the signer's PEM public key (ECDSA or RSA)
+    esp_err_t setSignature(const uint8_t *signature, size_t length, const char *publicKeyPem);
+    // Forgets the manifest
+    void clear();
+
+    // Starts over for an image; headerChecked if an earlier run checked it
+    void begin(bool headerChecked = false);
+    // Takes the next image bytes; the first ones must hold the whole header
+    esp_err_t update(const uint8_t *data, size_t length);
+    // Checks the whole image against the manifest
+    esp_err_t finish();
+    int length() const { return hashedLength; }
+
+private:
+    mbedtls_sha256_context sha;
+    bool headerChecked = false;
+    int hashedLength = 0;
+    bool hasDigest = false;
+    uint8_t expectedDigest[32];
+    int expectedSize = -1;
+    std::vector<uint8_t> signature;
+    String publicKey;
+};
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""Makes an OTADIFF1 patch that turns one app image into another.
+
+The device applies it with OTAUpdater::ImageType::Delta against the image it
+runs, so OLD must be the .bin that is flashed there, byte for byte:
+
+    python otadiff.py build_v1/app.bin build_v2/app.bin app_v1_v2.patch
+    python otadiff.py --gzip 15 build_v1/app.bin build_v2/app.bin app_v1_v2.patch.gz
+
+With --gzip, serve the patch with Compression::Gzip and give a window no larger
+than the device's OTA_UPDATER_INFLATE_WINDOW_BITS. Every patch is applied
+here before it is written, so a patch that does not rebuild NEW is never
+produced.
+
+Matching follows bsdiff: each stretch of NEW is paired with the stretch of
+OLD it differs least from, found from an exact 8-byte seed and grown while
+at least half the bytes agree, so code that only moved keeps its bytewise
+differences small. The differences go in the diff stream, unmatched bytes in
+the extra stream. See OTADeltaPatch.hpp for the format.
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = b'OTADIFF1'
+IMAGE_MAGIC = 0xE9
+APP_DESC_OFFSET = 24 + 8          # after the image and first segment headers
+APP_DESC_MAGIC = 0xABCD5432
+ELF_SHA_OFFSET = APP_DESC_OFFSET + 144
+
+SEED = 8            # bytes that must match exactly to try an alignment
+MIN_SCORE = 16      # matching bytes over mismatched ones worth a record
+GIVE_UP = 64        # score below the best at which an extension stops
+
+
+def elf_sha256(image, name):
+    if len(image) < ELF_SHA_OFFSET + 32 or image[0] != IMAGE_MAGIC or \
+            struct.unpack_from('<I', image, APP_DESC_OFFSET)[0] != APP_DESC_MAGIC:
+        sys.exit('%s is not an ESP app image' % name)
+    return image[ELF_SHA_OFFSET:ELF_SHA_OFFSET + 32]
+
+
+def index(old):
+    """First position in OLD of every SEED-byte string in it"""
+    seeds = {}
+    for pos in range(len(old) - SEED + 1):
+        seeds.setdefault(old[pos:pos + SEED], pos)
+    return seeds
+
+
+def extend(old, new, old_pos, new_pos, limit, step):
+    """Length past the given positions, going by step (1 or -1), that keeps
+    the most matching bytes over mismatched ones, and that score"""
+    score = best = length = 0
+    i = 0
+    while i < limit:
+        o = old_pos + i * step
+        n = new_pos + i * step
+        if o < 0 or o >= len(old):
+            break
+        score += 1 if old[o] == new[n] else -1
+        i += 1
+        if score > best:
+            best, length = score, i
+        elif score < best - GIVE_UP:
+            break
+    return length, best
+
+
+def matches(old, new):
+    """(new start, old start, length) of the stretches to diff, in order"""
+    seeds = index(old)
+    found = []
+    offset = 0              # old - new of the last match, likely to go on
+    pos = 0
+    done = 0                # end in NEW of the last match
+    while pos + SEED <= len(new):
+        candidates = []
+        if 0 <= pos + offset and pos + offset + SEED <= len(old) and \
+                old[pos + offset:pos + offset + SEED] == new[pos:pos + SEED]:
+            candidates.append(pos + offset)
+        seed = seeds.get(new[pos:pos + SEED])
+        if seed is not None and seed != pos + offset:
+            candidates.append(seed)
+
+        best = None
+        for old_pos in candidates:
+            ahead, score = extend(old, new, old_pos, pos, len(new) - pos, 1)
+            back, back_score = extend(old, new, old_pos - 1, pos - 1, pos - done, -1)
+            if best is None or score + back_score > best[0]:
+                best = (score + back_score, pos - back, old_pos - back, back + ahead)
+        if best is None or best[0] < MIN_SCORE:
+            pos += 1
+            continue
+
+        _, new_start, old_start, length = best
+        found.append((new_start, old_start, length))
+        offset = old_start - new_start
+        done = pos = new_start + length
+    return found
+
+
+def make_patch(old, new):
+    out = [MAGIC, struct.pack('<I', len(new)), elf_sha256(old, 'OLD')]
+    old_pos = 0
+    new_pos = 0
+
+    def record(diff_len, extra_end, seek_to):
+        nonlocal old_pos, new_pos
+        extra_len = extra_end - new_pos - diff_len
+        out.append(struct.pack('<IIi', diff_len, extra_len, seek_to - old_pos - diff_len))
+        out.append(bytes((new[new_pos + i] - old[old_pos + i]) & 0xFF for i in range(diff_len)))
+        out.append(new[new_pos + diff_len:extra_end])
+        new_pos = extra_end
+        old_pos = seek_to
+
+    # Unmatched bytes before the first match, then each match with the ones
+    # after it and a seek to where the next one starts in OLD
+    found = matches(old, new)
+    if not found:
+        record(0, len(new), 0)
+    elif found[0][:2] != (0, 0):
+        record(0, found[0][0], found[0][1])
+    for k, (new_start, old_start, length) in enumerate(found):
+        following = found[k + 1] if k + 1 < len(found) else (len(new), old_start + length)
+        record(length, following[0], following[1])
+    return b''.join(out)
+
+
+def apply_patch(old, patch):
+    """What the device rebuilds, checked the way OTADeltaPatch checks it"""
+    if patch[:8] != MAGIC or patch[12:44] != elf_sha256(old, 'OLD'):
+        raise ValueError('not a patch for this image')
+    size, = struct.unpack_from('<I', patch, 8)
+    new = bytearray()
+    pos = 44
+    old_pos = 0
+    while len(new) < size:
+        diff_len, extra_len, seek = struct.unpack_from('<IIi', patch, pos)
+        pos += 12
+        if len(new) + diff_len + extra_len > size or old_pos + diff_len > len(old):
+            raise ValueError('record out of range')
+        new += bytes((old[old_pos + i] + patch[pos + i]) & 0xFF for i in range(diff_len))
+        pos += diff_len
+        new += patch[pos:pos + extra_len]
+        pos += extra_len
+        old_pos += diff_len + seek
+        if not 0 <= old_pos <= len(old):
+            raise ValueError('seek outside the base image')
+    if pos != len(patch):
+        raise ValueError('data after the end of the patch')
+    return bytes(new)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Make an OTADIFF1 patch from OLD to NEW app image.')
+    parser.add_argument('old', help='image the device runs')
+    parser.add_argument('new', help='image to update it to')
+    parser.add_argument('patch', help='patch file to write')
+    parser.add_argument('--gzip', type=int, metavar='WINDOW_BITS', choices=range(9, 16),
+                        help='gzip the patch with a window of 2^WINDOW_BITS bytes (9-15)')
+    args = parser.parse_args()
+
+    with open(args.old, 'rb') as f:
+        old = f.read()
+    with open(args.new, 'rb') as f:
+        new = f.read()
+    elf_sha256(new, 'NEW')
+
+    patch = make_patch(old, new)
+    if apply_patch(old, patch) != new:
+        sys.exit('patch does not rebuild NEW')
+    if args.gzip:
+        compressor = zlib.compressobj(9, zlib.DEFLATED, 16 + args.gzip)
+        patch = compressor.compress(patch) + compressor.flush()
+
+    with open(args.patch, 'wb') as f:
+        f.write(patch)
+    print('%s: %d bytes for an image of %d (%.1f%%)' % (args.patch, len(patch), len(new), 100.0 * len(patch) / len(new)))
+
+
+if __name__ == '__main__':
+    main()
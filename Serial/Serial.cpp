@@ -1,5 +1,6 @@
 #include "Serial.h"
 #include <cstring>
+#include <cstdlib>
 #include <algorithm>
 
 const char* HardwareSerial::TAG = "HardwareSerial";
@@ -20,13 +21,42 @@ HardwareSerial::HardwareSerial(uart_port_t uart_num) :
     _initialized(false),
     _rx_buffer_size(256),
     _tx_buffer_size(256),
+    _rx_only(false),
+    _inverse(0),
+    _flow_ctrl(UART_HW_FLOWCTRL_DISABLE),
+    _rx_flow_ctrl_thresh(112),
+    _rx_timeout(0),
+    _uart_mode(UART_MODE_UART),
     _peek_buffer(0),
-    _peek_buffer_valid(false)
+    _peek_buffer_valid(false),
+    _event_queue(NULL),
+    _event_queue_size(20),
+    _line_mode(false),
+    _line_terminator('\n'),
+    _pattern_queue_size(32),
+    _rx_threshold(1),
+    _rx_task(NULL),
+    _rx_stop(false),
+    _rx_stopped(NULL),
+    _rx_signal(NULL),
+    _rx_overflow(false),
+    _stats(),
+    _rx_high_water(0),
+    _tx_high_water(0),
+    _carry(NULL),
+    _carry_len(0),
+    _carry_pos(0)
 {
 }
 
 HardwareSerial::~HardwareSerial() {
     end();
+    if (_rx_signal) {
+        vSemaphoreDelete(_rx_signal);
+    }
+    if (_rx_stopped) {
+        vSemaphoreDelete(_rx_stopped);
+    }
 }
 
 void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin, bool invert, unsigned long timeout_ms, uint8_t rxfifo_full_thrhd) {
@@ -61,29 +91,18 @@ void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, in
         _tx_pin = txPin;
     }
     
-    // Configure UART parameters
-    uart_config_t uart_config = {
-        .baud_rate = (int)_baud,
-        .data_bits = _getDataBits(_config),
-        .parity = _getParity(_config),
-        .stop_bits = _getStopBits(_config),
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-        .rx_flow_ctrl_thresh = rxfifo_full_thrhd,
-        .source_clk = UART_SCLK_DEFAULT,
-        .flags = {
-            .backup_before_sleep = 0
-        },
-    };
-    
-    ESP_ERROR_CHECK(uart_param_config(_uart_num, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(_uart_num, _tx_pin, _rx_pin, _rts_pin, _cts_pin));
-    ESP_ERROR_CHECK(uart_driver_install(_uart_num, _rx_buffer_size, _tx_buffer_size, 10, NULL, 0));
+    _rx_only = false;
+    _inverse = invert ? (UART_SIGNAL_RXD_INV | UART_SIGNAL_TXD_INV) : 0;
+    _flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    _rx_flow_ctrl_thresh = rxfifo_full_thrhd;
+    _rx_timeout = 0;
+    _uart_mode = UART_MODE_UART;
     
-    if (invert) {
-        uart_set_line_inverse(_uart_num, UART_SIGNAL_RXD_INV | UART_SIGNAL_TXD_INV);
-    }
+    _configureUart();
+    ESP_ERROR_CHECK(_installDriver(_tx_buffer_size));
     
     _initialized = true;
+    _startRxTask();
     ESP_LOGD(TAG, "UART%d initialized: baud=%lu, rx=%d, tx=%d", _uart_num, _baud, _rx_pin, _tx_pin);
 }
 
@@ -98,53 +117,47 @@ void HardwareSerial::beginRxOnly(unsigned long baud, int8_t rxPin, uint32_t conf
     _tx_pin = UART_PIN_NO_CHANGE; // Disable TX pin
     _rts_pin = UART_PIN_NO_CHANGE;
     _cts_pin = UART_PIN_NO_CHANGE;
+    _rx_only = true;
+    _inverse = invert ? UART_SIGNAL_RXD_INV : 0;
+    _flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    _rx_flow_ctrl_thresh = 112;
+    _rx_timeout = 0;
+    _uart_mode = UART_MODE_UART;
     
-    // Configure UART parameters
-    uart_config_t uart_config = {
-        .baud_rate = (int)_baud,
-        .data_bits = _getDataBits(_config),
-        .parity = _getParity(_config),
-        .stop_bits = _getStopBits(_config),
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-        .rx_flow_ctrl_thresh = 112,
-        .source_clk = UART_SCLK_DEFAULT,
-        .flags = {
-            .backup_before_sleep = 0
-        },
-    };
-    
-    ESP_ERROR_CHECK(uart_param_config(_uart_num, &uart_config));
     // Set only RX pin, TX disabled
-    ESP_ERROR_CHECK(uart_set_pin(_uart_num, UART_PIN_NO_CHANGE, _rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    _configureUart();
     // Install driver with TX buffer = 0 for RX-only mode
-    ESP_ERROR_CHECK(uart_driver_install(_uart_num, _rx_buffer_size, 0, 10, NULL, 0));
-    
-    if (invert) {
-        uart_set_line_inverse(_uart_num, UART_SIGNAL_RXD_INV);
-    }
+    ESP_ERROR_CHECK(_installDriver(0));
     
     _initialized = true;
+    _startRxTask();
     ESP_LOGI(TAG, "UART%d initialized (RX-only): baud=%lu, rx=%d", _uart_num, _baud, _rx_pin);
 }
 
 void HardwareSerial::end() {
     if (_initialized) {
+        _stopRxTask();
         uart_driver_delete(_uart_num);
+        _event_queue = NULL;
         _initialized = false;
-
+        _peek_buffer_valid = false;
+        _readCarry(NULL, _carryAvailable());
     }
 }
 
 int HardwareSerial::available() {
     if (!_initialized) return 0;
+    if (_rx_overflow) _takeRxOverflow();
     
     size_t available_bytes = 0;
     uart_get_buffered_data_len(_uart_num, &available_bytes);
-    return available_bytes + (_peek_buffer_valid ? 1 : 0);
+    _noteRxLevel(available_bytes);
+    return available_bytes + _carryAvailable() + (_peek_buffer_valid ? 1 : 0);
 }
 
 int HardwareSerial::read() {
     if (!_initialized) return -1;
+    if (_rx_overflow) _takeRxOverflow();
     
     if (_peek_buffer_valid) {
         _peek_buffer_valid = false;
@@ -152,19 +165,26 @@ int HardwareSerial::read() {
     }
     
     uint8_t byte;
+    if (_readCarry(&byte, 1) == 1) {
+        return byte;
+    }
     int len = uart_read_bytes(_uart_num, &byte, 1, 0);
     return (len > 0) ? byte : -1;
 }
 
 int HardwareSerial::peek() {
     if (!_initialized) return -1;
+    if (_rx_overflow) _takeRxOverflow();
     
     if (_peek_buffer_valid) {
         return _peek_buffer;
     }
     
     uint8_t byte;
-    int len = uart_read_bytes(_uart_num, &byte, 1, 0);
+    int len = _readCarry(&byte, 1);
+    if (len == 0) {
+        len = uart_read_bytes(_uart_num, &byte, 1, 0);
+    }
     if (len > 0) {
         _peek_buffer = byte;
         _peek_buffer_valid = true;
@@ -184,6 +204,7 @@ size_t HardwareSerial::write(uint8_t byte) {
     if (!_initialized) return 0;
     
     int written = uart_write_bytes(_uart_num, &byte, 1);
+    _noteTxLevel();
     return (written >= 0) ? written : 0;
 }
 
@@ -191,6 +212,7 @@ size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
     if (!_initialized || !buffer) return 0;
     
     int written = uart_write_bytes(_uart_num, buffer, size);
+    _noteTxLevel();
     return (written >= 0) ? written : 0;
 }
 
@@ -200,22 +222,50 @@ size_t HardwareSerial::readBytes(char *buffer, size_t length) {
 
 size_t HardwareSerial::readBytes(uint8_t *buffer, size_t length) {
     if (!_initialized || !buffer) return 0;
+    if (_rx_overflow) _takeRxOverflow();
     
-    int read_len = uart_read_bytes(_uart_num, buffer, length, pdMS_TO_TICKS(1000));
-    return (read_len >= 0) ? read_len : 0;
+    // available() counts a peeked byte, so it comes first
+    size_t index = 0;
+    if (_peek_buffer_valid && length > 0) {
+        buffer[index++] = _peek_buffer;
+        _peek_buffer_valid = false;
+    }
+    index += _readCarry(buffer + index, length - index);
+    if (index == length) {
+        return index;
+    }
+    
+    int read_len = uart_read_bytes(_uart_num, buffer + index, length - index, pdMS_TO_TICKS(1000));
+    return index + ((read_len >= 0) ? read_len : 0);
 }
 
 String HardwareSerial::readString() {
     String result;
     if (!_initialized) return result;
+    if (_rx_overflow) _takeRxOverflow();
     
-    int c;
-    while ((c = read()) >= 0) {
-        result += (char)c;
-        if (available() == 0) {
+    if (_peek_buffer_valid) {
+        result += (char)_peek_buffer;
+        _peek_buffer_valid = false;
+    }
+    if (_carryAvailable() > 0) {
+        result.concat(_carry + _carry_pos, _carryAvailable());
+        _readCarry(NULL, _carryAvailable());
+    }
+    
+    // Take whatever is buffered at once rather than a byte per call
+    uint8_t chunk[128];
+    while (true) {
+        size_t buffered = 0;
+        uart_get_buffered_data_len(_uart_num, &buffered);
+        if (buffered == 0) {
             vTaskDelay(pdMS_TO_TICKS(1)); // Small delay to allow more data
-            if (available() == 0) break;
+            uart_get_buffered_data_len(_uart_num, &buffered);
+            if (buffered == 0) break;
         }
+        int len = uart_read_bytes(_uart_num, chunk, std::min(buffered, sizeof(chunk)), 0);
+        if (len <= 0) break;
+        result.concat(chunk, len);
     }
     return result;
 }
@@ -224,6 +274,45 @@ String HardwareSerial::readStringUntil(char terminator) {
     String result;
     if (!_initialized) return result;
     
+    if (_line_mode && terminator == _line_terminator) {
+        if (_rx_overflow) _takeRxOverflow();
+        // peek() took the terminator's mark along with its byte
+        if (_peek_buffer_valid && _peek_buffer == (uint8_t)terminator) {
+            _peek_buffer_valid = false;
+            return result;
+        }
+        bool complete;
+        size_t carried = _carryLine(complete);
+        int pos = 0;
+        if (!complete) {
+            pos = _waitForLine(_timeout);
+            if (pos < 0) return result;
+            // An overflow flushed while waiting took the carry with it
+            carried = _carryLine(complete);
+        }
+        
+        if (_peek_buffer_valid) {
+            result += (char)_peek_buffer;
+            _peek_buffer_valid = false;
+        }
+        result.reserve(result.length() + carried + pos);
+        if (carried > 0) {
+            result.concat(_carry + _carry_pos, carried);
+        }
+        _readCarry(NULL, carried + (complete ? 1 : 0));
+        if (complete) return result;
+        
+        uint8_t chunk[128];
+        while (pos > 0) {
+            int len = uart_read_bytes(_uart_num, chunk, std::min((size_t)pos, sizeof(chunk)), pdMS_TO_TICKS(_timeout));
+            if (len <= 0) break;
+            result.concat(chunk, len);
+            pos -= len;
+        }
+        _discardRx(pos + 1);
+        return result;
+    }
+    
     int c;
     while ((c = read()) >= 0) {
         if (c == terminator) break;
@@ -239,6 +328,11 @@ int HardwareSerial::readBytesUntil(char terminator, char *buffer, size_t length)
 int HardwareSerial::readBytesUntil(char terminator, uint8_t *buffer, size_t length) {
     if (!_initialized || !buffer) return 0;
     
+    if (_line_mode && terminator == _line_terminator) {
+        int len = readLine((char*)buffer, length, _timeout);
+        return (len >= 0) ? len : 0;
+    }
+    
     size_t index = 0;
     int c;
     while (index < length && (c = read()) >= 0) {
@@ -248,9 +342,113 @@ int HardwareSerial::readBytesUntil(char terminator, uint8_t *buffer, size_t leng
     return index;
 }
 
+void HardwareSerial::enableLineMode(char terminator, int patternQueueSize) {
+    _line_mode = true;
+    _line_terminator = terminator;
+    _pattern_queue_size = patternQueueSize;
+    if (_initialized) {
+        _enableLinePattern();
+    }
+}
+
+void HardwareSerial::disableLineMode() {
+    _line_mode = false;
+    if (_initialized) {
+        uart_disable_pattern_det_intr(_uart_num);
+    }
+}
+
+int HardwareSerial::readLine(char *buffer, size_t length) {
+    return readLine(buffer, length, _timeout);
+}
+
+int HardwareSerial::readLine(char *buffer, size_t length, unsigned long timeout_ms) {
+    if (!_initialized || !_line_mode || !buffer) return -1;
+    
+    if (_rx_overflow) _takeRxOverflow();
+    // peek() took the terminator's mark along with its byte
+    if (_peek_buffer_valid && _peek_buffer == (uint8_t)_line_terminator) {
+        _peek_buffer_valid = false;
+        return 0;
+    }
+    // Bytes kept across a buffer resize come first; the line may end in them
+    bool complete;
+    size_t carried = _carryLine(complete);
+    int pos = 0;
+    if (!complete) {
+        pos = _waitForLine(timeout_ms);
+        if (pos < 0) return -1;
+        // An overflow flushed while waiting took the carry with it
+        carried = _carryLine(complete);
+    }
+    
+    size_t index = 0;
+    if (_peek_buffer_valid) {
+        if (length > 0) {
+            buffer[index++] = _peek_buffer;
+        }
+        _peek_buffer_valid = false;
+    }
+    size_t taken = _readCarry((uint8_t*)buffer + index, std::min(carried, length - index));
+    index += taken;
+    bool truncated = taken < carried;
+    _readCarry(NULL, carried - taken + (complete ? 1 : 0));
+    
+    if (!complete) {
+        // The rest of the line is in the RX buffer already: copy it in one read
+        size_t copy = std::min((size_t)pos, length - index);
+        if (copy > 0) {
+            int len = uart_read_bytes(_uart_num, buffer + index, copy, pdMS_TO_TICKS(timeout_ms));
+            if (len > 0) {
+                index += len;
+                pos -= len;
+            }
+        }
+        truncated |= pos > 0;
+        _discardRx(pos + 1);
+    }
+    if (truncated) {
+        ESP_LOGW(TAG, "UART%d line truncated to %u bytes", _uart_num, (unsigned)length);
+    }
+    return index;
+}
+
+// Not from a callback: the task running it would have to stop itself
+void HardwareSerial::onReceive(OnReceiveCb function, size_t threshold) {
+    if (_rx_task && xTaskGetCurrentTaskHandle() == _rx_task) {
+        ESP_LOGE(TAG, "UART%d callbacks cannot be changed from its RX task", _uart_num);
+        return;
+    }
+    _stopRxTask();
+    _on_receive_cb = function;
+    _rx_threshold = threshold > 0 ? threshold : 1;
+    _startRxTask();
+}
+
+void HardwareSerial::onReceiveError(OnReceiveErrorCb function) {
+    if (_rx_task && xTaskGetCurrentTaskHandle() == _rx_task) {
+        ESP_LOGE(TAG, "UART%d callbacks cannot be changed from its RX task", _uart_num);
+        return;
+    }
+    _stopRxTask();
+    _on_receive_error_cb = function;
+    _startRxTask();
+}
+
+void HardwareSerial::resetRxStats() {
+    _stats = RxStats();
+}
+
+void HardwareSerial::resetHighWaterMarks() {
+    _rx_high_water = 0;
+    _tx_high_water = 0;
+}
+
 void HardwareSerial::setBaudRate(uint32_t baud) {
     if (!_initialized) return;
     
+    // Bytes still queued would go out at the new rate, garbled
+    uart_wait_tx_done(_uart_num, portMAX_DELAY);
     _baud = baud;
     uart_set_baudrate(_uart_num, baud);
 }
@@ -270,32 +468,51 @@ void HardwareSerial::setDebugOutput(bool enable) {
     }
 }
 
-void HardwareSerial::setRxBufferSize(size_t size) {
-    _rx_buffer_size = size;
-    if (_initialized) {
-        ESP_LOGW(TAG, "Buffer size change will take effect after next begin()");
+bool HardwareSerial::setRxBufferSize(size_t size) {
+    // The driver needs room for at least a FIFO's worth
+    if (size <= SOC_UART_FIFO_LEN) {
+        ESP_LOGE(TAG, "UART%d RX buffer must exceed %d bytes", _uart_num, SOC_UART_FIFO_LEN);
+        return false;
+    }
+    if (!_initialized) {
+        _rx_buffer_size = size;
+        return true;
     }
+    if ((int)size == _rx_buffer_size) return true;
+    return _reinstallDriver(size, _tx_buffer_size);
 }
 
-void HardwareSerial::setTxBufferSize(size_t size) {
-    _tx_buffer_size = size;
-    if (_initialized) {
-        ESP_LOGW(TAG, "Buffer size change will take effect after next begin()");
+bool HardwareSerial::setTxBufferSize(size_t size) {
+    if (size > 0 && size <= SOC_UART_FIFO_LEN) {
+        ESP_LOGE(TAG, "UART%d TX buffer must be 0 or exceed %d bytes", _uart_num, SOC_UART_FIFO_LEN);
+        return false;
     }
+    // An RX-only port has no TX buffer to resize
+    if (!_initialized || _rx_only) {
+        _tx_buffer_size = size;
+        return true;
+    }
+    if ((int)size == _tx_buffer_size) return true;
+    return _reinstallDriver(_rx_buffer_size, size);
 }
 
 void HardwareSerial::setHwFlowCtrlMode(uart_hw_flowcontrol_t mode, uint8_t threshold) {
     if (!_initialized) return;
-    uart_set_hw_flow_ctrl(_uart_num, mode, threshold);
+    if (uart_set_hw_flow_ctrl(_uart_num, mode, threshold) == ESP_OK) {
+        _flow_ctrl = mode;
+        _rx_flow_ctrl_thresh = threshold;
+    }
 }
 
 void HardwareSerial::setPins(int8_t rxPin, int8_t txPin, int8_t ctsPin, int8_t rtsPin) {
-    _rx_pin = rxPin;
-    _tx_pin = txPin;
-    _cts_pin = ctsPin;
-    _rts_pin = rtsPin;
+    if (rxPin >= 0) _rx_pin = rxPin;
+    if (txPin >= 0) _tx_pin = txPin;
+    if (ctsPin >= 0) _cts_pin = ctsPin;
+    if (rtsPin >= 0) _rts_pin = rtsPin;
     
     if (_initialized) {
+        // Let pending output finish on the pins it started on
+        uart_wait_tx_done(_uart_num, portMAX_DELAY);
         uart_set_pin(_uart_num, _tx_pin, _rx_pin, _rts_pin, _cts_pin);
     }
 }
@@ -304,15 +521,25 @@ void HardwareSerial::setRxInvert(bool invert) {
     if (!_initialized) return;
     
     if (invert) {
-        uart_set_line_inverse(_uart_num, UART_SIGNAL_RXD_INV);
+        _inverse |= UART_SIGNAL_RXD_INV;
     } else {
-        uart_disable_intr_mask(_uart_num, UART_SIGNAL_RXD_INV);
+        _inverse &= ~UART_SIGNAL_RXD_INV;
     }
+    uart_set_line_inverse(_uart_num, _inverse);
 }
 
-void HardwareSerial::setRxTimeout(uint8_t timeout) {
-    if (!_initialized) return;
-    uart_set_rx_timeout(_uart_num, timeout);
+bool HardwareSerial::setRxTimeout(uint8_t timeout) {
+    if (!_initialized) return false;
+    if (uart_set_rx_timeout(_uart_num, timeout) != ESP_OK) return false;
+    _rx_timeout = timeout;
+    return true;
+}
+
+bool HardwareSerial::setMode(uart_mode_t mode) {
+    if (!_initialized) return false;
+    if (uart_set_mode(_uart_num, mode) != ESP_OK) return false;
+    _uart_mode = mode;
+    return true;
 }
 
 bool HardwareSerial::isConnected() {
@@ -331,6 +558,334 @@ HardwareSerial::operator bool() const {
 }
 
 // Private helper methods
+void HardwareSerial::_configureUart() {
+    uart_config_t uart_config = {
+        .baud_rate = (int)_baud,
+        .data_bits = _getDataBits(_config),
+        .parity = _getParity(_config),
+        .stop_bits = _getStopBits(_config),
+        .flow_ctrl = _flow_ctrl,
+        .rx_flow_ctrl_thresh = _rx_flow_ctrl_thresh,
+        .source_clk = UART_SCLK_DEFAULT,
+        .flags = {
+            .backup_before_sleep = 0
+        },
+    };
+    
+    ESP_ERROR_CHECK(uart_param_config(_uart_num, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(_uart_num, _tx_pin, _rx_pin, _rts_pin, _cts_pin));
+    if (_inverse) {
+        uart_set_line_inverse(_uart_num, _inverse);
+    }
+}
+
+esp_err_t HardwareSerial::_installDriver(int tx_buffer_size) {
+    esp_err_t err = uart_driver_install(_uart_num, _rx_buffer_size, tx_buffer_size, _event_queue_size, &_event_queue, 0);
+    if (err != ESP_OK) return err;
+    if (_line_mode) {
+        _enableLinePattern();
+    }
+    return ESP_OK;
+}
+
+// The driver's ring buffers are sized at install, so a new size takes a new
+// driver. Nothing buffered is lost: output is sent first, and unread input is
+// moved to the carry buffer, which the read methods empty before the driver's.
+bool HardwareSerial::_reinstallDriver(int rx_buffer_size, int tx_buffer_size) {
+    if (_rx_task && xTaskGetCurrentTaskHandle() == _rx_task) {
+        ESP_LOGE(TAG, "UART%d buffers cannot be resized from its RX task", _uart_num);
+        return false;
+    }
+    uart_wait_tx_done(_uart_num, portMAX_DELAY);
+    _stopRxTask();
+    
+    size_t buffered = 0;
+    uart_get_buffered_data_len(_uart_num, &buffered);
+    if (buffered > 0) {
+        size_t kept = _carryAvailable();
+        uint8_t *carry = (uint8_t*)malloc(kept + buffered);
+        if (!carry) {
+            ESP_LOGE(TAG, "UART%d no memory to keep %u buffered bytes", _uart_num, (unsigned)buffered);
+            _startRxTask();
+            return false;
+        }
+        if (kept > 0) {
+            memcpy(carry, _carry + _carry_pos, kept);
+        }
+        int len = uart_read_bytes(_uart_num, carry + kept, buffered, 0);
+        free(_carry);
+        _carry = carry;
+        _carry_len = kept + (len > 0 ? len : 0);
+        _carry_pos = 0;
+    }
+    
+    uart_driver_delete(_uart_num);
+    _event_queue = NULL;
+    int old_rx_size = _rx_buffer_size;
+    int old_tx_size = _tx_buffer_size;
+    _rx_buffer_size = rx_buffer_size;
+    _tx_buffer_size = tx_buffer_size;
+    
+    // The UART comes back from reset: program it again, as it was
+    _configureUart();
+    esp_err_t err = _installDriver(_rx_only ? 0 : _tx_buffer_size);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "UART%d buffers of %d/%d bytes unavailable: %s", _uart_num, rx_buffer_size, tx_buffer_size, esp_err_to_name(err));
+        _rx_buffer_size = old_rx_size;
+        _tx_buffer_size = old_tx_size;
+        ESP_ERROR_CHECK(_installDriver(_rx_only ? 0 : _tx_buffer_size));
+    }
+    if (_rx_timeout) {
+        uart_set_rx_timeout(_uart_num, _rx_timeout);
+    }
+    if (_uart_mode != UART_MODE_UART) {
+        uart_set_mode(_uart_num, _uart_mode);
+    }
+    
+    _startRxTask();
+    // Tell onReceive() about what was carried over, as if it had just arrived
+    if (_rx_task && _carryAvailable() > 0) {
+        uart_event_t event = {};
+        event.type = UART_DATA;
+        event.timeout_flag = true;
+        xQueueSend(_event_queue, &event, 0);
+    }
+    ESP_LOGD(TAG, "UART%d buffers resized: rx=%d, tx=%d", _uart_num, _rx_buffer_size, _tx_buffer_size);
+    return err == ESP_OK;
+}
+
+size_t HardwareSerial::_readCarry(uint8_t *buffer, size_t length) {
+    length = std::min(length, _carryAvailable());
+    if (length == 0) return 0;
+    if (buffer) {
+        memcpy(buffer, _carry + _carry_pos, length);
+    }
+    _carry_pos += length;
+    if (_carry_pos == _carry_len) {
+        free(_carry);
+        _carry = NULL;
+        _carry_len = 0;
+        _carry_pos = 0;
+    }
+    return length;
+}
+
+// Length of the line at the front of the carry buffer; complete if its
+// terminator is there too, else the line goes on in the driver's buffer
+size_t HardwareSerial::_carryLine(bool &complete) {
+    size_t carried = _carryAvailable();
+    if (carried == 0) {
+        complete = false;
+        return 0;
+    }
+    const uint8_t *start = _carry + _carry_pos;
+    const uint8_t *end = (const uint8_t*)memchr(start, _line_terminator, carried);
+    complete = end != NULL;
+    return end ? end - start : carried;
+}
+
+void HardwareSerial::_noteRxLevel(size_t buffered) {
+    if (buffered > _rx_high_water) {
+        _rx_high_water = buffered;
+    }
+}
+
+void HardwareSerial::_noteTxLevel() {
+    size_t free_size = 0;
+    if (_tx_buffer_size == 0 || uart_get_tx_buffer_free_size(_uart_num, &free_size) != ESP_OK) return;
+    size_t used = _tx_buffer_size - std::min(free_size, (size_t)_tx_buffer_size);
+    if (used > _tx_high_water) {
+        _tx_high_water = used;
+    }
+}
+
+void HardwareSerial::_enableLinePattern() {
+    // A single terminator, with no idle time required around it
+    uart_enable_pattern_det_baud_intr(_uart_num, _line_terminator, 1, 9, 0, 0);
+    uart_pattern_queue_reset(_uart_num, _pattern_queue_size);
+}
+
+int HardwareSerial::_waitForLine(unsigned long timeout_ms) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wait = pdMS_TO_TICKS(timeout_ms);
+    
+    // Events only wake us; the pattern queue says where each line ends
+    int pos;
+    while (true) {
+        if (_rx_overflow) _takeRxOverflow();
+        if ((pos = uart_pattern_pop_pos(_uart_num)) >= 0) break;
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= wait) {
+            return -1;
+        }
+        if (_rx_task) {
+            // The RX task takes the events and signals what they bring
+            xSemaphoreTake(_rx_signal, wait - elapsed);
+            continue;
+        }
+        uart_event_t event;
+        if (xQueueReceive(_event_queue, &event, wait - elapsed) != pdTRUE) {
+            return -1;
+        }
+        _handleRxEvent(event);
+    }
+    return pos;
+}
+
+void HardwareSerial::_discardRx(size_t count) {
+    uint8_t scratch[32];
+    while (count > 0) {
+        int len = uart_read_bytes(_uart_num, scratch, std::min(count, sizeof(scratch)), pdMS_TO_TICKS(10));
+        if (len <= 0) break;
+        count -= len;
+    }
+}
+
+// Bytes were lost, so the line being received is incomplete: start over. The
+// driver's buffer and queues are flushed at once; the carry and the peeked
+// byte belong to the reading task, so from the RX task they are only flagged
+// and dropped by the next read.
+void HardwareSerial::_recoverRxOverflow() {
+    ESP_LOGW(TAG, "UART%d RX overflow, input flushed", _uart_num);
+    uart_flush_input(_uart_num);
+    xQueueReset(_event_queue);
+    if (_line_mode) {
+        uart_pattern_queue_reset(_uart_num, _pattern_queue_size);
+    }
+    if (_rx_task && xTaskGetCurrentTaskHandle() == _rx_task) {
+        _rx_overflow = true;
+        // Wake a readLine() waiting on the task to drop them
+        xSemaphoreGive(_rx_signal);
+    } else {
+        _takeRxOverflow();
+    }
+}
+
+// Reading task: drops what was read ahead of an overflow
+void HardwareSerial::_takeRxOverflow() {
+    _rx_overflow = false;
+    _readCarry(NULL, _carryAvailable());
+    _peek_buffer_valid = false;
+}
+
+void HardwareSerial::_handleRxEvent(const uart_event_t &event) {
+    switch (event.type) {
+        case UART_DATA:
+            _stats.rx_bytes += event.size;
+            break;
+        case UART_PATTERN_DET:
+            break;
+        case UART_FIFO_OVF:
+            _stats.fifo_overflows++;
+            // A line that lost bytes can never be delivered whole
+            if (_line_mode) {
+                _recoverRxOverflow();
+            }
+            _reportRxError(UART_FIFO_OVF_ERROR);
+            return;
+        case UART_BUFFER_FULL:
+            _stats.buffer_full++;
+            _noteRxLevel(_rx_buffer_size);
+            _reportRxError(UART_BUFFER_FULL_ERROR);
+            // Full without a terminator in it, nothing will ever drain it
+            if (_line_mode && uart_pattern_get_pos(_uart_num) < 0) {
+                _recoverRxOverflow();
+                return;
+            }
+            break;
+        case UART_FRAME_ERR:
+            _stats.frame_errors++;
+            _reportRxError(UART_FRAME_ERROR);
+            return;
+        case UART_PARITY_ERR:
+            _stats.parity_errors++;
+            _reportRxError(UART_PARITY_ERROR);
+            return;
+        case UART_BREAK:
+            _stats.breaks++;
+            _reportRxError(UART_BREAK_ERROR);
+            return;
+        default:
+            return;
+    }
+    
+    // Data arrived: wake a reader, then the callback if enough is buffered
+    if (_rx_signal) {
+        xSemaphoreGive(_rx_signal);
+    }
+    size_t buffered = 0;
+    uart_get_buffered_data_len(_uart_num, &buffered);
+    _noteRxLevel(buffered);
+    if (_on_receive_cb) {
+        buffered += _carryAvailable();
+        if (_peek_buffer_valid) buffered++;
+        bool idle = event.type == UART_DATA && event.timeout_flag;
+        if (buffered >= _rx_threshold || (idle && buffered > 0)) {
+            _on_receive_cb();
+        }
+    }
+}
+
+void HardwareSerial::_reportRxError(hardwareSerial_error_t error) {
+    if (_on_receive_error_cb) {
+        _on_receive_error_cb(error);
+    }
+}
+
+void HardwareSerial::_startRxTask() {
+    if (!_initialized || _rx_task || (!_on_receive_cb && !_on_receive_error_cb)) return;
+    
+    if (!_rx_signal) {
+        _rx_signal = xSemaphoreCreateBinary();
+    }
+    if (!_rx_stopped) {
+        _rx_stopped = xSemaphoreCreateBinary();
+    }
+    _rx_stop = false;
+    TaskHandle_t task = NULL;
+    if (xTaskCreate(_rxTask, "uart_rx", SERIAL_RX_TASK_STACK_SIZE, this, SERIAL_RX_TASK_PRIORITY, &task) != pdPASS) {
+        ESP_LOGE(TAG, "UART%d failed to start RX task", _uart_num);
+        return;
+    }
+    _rx_task = task;
+}
+
+void HardwareSerial::_stopRxTask() {
+    if (!_rx_task) return;
+    if (xTaskGetCurrentTaskHandle() == _rx_task) {
+        ESP_LOGE(TAG, "UART%d RX task cannot stop itself", _uart_num);
+        return;
+    }
+    
+    // The flag tells the task to exit, an event of no UART type wakes it. The
+    // event may be lost to an overflow recovery resetting the queue, so the
+    // task also looks at the flag every SERIAL_RX_TASK_POLL_MS; one it never
+    // took is ignored by whoever takes events next.
+    _rx_stop = true;
+    uart_event_t stop = {};
+    stop.type = UART_EVENT_MAX;
+    xQueueSend(_event_queue, &stop, 0);
+    xSemaphoreTake(_rx_stopped, portMAX_DELAY);
+    _rx_task = NULL;
+    // Let a readLine() waiting on the task go back to the event queue
+    xSemaphoreGive(_rx_signal);
+}
+
+void HardwareSerial::_rxTask(void *arg) {
+    HardwareSerial *self = (HardwareSerial*)arg;
+    uart_event_t event;
+    
+    while (!self->_rx_stop) {
+        if (xQueueReceive(self->_event_queue, &event, pdMS_TO_TICKS(SERIAL_RX_TASK_POLL_MS)) == pdTRUE) {
+            self->_handleRxEvent(event);
+        }
+    }
+    
+    // Nothing of the object is touched once the stopping task may go on
+    xSemaphoreGive(self->_rx_stopped);
+    vTaskDelete(NULL);
+}
+
 uart_word_length_t HardwareSerial::_getDataBits(uint32_t config) {
     switch (config & 0x07) {
         case 0x00: return UART_DATA_5_BITS;
@@ -6,9 +6,24 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "Stream.h" 
 #include "WString.h"
+#include <functional>
+
+// Task that runs onReceive() and onReceiveError() callbacks, one per port
+#ifndef SERIAL_RX_TASK_STACK_SIZE
+#define SERIAL_RX_TASK_STACK_SIZE 4096
+#endif
+#ifndef SERIAL_RX_TASK_PRIORITY
+#define SERIAL_RX_TASK_PRIORITY 12
+#endif
+// How often an idle RX task checks it is asked to stop
+#ifndef SERIAL_RX_TASK_POLL_MS
+#define SERIAL_RX_TASK_POLL_MS 100
+#endif
+
 #define SERIAL_5N1 0x00
 #define SERIAL_6N1 0x02
 #define SERIAL_7N1 0x04
@@ -34,7 +49,31 @@
 #define SERIAL_7O2 0x3C
 #define SERIAL_8O2 0x3E
 
+typedef enum {
+    UART_NO_ERROR,
+    UART_BREAK_ERROR,
+    UART_BUFFER_FULL_ERROR,
+    UART_FIFO_OVF_ERROR,
+    UART_FRAME_ERROR,
+    UART_PARITY_ERROR
+} hardwareSerial_error_t;
+
+typedef std::function<void(void)> OnReceiveCb;
+typedef std::function<void(hardwareSerial_error_t)> OnReceiveErrorCb;
+
 class HardwareSerial : public Stream {
+public:
+    // Counted from the driver's events while an onReceive() task or readLine()
+    // is taking them
+    struct RxStats {
+        uint32_t rx_bytes;
+        uint32_t fifo_overflows;    // bytes lost in the hardware FIFO
+        uint32_t buffer_full;       // RX ring buffer filled up
+        uint32_t frame_errors;
+        uint32_t parity_errors;
+        uint32_t breaks;
+    };
+
 private:
     uart_port_t _uart_num;
     int _tx_pin;
@@ -46,11 +85,55 @@ private:
     bool _initialized;
     int _rx_buffer_size;
     int _tx_buffer_size;
+    bool _rx_only;
+    uint32_t _inverse;
+    uart_hw_flowcontrol_t _flow_ctrl;
+    uint8_t _rx_flow_ctrl_thresh;
+    uint8_t _rx_timeout;
+    uart_mode_t _uart_mode;
     static const char* TAG;
     uint8_t _peek_buffer;
     bool _peek_buffer_valid;
+    QueueHandle_t _event_queue;
+    int _event_queue_size;
+    bool _line_mode;
+    char _line_terminator;
+    int _pattern_queue_size;
+    OnReceiveCb _on_receive_cb;
+    OnReceiveErrorCb _on_receive_error_cb;
+    size_t _rx_threshold;
+    TaskHandle_t volatile _rx_task;
+    volatile bool _rx_stop;         // asks the RX task to exit
+    SemaphoreHandle_t _rx_stopped;  // given by the RX task as it exits
+    SemaphoreHandle_t _rx_signal;
+    volatile bool _rx_overflow;     // set by the RX task, taken by the next read
+    RxStats _stats;
+    size_t _rx_high_water;
+    size_t _tx_high_water;
+    // Received bytes kept across a driver reinstall, read before the driver's
+    uint8_t *_carry;
+    size_t _carry_len;
+    size_t _carry_pos;
     
     void _updateConfig();
+    void _configureUart();
+    esp_err_t _installDriver(int tx_buffer_size);
+    bool _reinstallDriver(int rx_buffer_size, int tx_buffer_size);
+    size_t _carryAvailable() const { return _carry_len - _carry_pos; }
+    size_t _readCarry(uint8_t *buffer, size_t length);
+    size_t _carryLine(bool &complete);
+    void _noteRxLevel(size_t buffered);
+    void _noteTxLevel();
+    void _enableLinePattern();
+    int _waitForLine(unsigned long timeout_ms);
+    void _discardRx(size_t count);
+    void _takeRxOverflow();
+    void _recoverRxOverflow();
+    void _handleRxEvent(const uart_event_t &event);
+    void _reportRxError(hardwareSerial_error_t error);
+    void _startRxTask();
+    void _stopRxTask();
+    static void _rxTask(void *arg);
     uart_word_length_t _getDataBits(uint32_t config);
     uart_stop_bits_t _getStopBits(uint32_t config);
     uart_parity_t _getParity(uint32_t config);
@@ -80,18 +163,60 @@ public:
     int readBytesUntil(char terminator, char *buffer, size_t length);
     int readBytesUntil(char terminator, uint8_t *buffer, size_t length);
     
+    // Line mode: the UART's pattern detection marks each terminator as it
+    // arrives, so a whole line is taken from the RX buffer in one read
+    // instead of byte by byte. Can be set before or after begin().
+    // readStringUntil() and readBytesUntil() with the same terminator then
+    // wait up to the stream timeout for a whole line.
+    void enableLineMode(char terminator = '\n', int patternQueueSize = 32);
+    void disableLineMode();
+    // Waits up to timeout_ms for a complete line and copies it, without its
+    // terminator, to buffer. Returns its length, or -1 on timeout. A line
+    // longer than length is truncated and the rest of it dropped.
+    int readLine(char *buffer, size_t length, unsigned long timeout_ms);
+    int readLine(char *buffer, size_t length);
+    
+    // Calls function from a task of the port's own when at least threshold
+    // bytes are buffered, or when the line goes idle (see setRxTimeout) with
+    // any buffered. NULL stops it. Do not call end() from the callbacks.
+    void onReceive(OnReceiveCb function, size_t threshold = 1);
+    void onReceiveError(OnReceiveErrorCb function);
+    RxStats getRxStats() { return _stats; }
+    void resetRxStats();
+    
+    // Most bytes seen waiting in the RX and TX ring buffers since begin() or
+    // the last reset, for sizing them. The RX level is sampled by available()
+    // and by the driver events an onReceive() task or readLine() takes; an RX
+    // mark at the buffer size means it filled up.
+    size_t getRxHighWaterMark() { return _rx_high_water; }
+    size_t getTxHighWaterMark() { return _tx_high_water; }
+    void resetHighWaterMarks();
+    
     // Configuration methods
+    // Waits for pending output to go out at the old rate first
     void setBaudRate(uint32_t baud);
     uint32_t baudRate();
     void setDebugOutput(bool);
     
     // ESP32 specific methods
-    void setRxBufferSize(size_t size);
-    void setTxBufferSize(size_t size);
+    // Sizes must exceed the hardware FIFO (a TX size of 0 makes write() block
+    // until sent). On a running port the driver is reinstalled with the new
+    // size: pending output is sent first and received bytes not yet read are
+    // kept and read ahead of new ones. Bytes arriving during the swap itself
+    // may be lost, so resize while the line is quiet or flow-controlled.
+    // Returns false, keeping the old size, if the new one cannot be had.
+    bool setRxBufferSize(size_t size);
+    bool setTxBufferSize(size_t size);
     void setHwFlowCtrlMode(uart_hw_flowcontrol_t mode, uint8_t threshold = 64);
+    // -1 leaves a pin as it is. Waits for pending output to go out first.
     void setPins(int8_t rxPin, int8_t txPin, int8_t ctsPin = -1, int8_t rtsPin = -1);
     void setRxInvert(bool invert);
-    void setRxTimeout(uint8_t timeout);
+    // In symbols (character times). The hardware limit depends on the chip and
+    // the baud rate; false if timeout is beyond it.
+    bool setRxTimeout(uint8_t timeout);
+    // UART_MODE_RS485_HALF_DUPLEX drives a transceiver's DE from the RTS pin
+    // while sending. After begin().
+    bool setMode(uart_mode_t mode);
     
     // Status methods
     bool isConnected();
@@ -102,6 +227,7 @@ public:
     
     // Low level access
     uart_port_t getUartNum() { return _uart_num; }
+    QueueHandle_t getEventQueue() { return _event_queue; }
 };
 
 // Global instances for compatibility
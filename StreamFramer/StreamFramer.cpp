@@ -0,0 +1,378 @@
+#include "StreamFramer.h"
+#include "esp_log.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+
+const char* StreamFramer::TAG = "StreamFramer";
+
+// CRC-16/CCITT-FALSE, a byte per table lookup
+static constexpr std::array<uint16_t, 256> CRC16_TABLE = [] {
+    std::array<uint16_t, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = i << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+static uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF) {
+    while (length--) {
+        crc = (crc << 8) ^ CRC16_TABLE[(crc >> 8) ^ *data++];
+    }
+    return crc;
+}
+
+// Collects encoded bytes so they reach the stream in writes of a chunk
+namespace {
+class FrameWriter {
+public:
+    explicit FrameWriter(Stream &stream) : _stream(stream), _used(0), _ok(true) {}
+
+    void put(uint8_t byte) {
+        _buffer[_used++] = byte;
+        if (_used == sizeof(_buffer)) {
+            flush();
+        }
+    }
+
+    bool flush() {
+        if (_used > 0 && _stream.write(_buffer, _used) != _used) {
+            _ok = false;
+        }
+        _used = 0;
+        return _ok;
+    }
+
+private:
+    Stream &_stream;
+    uint8_t _buffer[64];
+    size_t _used;
+    bool _ok;
+};
+}
+
+StreamFramer::StreamFramer(Stream &stream, Mode mode, size_t maxFrameSize, int poolSize) :
+    _stream(stream),
+    _mode(mode),
+    _max_frame_size(maxFrameSize),
+    _pool_size(poolSize),
+    _crc(mode == Mode::LengthCrc),
+    _pool(NULL),
+    _free_frames(NULL),
+    _ready_frames(NULL),
+    _stats()
+{
+    _resetDecoder();
+}
+
+StreamFramer::~StreamFramer() {
+    end();
+}
+
+bool StreamFramer::begin() {
+    end();
+
+    // Room for a CRC after the largest frame
+    size_t capacity = _max_frame_size + 2;
+    _pool = (uint8_t*)malloc(capacity * _pool_size);
+    _free_frames = xQueueCreate(_pool_size, sizeof(uint8_t*));
+    _ready_frames = xQueueCreate(_pool_size, sizeof(Frame));
+    if (!_pool || !_free_frames || !_ready_frames) {
+        ESP_LOGE(TAG, "Failed to allocate %d frames of %u bytes", _pool_size, (unsigned)_max_frame_size);
+        end();
+        return false;
+    }
+    for (int i = 0; i < _pool_size; i++) {
+        uint8_t *buffer = _pool + i * capacity;
+        xQueueSend(_free_frames, &buffer, 0);
+    }
+    _resetDecoder();
+    return true;
+}
+
+void StreamFramer::end() {
+    if (_free_frames) vQueueDelete(_free_frames);
+    if (_ready_frames) vQueueDelete(_ready_frames);
+    free(_pool);
+    _free_frames = NULL;
+    _ready_frames = NULL;
+    _pool = NULL;
+    _frame = NULL;
+}
+
+void StreamFramer::setCrc(bool enable) {
+    _crc = enable || _mode == Mode::LengthCrc;
+}
+
+void StreamFramer::onFrame(FrameCallback cb) {
+    _callback = cb;
+}
+
+size_t StreamFramer::writeFrame(const uint8_t *data, size_t length) {
+    if (!data || length == 0 || length > _max_frame_size) return 0;
+
+    uint8_t header[2] = { (uint8_t)(length & 0xFF), (uint8_t)(length >> 8) };
+    uint16_t crc = 0;
+    if (_mode == Mode::LengthCrc) {
+        crc = crc16(data, length, crc16(header, sizeof(header)));
+    } else if (_crc) {
+        crc = crc16(data, length);
+    }
+    uint8_t trailer[2] = { (uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8) };
+    size_t total = length + (_crc ? sizeof(trailer) : 0);
+    auto at = [&](size_t i) { return i < length ? data[i] : trailer[i - length]; };
+
+    FrameWriter out(_stream);
+    switch (_mode) {
+        case Mode::Slip:
+            // A leading END flushes any line noise the receiver has collected
+            out.put(SLIP_END);
+            for (size_t i = 0; i < total; i++) {
+                uint8_t byte = at(i);
+                if (byte == SLIP_END) {
+                    out.put(SLIP_ESC);
+                    out.put(SLIP_ESC_END);
+                } else if (byte == SLIP_ESC) {
+                    out.put(SLIP_ESC);
+                    out.put(SLIP_ESC_ESC);
+                } else {
+                    out.put(byte);
+                }
+            }
+            out.put(SLIP_END);
+            break;
+
+        case Mode::Cobs: {
+            // Blocks of up to 254 non-zero bytes, each led by its length + 1;
+            // a block shorter than 254 stands for a zero after it. A leading
+            // delimiter flushes line noise, as with SLIP.
+            out.put(0x00);
+            size_t pos = 0;
+            while (true) {
+                size_t run = 0;
+                while (pos + run < total && run < 254 && at(pos + run) != 0) run++;
+                out.put(run + 1);
+                for (size_t i = 0; i < run; i++) {
+                    out.put(at(pos + i));
+                }
+                pos += run;
+                if (pos >= total) break;
+                if (run < 254) pos++;
+            }
+            out.put(0x00);
+            break;
+        }
+
+        case Mode::LengthCrc:
+            out.put(LENGTH_SOF);
+            out.put(header[0]);
+            out.put(header[1]);
+            for (size_t i = 0; i < total; i++) {
+                out.put(at(i));
+            }
+            break;
+    }
+    return out.flush() ? length : 0;
+}
+
+int StreamFramer::poll() {
+    int frames = 0;
+    uint8_t chunk[128];
+    int available;
+    while ((available = _stream.available()) > 0) {
+        size_t len = _stream.readBytes(chunk, std::min((size_t)available, sizeof(chunk)));
+        if (len == 0) break;
+        frames += feed(chunk, len);
+    }
+    return frames;
+}
+
+int StreamFramer::feed(const uint8_t *data, size_t length) {
+    if (!_pool) return 0;
+
+    uint32_t before = _stats.frames;
+    for (size_t i = 0; i < length; i++) {
+        switch (_mode) {
+            case Mode::Slip: _decodeSlip(data[i]); break;
+            case Mode::Cobs: _decodeCobs(data[i]); break;
+            case Mode::LengthCrc: _decodeLength(data[i]); break;
+        }
+    }
+    return _stats.frames - before;
+}
+
+bool StreamFramer::readFrame(Frame &frame, TickType_t wait) {
+    if (!_ready_frames) return false;
+    return xQueueReceive(_ready_frames, &frame, wait) == pdTRUE;
+}
+
+void StreamFramer::releaseFrame(const Frame &frame) {
+    if (!_free_frames || !frame.data) return;
+    xQueueSend(_free_frames, &frame.data, 0);
+}
+
+void StreamFramer::resetStats() {
+    _stats = Stats();
+}
+
+// Private helper methods
+void StreamFramer::_decodeSlip(uint8_t byte) {
+    if (byte == SLIP_END) {
+        _endFrame();
+        return;
+    }
+    if (_escaped) {
+        _escaped = false;
+        if (byte == SLIP_ESC_END) {
+            byte = SLIP_END;
+        } else if (byte == SLIP_ESC_ESC) {
+            byte = SLIP_ESC;
+        } else {
+            _discard(_stats.framing_errors);
+            return;
+        }
+    } else if (byte == SLIP_ESC) {
+        _escaped = true;
+        return;
+    }
+    _putByte(byte);
+}
+
+void StreamFramer::_decodeCobs(uint8_t byte) {
+    if (byte == 0x00) {
+        // A delimiter inside a block means bytes were lost
+        if (_cobs_left != 0) {
+            _discard(_stats.framing_errors);
+        }
+        _endFrame();
+        return;
+    }
+    if (_cobs_left > 0) {
+        _putByte(byte);
+        _cobs_left--;
+        return;
+    }
+    // A code byte; the block before it, if short, stood for a zero
+    if (_cobs_code != 0 && _cobs_code != 0xFF) {
+        _putByte(0x00);
+    }
+    _cobs_code = byte;
+    _cobs_left = byte - 1;
+}
+
+void StreamFramer::_decodeLength(uint8_t byte) {
+    switch (_length_state) {
+        case LengthState::Sof:
+            // Anything else is noise between frames
+            if (byte == LENGTH_SOF) {
+                _length_state = LengthState::LengthLow;
+            }
+            break;
+
+        case LengthState::LengthLow:
+            _expected = byte;
+            _length_state = LengthState::LengthHigh;
+            break;
+
+        case LengthState::LengthHigh:
+            _expected |= byte << 8;
+            if (_expected == 0 || _expected > _max_frame_size) {
+                // Most likely a SOF in noise rather than a real frame
+                _stats.framing_errors++;
+                _length_state = LengthState::Sof;
+                break;
+            }
+            _remaining = _expected + 2;
+            _length_state = LengthState::Data;
+            break;
+
+        case LengthState::Data:
+            _putByte(byte);
+            if (--_remaining == 0) {
+                _endFrame();
+                _length_state = LengthState::Sof;
+            }
+            break;
+    }
+}
+
+void StreamFramer::_putByte(uint8_t byte) {
+    if (_discarding) return;
+
+    if (!_frame && xQueueReceive(_free_frames, &_frame, 0) != pdTRUE) {
+        _frame = NULL;
+        _discard(_stats.dropped);
+        return;
+    }
+    if (_length >= _max_frame_size + (_crc ? 2 : 0)) {
+        _discard(_stats.overruns);
+        return;
+    }
+    _frame[_length++] = byte;
+}
+
+void StreamFramer::_discard(uint32_t &counter) {
+    if (!_discarding) {
+        counter++;
+        _discarding = true;
+    }
+}
+
+void StreamFramer::_endFrame() {
+    size_t length = _length;
+
+    if (!_discarding && _frame && length > 0) {
+        if (_crc) {
+            if (length < 2) {
+                _stats.framing_errors++;
+                length = 0;
+            } else {
+                length -= 2;
+                uint16_t crc = 0xFFFF;
+                if (_mode == Mode::LengthCrc) {
+                    uint8_t header[2] = { (uint8_t)(length & 0xFF), (uint8_t)(length >> 8) };
+                    crc = crc16(header, sizeof(header));
+                }
+                crc = crc16(_frame, length, crc);
+                if (_frame[length] != (crc & 0xFF) || _frame[length + 1] != (crc >> 8)) {
+                    _stats.crc_errors++;
+                    length = 0;
+                }
+            }
+        }
+
+        if (length > 0) {
+            if (_callback) {
+                // The buffer is kept for the next frame
+                _callback(_frame, length);
+            } else {
+                Frame frame = { _frame, length };
+                xQueueSend(_ready_frames, &frame, 0);
+                _frame = NULL;
+            }
+            _stats.frames++;
+        }
+    }
+
+    _length = 0;
+    _discarding = false;
+    _escaped = false;
+    _cobs_code = 0;
+    _cobs_left = 0;
+}
+
+void StreamFramer::_resetDecoder() {
+    _frame = NULL;
+    _length = 0;
+    _discarding = false;
+    _escaped = false;
+    _cobs_code = 0;
+    _cobs_left = 0;
+    _length_state = LengthState::Sof;
+    _expected = 0;
+    _remaining = 0;
+}
@@ -0,0 +1,109 @@
+#ifndef STREAMFRAMER_H
+#define STREAMFRAMER_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "Stream.h"
+#include <functional>
+
+// Splits the bytes of a Stream into frames and writes frames to it. Input is
+// read in bulk and decoded as it arrives, straight into buffers from a pool
+// allocated by begin(); each frame is handed out whole, through a callback or
+// a queue. Empty frames are skipped.
+class StreamFramer {
+public:
+    enum class Mode {
+        Slip,       // RFC 1055: ends with END, END and ESC escaped in the data
+        Cobs,       // Consistent Overhead Byte Stuffing, ends with 0x00
+        LengthCrc   // SOF, u16 length, data, CRC-16 of length and data (little-endian)
+    };
+
+    struct Frame {
+        uint8_t *data;
+        size_t length;
+    };
+
+    struct Stats {
+        uint32_t frames;            // delivered
+        uint32_t crc_errors;
+        uint32_t framing_errors;    // malformed encoding
+        uint32_t overruns;          // longer than the frame size
+        uint32_t dropped;           // no free buffer to decode into
+    };
+
+    // Called from poll() or feed(); data is only valid during the call
+    using FrameCallback = std::function<void(const uint8_t *data, size_t length)>;
+
+    StreamFramer(Stream &stream, Mode mode, size_t maxFrameSize = 256, int poolSize = 4);
+    ~StreamFramer();
+
+    bool begin();
+    void end();
+
+    // A CRC-16 on each frame, for SLIP and COBS; LengthCrc always has one.
+    // Both ends must agree.
+    void setCrc(bool enable);
+    // Without a callback, frames wait in a queue for readFrame()
+    void onFrame(FrameCallback cb);
+
+    // Encodes and writes one frame; returns length, or 0 if the stream took
+    // less than all of it
+    size_t writeFrame(const uint8_t *data, size_t length);
+
+    // Decodes what the stream has available; returns the frames completed
+    int poll();
+    // Decodes bytes read some other way
+    int feed(const uint8_t *data, size_t length);
+
+    // Takes the oldest queued frame, waiting up to wait ticks. Its buffer
+    // stays out of the pool until releaseFrame(). Safe from another task.
+    bool readFrame(Frame &frame, TickType_t wait = 0);
+    void releaseFrame(const Frame &frame);
+
+    Stats getStats() const { return _stats; }
+    void resetStats();
+
+private:
+    static const char* TAG;
+    static constexpr uint8_t SLIP_END = 0xC0;
+    static constexpr uint8_t SLIP_ESC = 0xDB;
+    static constexpr uint8_t SLIP_ESC_END = 0xDC;
+    static constexpr uint8_t SLIP_ESC_ESC = 0xDD;
+    static constexpr uint8_t LENGTH_SOF = 0xA5;
+
+    enum class LengthState { Sof, LengthLow, LengthHigh, Data };
+
+    void _decodeSlip(uint8_t byte);
+    void _decodeCobs(uint8_t byte);
+    void _decodeLength(uint8_t byte);
+    void _putByte(uint8_t byte);
+    void _discard(uint32_t &counter);
+    void _endFrame();
+    void _resetDecoder();
+
+    Stream &_stream;
+    const Mode _mode;
+    const size_t _max_frame_size;
+    const int _pool_size;
+    bool _crc;
+    FrameCallback _callback;
+
+    uint8_t *_pool;
+    QueueHandle_t _free_frames;
+    QueueHandle_t _ready_frames;
+
+    // Decoder state
+    uint8_t *_frame;            // buffer being filled, from the pool
+    size_t _length;
+    bool _discarding;           // skipping to the end of a frame that cannot be kept
+    bool _escaped;              // SLIP: the last byte was ESC
+    uint8_t _cobs_code;         // COBS: code of the current block, 0 before the first
+    uint8_t _cobs_left;         // COBS: data bytes left in it
+    LengthState _length_state;
+    uint16_t _expected;         // LengthCrc: data bytes the header announced
+    size_t _remaining;          // LengthCrc: bytes left, CRC included
+
+    Stats _stats;
+};
+
+#endif // STREAMFRAMER_H
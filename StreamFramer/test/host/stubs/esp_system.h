@@ -0,0 +1,2 @@
+// Host build only: nothing stdlib_noniso needs from it
+#pragma once
@@ -0,0 +1,11 @@
+// Host build only: microseconds since the first call
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+
+inline int64_t esp_timer_get_time() {
+    using namespace std::chrono;
+    static const steady_clock::time_point start = steady_clock::now();
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
@@ -0,0 +1,26 @@
+// Host build only: the newlib extensions WString relies on
+#include <stdlib.h>
+
+static char *convert(unsigned long value, int negative, char *out, int radix) {
+    char digits[sizeof(value) * 8];
+    int count = 0;
+    do {
+        int digit = value % radix;
+        digits[count++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= radix;
+    } while (value);
+    char *p = out;
+    if (negative) *p++ = '-';
+    while (count) *p++ = digits[--count];
+    *p = 0;
+    return out;
+}
+
+char *itoa(int value, char *out, int radix) {
+    if (value < 0 && radix == 10) return convert(-(long)value, 1, out, radix);
+    return convert((unsigned)value, 0, out, radix);
+}
+
+char *utoa(unsigned value, char *out, int radix) {
+    return convert(value, 0, out, radix);
+}
@@ -0,0 +1,184 @@
+// Host tests for StreamFramer over an in-memory loopback Stream.
+//
+//   make -C StreamFramer/test/host
+//
+// For every mode, with and without a CRC: random frames full of the bytes
+// each encoding has to escape round-trip through writeFrame() and poll(), in
+// callback and queue mode; then a corrupted frame, line noise and an overlong
+// frame must each cost at most that frame, never the one after it.
+
+#include "StreamFramer.h"
+#include <deque>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+static int fails = 0;
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+// What is written can be read back, in order
+class LoopbackStream : public Stream {
+public:
+    int available() override { return _bytes.size(); }
+    int read() override {
+        if (_bytes.empty()) return -1;
+        int byte = _bytes.front();
+        _bytes.pop_front();
+        return byte;
+    }
+    int peek() override { return _bytes.empty() ? -1 : _bytes.front(); }
+    size_t write(uint8_t byte) override {
+        _bytes.push_back(byte);
+        return 1;
+    }
+    size_t write(const uint8_t *buffer, size_t size) override {
+        _bytes.insert(_bytes.end(), buffer, buffer + size);
+        return size;
+    }
+    void flush() override {}
+
+    // Written and not yet read, for corrupting in place
+    std::deque<uint8_t> &bytes() { return _bytes; }
+
+private:
+    std::deque<uint8_t> _bytes;
+};
+
+static const char *modeName(StreamFramer::Mode mode) {
+    switch (mode) {
+        case StreamFramer::Mode::Slip: return "SLIP";
+        case StreamFramer::Mode::Cobs: return "COBS";
+        default: return "LengthCrc";
+    }
+}
+
+// Drains the queue; returns the frames equal to expected, and the others in other
+static int readFrames(StreamFramer &framer, const std::vector<uint8_t> &expected, int *other = nullptr) {
+    int matching = 0;
+    StreamFramer::Frame frame;
+    while (framer.readFrame(frame)) {
+        if (std::vector<uint8_t>(frame.data, frame.data + frame.length) == expected) {
+            matching++;
+        } else if (other) {
+            (*other)++;
+        }
+        framer.releaseFrame(frame);
+    }
+    return matching;
+}
+
+static void testRoundTrip(StreamFramer::Mode mode, bool crc) {
+    const size_t maxFrame = 600;
+    std::mt19937 rng(1);
+    LoopbackStream loopback;
+    StreamFramer framer(loopback, mode, maxFrame, 4);
+    framer.setCrc(crc);
+    CHECK(framer.begin());
+
+    std::vector<std::vector<uint8_t>> sent, received;
+    framer.onFrame([&](const uint8_t *data, size_t length) { received.emplace_back(data, data + length); });
+    for (int i = 0; i < 300; i++) {
+        std::vector<uint8_t> frame(1 + rng() % maxFrame);
+        for (uint8_t &byte : frame) {
+            static const uint8_t special[] = {0x00, 0xC0, 0xDB, 0xDC, 0xDD, 0xA5};
+            byte = rng() % 2 ? special[rng() % sizeof(special)] : rng();
+        }
+        // COBS block boundaries: runs of exactly 254 non-zero bytes, with and
+        // without a zero after them, and frames of zeros only
+        if (i % 7 == 0) frame.assign(frame.size(), 0);
+        if (i % 11 == 0) frame.assign(254 * (1 + i % 2), 0x55);
+        if (i % 13 == 0) {
+            frame.assign(254, 0x55);
+            frame.push_back(0);
+        }
+        CHECK(framer.writeFrame(frame.data(), frame.size()) == frame.size());
+        sent.push_back(frame);
+        // Decode mid-stream too, so frames split across polls
+        if (rng() % 3 == 0) framer.poll();
+    }
+    framer.poll();
+    CHECK(received == sent);
+    CHECK(framer.getStats().frames == 300);
+
+    // Queue mode: frames beyond the pool are dropped, not overwritten
+    framer.onFrame(nullptr);
+    const std::vector<uint8_t> small = {1, 2, 3, 4, 5};
+    for (int i = 0; i < 6; i++) framer.writeFrame(small.data(), small.size());
+    CHECK(framer.poll() == 4);
+    CHECK(framer.getStats().dropped == 2);
+    CHECK(readFrames(framer, small) == 4);
+}
+
+static void testCorruption(StreamFramer::Mode mode, bool crc) {
+    LoopbackStream loopback;
+    StreamFramer framer(loopback, mode, 64, 4);
+    framer.setCrc(crc);
+    CHECK(framer.begin());
+    const std::vector<uint8_t> frame = {1, 2, 3, 4, 5};
+    bool checked = crc || mode == StreamFramer::Mode::LengthCrc;
+
+    // A flipped data bit: caught by the CRC, else delivered as is; the next
+    // frame is intact either way
+    framer.writeFrame(frame.data(), frame.size());
+    loopback.bytes()[mode == StreamFramer::Mode::LengthCrc ? 5 : 3] ^= 0x01;
+    framer.writeFrame(frame.data(), frame.size());
+    framer.poll();
+    int other = 0;
+    CHECK(readFrames(framer, frame, &other) == 1);
+    if (checked) {
+        CHECK(other == 0 && framer.getStats().crc_errors == 1);
+    } else {
+        CHECK(other == 1);
+    }
+
+    // Line noise before a frame
+    framer.resetStats();
+    const uint8_t noise[] = {0x13, 0xA5, 0xFF, 0xFF, 0x22, 0xDB};
+    loopback.write(noise, sizeof(noise));
+    framer.writeFrame(frame.data(), frame.size());
+    framer.poll();
+    CHECK(readFrames(framer, frame) == 1);
+
+    // A frame cut short by a lost tail: at most that frame is lost
+    framer.resetStats();
+    framer.writeFrame(frame.data(), frame.size());
+    loopback.bytes().pop_back();
+    loopback.bytes().pop_back();
+    for (int i = 0; i < 3; i++) framer.writeFrame(frame.data(), frame.size());
+    framer.poll();
+    other = 0;
+    CHECK(readFrames(framer, frame, &other) >= 2);
+    if (checked) CHECK(other == 0);
+
+    // Longer than the frame size, from a sender allowed larger ones: counted
+    // and skipped whole. LengthCrc rejects it by its header, as it would a SOF
+    // in noise, and hunts for the next SOF.
+    framer.resetStats();
+    StreamFramer sender(loopback, mode, 128, 1);
+    sender.setCrc(crc);
+    std::vector<uint8_t> large(100, 0x42);
+    CHECK(sender.writeFrame(large.data(), large.size()) == large.size());
+    framer.writeFrame(frame.data(), frame.size());
+    framer.poll();
+    other = 0;
+    CHECK(readFrames(framer, frame, &other) == 1);
+    CHECK(other == 0);
+    if (mode == StreamFramer::Mode::LengthCrc) {
+        CHECK(framer.getStats().framing_errors == 1);
+    } else {
+        CHECK(framer.getStats().overruns == 1);
+    }
+}
+
+int main() {
+    for (StreamFramer::Mode mode : {StreamFramer::Mode::Slip, StreamFramer::Mode::Cobs, StreamFramer::Mode::LengthCrc}) {
+        for (bool crc : {false, true}) {
+            int before = fails;
+            testRoundTrip(mode, crc);
+            testCorruption(mode, crc);
+            printf("%s%s: %s\n", modeName(mode), crc ? " with CRC" : "", fails == before ? "ok" : "FAILED");
+        }
+    }
+    printf(fails ? "FAILED\n" : "all ok\n");
+    return fails != 0;
+}
@@ -22,9 +22,15 @@
 
 
 #include "StreamString.h"
+#include <algorithm>
 
 size_t StreamString::write(const uint8_t *data, size_t size) {
   if (size && data) {
+    // Drop what has been read before any growth, so the bytes read never
+    // count against the String's maximum capacity
+    if (_read_pos > 0 && length() + size + 1 > capacity()) {
+      compact();
+    }
     const unsigned int newlen = length() + size;
     if (reserve(newlen + 1)) {
       memcpy((void *)(wbuffer() + len()), (const void *)data, size);
@@ -37,28 +43,68 @@ size_t StreamString::write(const uint8_t *data, size_t size) {
 }
 
 size_t StreamString::write(uint8_t data) {
-  return concat((char)data);
+  return write(&data, 1);
 }
 
 int StreamString::available() {
-  return length();
+  return unread();
 }
 
 int StreamString::read() {
-  if (length()) {
-    char c = charAt(0);
-    remove(0, 1);
+  if (unread()) {
+    uint8_t c = buffer()[_read_pos];
+    consume(1);
     return c;
   }
   return -1;
 }
 
 int StreamString::peek() {
-  if (length()) {
-    char c = charAt(0);
-    return c;
+  if (unread()) {
+    return (uint8_t)buffer()[_read_pos];
   }
   return -1;
 }
 
 void StreamString::flush() {}
+
+size_t StreamString::readBytes(char *buffer, size_t length) {
+  unsigned int count = std::min(length, (size_t)unread());
+  if (count) {
+    memcpy(buffer, this->buffer() + _read_pos, count);
+    consume(count);
+  }
+  return count;
+}
+
+String StreamString::readString() {
+  if (_read_pos == 0) {
+    return String(std::move(static_cast<String &>(*this)));
+  }
+  String result(buffer() + _read_pos, unread());
+  consume(unread());
+  return result;
+}
+
+void StreamString::compact() {
+  if (_read_pos > 0) {
+    remove(0, _read_pos);
+    _read_pos = 0;
+  }
+}
+
+// The String may have been changed under the cursor through its own methods
+unsigned int StreamString::unread() {
+  _read_pos = std::min(_read_pos, length());
+  return length() - _read_pos;
+}
+
+void StreamString::consume(unsigned int count) {
+  _read_pos += count;
+  if (_read_pos >= length()) {
+    clear();
+    _read_pos = 0;
+  } else if (_read_pos >= length() / 2) {
+    compact();
+  }
+}
@@ -24,6 +24,12 @@
 #include "Stream.h"
 #include "WString.h"
 
+// A String that is also a Stream: writes append to it and reads take from
+// its front. Reads advance a cursor rather than removing each byte, so
+// draining N bytes costs O(N). The bytes read are dropped in one move once
+// they make up half of the string, and all at once when it has been read to
+// the end. Until then the String itself still holds them: call compact()
+// before using it as a String after a partial read.
 class StreamString : public Stream, public String {
 public:
   size_t write(const uint8_t *buffer, size_t size) override;
@@ -33,6 +39,23 @@ public:
   int read() override;
   int peek() override;
   void flush() override;
+
+  // Copy out what is there at once; there is never more to wait for
+  size_t readBytes(char *buffer, size_t length) override;
+  size_t readBytes(uint8_t *buffer, size_t length) override {
+    return readBytes((char *)buffer, length);
+  }
+  // Hands over the string itself, without a copy, if nothing was read yet
+  String readString() override;
+
+  // Drops the bytes read so far from the String
+  void compact();
+
+private:
+  unsigned int unread();
+  void consume(unsigned int count);
+
+  unsigned int _read_pos = 0;
 };
 
 #endif /* STREAMSTRING_H_ */
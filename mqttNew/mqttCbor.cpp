@@ -0,0 +1,408 @@
+#include "mqttCbor.hpp"
+#include <cstring>
+#include <cmath>
+
+namespace
+{
+    constexpr uint8_t MAJOR_UINT = 0;
+    constexpr uint8_t MAJOR_NINT = 1;
+    constexpr uint8_t MAJOR_BYTES = 2;
+    constexpr uint8_t MAJOR_TEXT = 3;
+    constexpr uint8_t MAJOR_ARRAY = 4;
+    constexpr uint8_t MAJOR_MAP = 5;
+    constexpr uint8_t MAJOR_TAG = 6;
+    constexpr uint8_t MAJOR_SIMPLE = 7;
+
+    constexpr uint8_t SIMPLE_FALSE = 20;
+    constexpr uint8_t SIMPLE_TRUE = 21;
+    constexpr uint8_t SIMPLE_NULL = 22;
+    constexpr uint8_t AI_HALF = 25;
+    constexpr uint8_t AI_FLOAT = 26;
+    constexpr uint8_t AI_DOUBLE = 27;
+
+    // Reads the head at p; returns the pointer past it or nullptr if truncated/unsupported
+    const uint8_t *readHead(const uint8_t *p, const uint8_t *end, uint8_t &major, uint8_t &ai, uint64_t &arg)
+    {
+        if (p >= end)
+            return nullptr;
+        major = *p >> 5;
+        ai = *p & 0x1f;
+        p++;
+        if (ai < 24)
+        {
+            arg = ai;
+            return p;
+        }
+        if (ai > 27)
+            return nullptr; // reserved or indefinite length
+        size_t n = (size_t)1 << (ai - 24);
+        if ((size_t)(end - p) < n)
+            return nullptr;
+        arg = 0;
+        for (size_t i = 0; i < n; ++i)
+            arg = (arg << 8) | p[i];
+        return p + n;
+    }
+
+    double halfToDouble(uint16_t h)
+    {
+        int exp = (h >> 10) & 0x1f;
+        int mant = h & 0x3ff;
+        double val;
+        if (exp == 0)
+            val = std::ldexp(mant, -24);
+        else if (exp != 31)
+            val = std::ldexp(mant + 1024, exp - 25);
+        else
+            val = mant == 0 ? INFINITY : NAN;
+        return (h & 0x8000) ? -val : val;
+    }
+}
+
+CborWriter::CborWriter(uint8_t *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+void CborWriter::reset()
+{
+    length = 0;
+    overflow = false;
+}
+
+void CborWriter::writeRaw(const void *src, size_t len)
+{
+    if (overflow || capacity - length < len)
+    {
+        overflow = true;
+        return;
+    }
+    memcpy(buffer + length, src, len);
+    length += len;
+}
+
+void CborWriter::writeHead(uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    size_t n;
+    major <<= 5;
+    if (value < 24)
+    {
+        head[0] = major | (uint8_t)value;
+        n = 1;
+    }
+    else if (value <= 0xff)
+    {
+        head[0] = major | 24;
+        n = 2;
+    }
+    else if (value <= 0xffff)
+    {
+        head[0] = major | 25;
+        n = 3;
+    }
+    else if (value <= 0xffffffffULL)
+    {
+        head[0] = major | 26;
+        n = 5;
+    }
+    else
+    {
+        head[0] = major | 27;
+        n = 9;
+    }
+    for (size_t i = n - 1; i >= 1; --i, value >>= 8)
+        head[i] = (uint8_t)value;
+    writeRaw(head, n);
+}
+
+CborWriter &CborWriter::beginArray(size_t count)
+{
+    writeHead(MAJOR_ARRAY, count);
+    return *this;
+}
+
+CborWriter &CborWriter::beginMap(size_t pairs)
+{
+    writeHead(MAJOR_MAP, pairs);
+    return *this;
+}
+
+CborWriter &CborWriter::writeUInt(uint64_t value)
+{
+    writeHead(MAJOR_UINT, value);
+    return *this;
+}
+
+CborWriter &CborWriter::writeInt(int64_t value)
+{
+    if (value < 0)
+        writeHead(MAJOR_NINT, (uint64_t)(-(value + 1)));
+    else
+        writeHead(MAJOR_UINT, (uint64_t)value);
+    return *this;
+}
+
+CborWriter &CborWriter::writeFloat(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t out[5] = {(MAJOR_SIMPLE << 5) | AI_FLOAT, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits};
+    writeRaw(out, sizeof(out));
+    return *this;
+}
+
+CborWriter &CborWriter::writeDouble(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t out[9];
+    out[0] = (MAJOR_SIMPLE << 5) | AI_DOUBLE;
+    for (int i = 8; i >= 1; --i, bits >>= 8)
+        out[i] = (uint8_t)bits;
+    writeRaw(out, sizeof(out));
+    return *this;
+}
+
+CborWriter &CborWriter::writeBool(bool value)
+{
+    writeHead(MAJOR_SIMPLE, value ? SIMPLE_TRUE : SIMPLE_FALSE);
+    return *this;
+}
+
+CborWriter &CborWriter::writeNull()
+{
+    writeHead(MAJOR_SIMPLE, SIMPLE_NULL);
+    return *this;
+}
+
+CborWriter &CborWriter::writeText(const char *text)
+{
+    return writeText(text, strlen(text));
+}
+
+CborWriter &CborWriter::writeText(const char *text, size_t len)
+{
+    writeHead(MAJOR_TEXT, len);
+    writeRaw(text, len);
+    return *this;
+}
+
+CborWriter &CborWriter::writeText(const String &text)
+{
+    return writeText(text.c_str(), text.length());
+}
+
+CborWriter &CborWriter::writeBytes(const uint8_t *data, size_t len)
+{
+    writeHead(MAJOR_BYTES, len);
+    writeRaw(data, len);
+    return *this;
+}
+
+CborValue::CborValue(Type kind, const uint8_t *item, const uint8_t *payload, const uint8_t *end, uint64_t arg)
+    : kind(kind), item(item), payload(payload), end(end), arg(arg) {}
+
+CborValue CborValue::parse(const uint8_t *data, size_t len)
+{
+    if (!data || len == 0)
+        return CborValue();
+    const uint8_t *end = data + len;
+    if (skip(data, end, 0) != end)
+        return CborValue();
+    return decode(data, end);
+}
+
+// Returns the pointer past the complete item at p, or nullptr if it is malformed
+const uint8_t *CborValue::skip(const uint8_t *p, const uint8_t *end, int depth)
+{
+    if (depth > MAX_DEPTH)
+        return nullptr;
+
+    uint8_t major, ai;
+    uint64_t arg;
+    p = readHead(p, end, major, ai, arg);
+    if (!p)
+        return nullptr;
+
+    switch (major)
+    {
+    case MAJOR_BYTES:
+    case MAJOR_TEXT:
+        if ((uint64_t)(end - p) < arg)
+            return nullptr;
+        return p + arg;
+    case MAJOR_ARRAY:
+    case MAJOR_MAP:
+    {
+        uint64_t items = (major == MAJOR_MAP) ? arg * 2 : arg;
+        // Every item is at least one byte; rejects absurd counts before looping
+        if (items > (uint64_t)(end - p) || (major == MAJOR_MAP && arg > items))
+            return nullptr;
+        for (uint64_t i = 0; i < items && p; ++i)
+            p = skip(p, end, depth + 1);
+        return p;
+    }
+    case MAJOR_TAG:
+        return skip(p, end, depth + 1);
+    case MAJOR_SIMPLE:
+        if (ai == 24 && arg < 32)
+            return nullptr; // non-canonical simple value encoding
+        return p;
+    default:
+        return p;
+    }
+}
+
+// Decodes the head of an item already validated by skip()
+CborValue CborValue::decode(const uint8_t *p, const uint8_t *end)
+{
+    uint8_t major, ai;
+    uint64_t arg;
+    const uint8_t *item = p;
+    p = readHead(p, end, major, ai, arg);
+    while (p && major == MAJOR_TAG)
+    {
+        item = p;
+        p = readHead(p, end, major, ai, arg);
+    }
+    if (!p)
+        return CborValue();
+
+    Type kind;
+    switch (major)
+    {
+    case MAJOR_UINT:
+        kind = Type::Unsigned;
+        break;
+    case MAJOR_NINT:
+        kind = Type::Negative;
+        break;
+    case MAJOR_BYTES:
+        kind = Type::Bytes;
+        break;
+    case MAJOR_TEXT:
+        kind = Type::Text;
+        break;
+    case MAJOR_ARRAY:
+        kind = Type::Array;
+        break;
+    case MAJOR_MAP:
+        kind = Type::Map;
+        break;
+    default:
+        if (ai == SIMPLE_FALSE || ai == SIMPLE_TRUE)
+            kind = Type::Bool;
+        else if (ai == SIMPLE_NULL)
+            kind = Type::Null;
+        else if (ai == AI_HALF || ai == AI_FLOAT || ai == AI_DOUBLE)
+            kind = Type::Float;
+        else
+            kind = Type::Undefined;
+        break;
+    }
+    return CborValue(kind, item, p, end, arg);
+}
+
+int64_t CborValue::toInt(int64_t defaultValue) const
+{
+    switch (kind)
+    {
+    case Type::Unsigned:
+        return (int64_t)arg;
+    case Type::Negative:
+        return -1 - (int64_t)arg;
+    case Type::Float:
+        return (int64_t)toDouble();
+    case Type::Bool:
+        return arg == SIMPLE_TRUE;
+    default:
+        return defaultValue;
+    }
+}
+
+double CborValue::toDouble(double defaultValue) const
+{
+    switch (kind)
+    {
+    case Type::Unsigned:
+    case Type::Negative:
+        return (double)toInt();
+    case Type::Float:
+    {
+        uint8_t ai = *item & 0x1f;
+        if (ai == AI_HALF)
+            return halfToDouble((uint16_t)arg);
+        if (ai == AI_FLOAT)
+        {
+            uint32_t bits = (uint32_t)arg;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+        double d;
+        memcpy(&d, &arg, sizeof(d));
+        return d;
+    }
+    default:
+        return defaultValue;
+    }
+}
+
+bool CborValue::toBool(bool defaultValue) const
+{
+    if (kind == Type::Bool)
+        return arg == SIMPLE_TRUE;
+    return defaultValue;
+}
+
+String CborValue::toString() const
+{
+    size_t len;
+    const uint8_t *data = bytes(len);
+    if (!data)
+        return String();
+    return String(data, len);
+}
+
+const uint8_t *CborValue::bytes(size_t &len) const
+{
+    if (kind != Type::Text && kind != Type::Bytes)
+    {
+        len = 0;
+        return nullptr;
+    }
+    len = (size_t)arg;
+    return payload;
+}
+
+size_t CborValue::size() const
+{
+    return (kind == Type::Array || kind == Type::Map) ? (size_t)arg : 0;
+}
+
+CborValue CborValue::at(size_t index) const
+{
+    if (kind != Type::Array || index >= arg)
+        return CborValue();
+    const uint8_t *p = payload;
+    for (size_t i = 0; i < index; ++i)
+        p = skip(p, end, 0);
+    return decode(p, end);
+}
+
+CborValue CborValue::get(const char *key) const
+{
+    if (kind != Type::Map || !key)
+        return CborValue();
+    size_t keyLen = strlen(key);
+    const uint8_t *p = payload;
+    for (uint64_t i = 0; i < arg; ++i)
+    {
+        CborValue k = decode(p, end);
+        p = skip(p, end, 0);
+        size_t len;
+        const uint8_t *text = k.bytes(len);
+        if (k.kind == Type::Text && len == keyLen && memcmp(text, key, len) == 0)
+            return decode(p, end);
+        p = skip(p, end, 0);
+    }
+    return CborValue();
+}
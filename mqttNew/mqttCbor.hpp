@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "WString.h"
+
+/**
+ * @brief Heap-free CBOR (RFC 8949) encoder writing into a caller-provided buffer
+ *
+ * Containers are definite-length, so the number of items/pairs must be known
+ * when they are opened. Once the buffer overflows every further write is a
+ * no-op and ok() returns false.
+ */
+class CborWriter
+{
+public:
+    /**
+     * @brief Construct a writer over an existing buffer
+     *
+     * @param buffer            Destination buffer (owned by the caller)
+     * @param capacity          Size of the destination buffer in bytes
+     */
+    CborWriter(uint8_t *buffer, size_t capacity);
+
+    CborWriter &beginArray(size_t count);
+    CborWriter &beginMap(size_t pairs);
+
+    CborWriter &writeUInt(uint64_t value);
+    CborWriter &writeInt(int64_t value);
+    CborWriter &writeFloat(float value);
+    CborWriter &writeDouble(double value);
+    CborWriter &writeBool(bool value);
+    CborWriter &writeNull();
+    CborWriter &writeText(const char *text);
+    CborWriter &writeText(const char *text, size_t len);
+    CborWriter &writeText(const String &text);
+    CborWriter &writeBytes(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Discard everything written so far and clear the overflow flag
+     */
+    void reset();
+
+    /**
+     * @brief Check that every write so far fitted into the buffer
+     *
+     * @return true if the encoded data is complete
+     *         false if the buffer overflowed
+     */
+    bool ok() const { return !overflow; }
+
+    const uint8_t *data() const { return buffer; }
+    size_t size() const { return length; }
+
+private:
+    void writeHead(uint8_t major, uint64_t value);
+    void writeRaw(const void *src, size_t len);
+
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length = 0;
+    bool overflow = false;
+};
+
+/**
+ * @brief Zero-copy view of a single CBOR data item
+ *
+ * A CborValue only points into the buffer it was parsed from; that buffer must
+ * outlive every value derived from it. Tags are skipped transparently;
+ * indefinite-length items are not supported and make parse() fail.
+ */
+class CborValue
+{
+public:
+    enum class Type : uint8_t
+    {
+        Invalid,
+        Unsigned,
+        Negative,
+        Bytes,
+        Text,
+        Array,
+        Map,
+        Float,
+        Bool,
+        Null,
+        Undefined,
+    };
+
+    CborValue() = default;
+
+    /**
+     * @brief Validate a complete encoded item and return a view of its root
+     *
+     * @param data              Encoded CBOR buffer
+     * @param len               Length of the buffer in bytes
+     * @return Root value, or an invalid value if the buffer is malformed,
+     *         nests too deeply or has trailing bytes
+     */
+    static CborValue parse(const uint8_t *data, size_t len);
+
+    Type type() const { return kind; }
+    bool isValid() const { return kind != Type::Invalid; }
+    bool isMap() const { return kind == Type::Map; }
+    bool isArray() const { return kind == Type::Array; }
+
+    int64_t toInt(int64_t defaultValue = 0) const;
+    double toDouble(double defaultValue = 0) const;
+    bool toBool(bool defaultValue = false) const;
+
+    /**
+     * @brief Copy a text or byte string into a String (allocates)
+     */
+    String toString() const;
+
+    /**
+     * @brief Borrow the contents of a text or byte string without copying
+     *
+     * @param len               Receives the length in bytes
+     * @return Pointer into the source buffer, or nullptr if not a string
+     */
+    const uint8_t *bytes(size_t &len) const;
+
+    /**
+     * @brief Number of elements of an array, or key/value pairs of a map
+     */
+    size_t size() const;
+
+    /**
+     * @brief Array element at the given index (linear scan)
+     */
+    CborValue at(size_t index) const;
+
+    /**
+     * @brief Map value for a text key (linear scan)
+     *
+     * @return The value, or an invalid value if the key is absent
+     */
+    CborValue get(const char *key) const;
+
+    bool has(const char *key) const { return get(key).isValid(); }
+
+private:
+    CborValue(Type kind, const uint8_t *item, const uint8_t *payload, const uint8_t *end, uint64_t arg);
+
+    static CborValue decode(const uint8_t *p, const uint8_t *end);
+    static const uint8_t *skip(const uint8_t *p, const uint8_t *end, int depth);
+
+    Type kind = Type::Invalid;
+    const uint8_t *item = nullptr;    // first byte of the item head
+    const uint8_t *payload = nullptr; // first byte after the head
+    const uint8_t *end = nullptr;     // end of the source buffer
+    uint64_t arg = 0;                 // head argument (value, length or count)
+
+    static constexpr int MAX_DEPTH = 16;
+};
@@ -82,6 +82,23 @@ int MqttClient::publish(const String &topic, const String &payload, int qos, int
     return esp_mqtt_client_publish(client, topic.c_str(), payload.c_str(), payload.length(), qos, retain);
 }
 
+int MqttClient::publishCbor(const String &topic, const CborWriter &writer, int qos, int retain)
+{
+    if (!writer.ok())
+    {
+        ESP_LOGE(TAG, "CBOR payload overflowed its buffer for topic: %s", topic.c_str());
+        return ESP_FAIL;
+    }
+    return publishCbor(topic, writer.data(), writer.size(), qos, retain);
+}
+
+int MqttClient::publishCbor(const String &topic, const uint8_t *data, size_t len, int qos, int retain)
+{
+    if (!client)
+        return ESP_FAIL;
+    return esp_mqtt_client_publish(client, topic.c_str(), reinterpret_cast<const char *>(data), len, qos, retain);
+}
+
 int MqttClient::subscribe(const String &topic, int qos)
 {
     if (!client)
@@ -126,6 +143,26 @@ void MqttClient::registerJsonCallback(const String &topic, std::function<void(cJ
     }
 }
 
+void MqttClient::registerCborCallback(const String &topic, std::function<void(const CborValue &root)> callback, int qos, bool oneShot)
+{
+    topicCallbacks[topic] = {qos, nullptr, nullptr, {}, oneShot, callback};
+    if (connected)
+    {
+        subscribe(topic, qos);
+        ESP_LOGD(TAG, "Subscribed (late) to topic: %s", topic.c_str());
+    }
+}
+
+void MqttClient::registerCborCallback(const String &topic, std::function<void(const CborValue &root)> callback, const std::vector<String> &requiredKeys, int qos, bool oneShot)
+{
+    topicCallbacks[topic] = {qos, nullptr, nullptr, requiredKeys, oneShot, callback};
+    if (connected)
+    {
+        subscribe(topic, qos);
+        ESP_LOGD(TAG, "Subscribed (late) to topic: %s", topic.c_str());
+    }
+}
+
 void MqttClient::unregisterCallback(const String &topic)
 {
     auto it = topicCallbacks.find(topic);
@@ -180,15 +217,47 @@ void MqttClient::handleEvent(esp_mqtt_event_handle_t event)
     case MQTT_EVENT_DATA:
     {
         String topic(event->topic, event->topic_len);
-        String payload(event->data, event->data_len);
-
-        ESP_LOGD(TAG, "Received on [%s]: %s", topic.c_str(), payload.c_str());
 
         // Call registered callback
         auto it = topicCallbacks.find(topic);
         if (it != topicCallbacks.end())
         {
             auto entry = it->second;
+            if (entry.cborCallback)
+            {
+                // Decoded in place from the event buffer, no String copy
+                ESP_LOGD(TAG, "Received %d CBOR bytes on [%s]", event->data_len, topic.c_str());
+                CborValue root = CborValue::parse(reinterpret_cast<const uint8_t *>(event->data), event->data_len);
+                if (!root.isValid())
+                    ESP_LOGE(TAG, "Invalid CBOR on topic: %s", topic.c_str());
+                else
+                {
+                    bool valid = true;
+                    for (const auto &key : entry.requiredKeys)
+                    {
+                        if (!root.has(key.c_str()))
+                        {
+                            ESP_LOGE(TAG, "CBOR missing required key '%s' on topic: %s", key.c_str(), topic.c_str());
+                            valid = false;
+                            break;
+                        }
+                    }
+
+                    if (valid)
+                    {
+                        entry.cborCallback(root);
+                    }
+                }
+                if (entry.oneShot)
+                {
+                    unregisterCallback(topic);
+                }
+                break;
+            }
+
+            String payload(event->data, event->data_len);
+            ESP_LOGD(TAG, "Received on [%s]: %s", topic.c_str(), payload.c_str());
+
             if (entry.strCallback)
                 entry.strCallback(payload);
             else if (entry.jsonCallback)
@@ -5,6 +5,7 @@
 #include "WString.h"
 #include "mqtt_client.h"
 #include "cJSON.h"
+#include "mqttCbor.hpp"
 
 class MqttClient
 {
@@ -49,6 +50,31 @@ public:
      */
     int publish(const String &topic, const String &payload, int qos = 1, int retain = 0);
 
+    /**
+     * @brief Publish a CBOR-encoded message to a specific topic
+     *
+     * @param topic             MQTT topic string
+     * @param writer            Writer holding the encoded payload (must be ok())
+     * @param qos               Quality of Service level (default 1)
+     * @param retain            Retain flag (default 0)
+     * @return Message ID of the publish on success
+     *         -1 if publishing failed or the writer overflowed
+     */
+    int publishCbor(const String &topic, const CborWriter &writer, int qos = 1, int retain = 0);
+
+    /**
+     * @brief Publish an already encoded CBOR buffer to a specific topic
+     *
+     * @param topic             MQTT topic string
+     * @param data              Encoded CBOR payload
+     * @param len               Payload length in bytes
+     * @param qos               Quality of Service level (default 1)
+     * @param retain            Retain flag (default 0)
+     * @return Message ID of the publish on success
+     *         -1 if publishing failed
+     */
+    int publishCbor(const String &topic, const uint8_t *data, size_t len, int qos = 1, int retain = 0);
+
     /**
      * @brief Subscribe to a specific MQTT topic
      *
@@ -128,6 +154,29 @@ public:
      */
     void registerJsonCallback(const String &topic, std::function<void(cJSON *json)> callback, const std::vector<String> &requiredKeys, int qos = 1, bool oneShot = false);
 
+    /**
+     * @brief Register a CBOR callback for a specific topic without key validation
+     *
+     * @param topic             MQTT topic string
+     * @param callback          Callback function accepting the decoded root value;
+     *                          the value points into the MQTT event buffer and is
+     *                          only valid for the duration of the call
+     * @param qos               Quality of Service level (default 1)
+     * @param oneShot           If true, the callback is unregistered after first invocation
+     */
+    void registerCborCallback(const String &topic, std::function<void(const CborValue &root)> callback, int qos = 1, bool oneShot = false);
+
+    /**
+     * @brief Register a CBOR callback for a specific topic with required key validation
+     *
+     * @param topic             MQTT topic string
+     * @param callback          Callback function accepting the decoded root value
+     * @param requiredKeys      List of required map keys to validate before invoking callback
+     * @param qos               Quality of Service level (default 1)
+     * @param oneShot           If true, the callback is unregistered after first invocation
+     */
+    void registerCborCallback(const String &topic, std::function<void(const CborValue &root)> callback, const std::vector<String> &requiredKeys, int qos = 1, bool oneShot = false);
+
     /**
      * @brief Unregister a previously registered callback for a given topic
      *
@@ -160,8 +209,9 @@ private:
         int qos;
         std::function<void(const String &payload)> strCallback;
         std::function<void(cJSON *json)> jsonCallback;
-        std::vector<String> requiredKeys; // for JSON validation
+        std::vector<String> requiredKeys; // for JSON/CBOR validation
         bool oneShot = false;
+        std::function<void(const CborValue &root)> cborCallback;
     };
     std::map<String, CallbackEntry> topicCallbacks;
 